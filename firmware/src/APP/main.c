@@ -27,6 +27,9 @@
 #include "can.h"
 #include "control_api.h"
 #include "calibration.h"
+#include "autotune.h"
+#include "anticogging.h"
+#include "friction.h"
 #include "nonvolatile.h"
 #include "actuator_config.h"
 #include "display.h"
@@ -84,6 +87,8 @@ void User_confirmation(void){
 
 static bool runCalibration = false;
 static bool runKbemfEstimation = false;
+static bool runLatencyIdentification = false;
+static bool runAutotune = false;
 static void RunCalibration(void){
 	StepperCtrl_enable(false);
 	apiAllowControl(false);
@@ -95,6 +100,7 @@ static void RunCalibration(void){
 	do{
 		(void) printf("1. Motor type and wiring orientation detection\n");
 		(void) printf("2. Magnet offset calibration.\n");
+		(void) printf("3. Cogging map.\n");
 		User_confirmation();
 		err0 = !Learn_StepSize_WiringPolarity();
 		if (err0){
@@ -130,11 +136,17 @@ static void RunCalibration(void){
 			delay_ms(1000);
 		}
 	}while(err1 || err2);
-	Set_Error_LED(false);
 	(void) printf("Calibration OK\n");
 
-	runCalibration = false;
 	StepperCtrl_enable(true);
+	//the cogging map is measured in closeloop - after the calibration table is ready
+	int8_t cogging_err = Anticogging_calibrate();
+	if (cogging_err != 0){
+		(void) printf("ERROR: Cogging map failed (%d). Continuing without anticogging\n", cogging_err);
+	}
+	Set_Error_LED(false);
+
+	runCalibration = false;
 	apiAllowControl(true);
 }
 
@@ -203,12 +215,38 @@ static void Background_process(void){
 	if(runCalibration){
 		RunCalibration();
 	}
+	CalibrationTable_refine();
 	if(runKbemfEstimation){
 		apiAllowControl(false);
 		Estimate_motor_k_bemf();
 		runKbemfEstimation = false;
 		apiAllowControl(true);
 	}
+	if(runLatencyIdentification){
+		apiAllowControl(false);
+		int8_t latency_err = Identify_sensor_latency(); //uses motor_k_bemf - estimate it first
+		if (latency_err != 0){
+			(void) printf("ERROR: Sensor latency identification failed (%d). Keeping %u us\n", latency_err, Encoder_latency_us());
+		}else{
+			(void) printf("Sensor latency: %u us\n", Encoder_latency_us());
+		}
+		runLatencyIdentification = false;
+		apiAllowControl(true);
+	}
+	if(runAutotune){
+		apiAllowControl(false);
+		int8_t friction_err = Friction_identify(); //first, so that the PID is tuned with the friction feedforward
+		if (friction_err != 0){
+			(void) printf("ERROR: Friction identification failed (%d). PID autotune skipped\n", friction_err);
+		}else{
+			int8_t autotune_err = Autotune_pid();
+			if (autotune_err != 0){
+				(void) printf("ERROR: PID autotune failed (%d)\n", autotune_err);
+			}
+		}
+		runAutotune = false;
+		apiAllowControl(true);
+	}
 }
 
 //fast motor control task
@@ -225,10 +263,9 @@ void Motion_task(void){
 void Service_task(void){
 	service_task_counter++;
 
-	adc_update_all();
-	
 	//transmit CAN every 10ms
 	CAN_TransmitMotorStatus(service_task_counter);
+	CAN_TransmitLoadStatus(service_task_counter);
 
 	//go to Soft Off if motor is actively controlled but control signal is not received
 	bool comm_error = false;
@@ -241,9 +278,10 @@ void Service_task(void){
 	}
 
 	const uint16_t button_delay_calib = 200U;//hold 2s to trigger calibration
+	const uint16_t button_delay_latency = 600U;//hold F2 6s to trigger the sensor latency identification instead of motor_k_bemf
 	//Function button and LED processing
 	static uint16_t f1_button_count = 0; //centiseconds
-	if(F1_button_state() && (stepCtrlError == STEPCTRL_NO_ERROR)){//look for button long press
+	if(F1_button_state() && !F2_button_state() && (stepCtrlError == STEPCTRL_NO_ERROR)){//look for button long press
 		f1_button_count++;
 		StepperCtrl_setControlMode(STEPCTRL_FEEDBACK_SOFT_TORQUE_OFF);
 	}
@@ -258,18 +296,39 @@ void Service_task(void){
 
 	//Function button and LED processing
 	static uint16_t f2_button_count = 0; //centiseconds
-	if(F2_button_state() && (stepCtrlError == STEPCTRL_NO_ERROR)){//look for button long press
+	if(F2_button_state() && !F1_button_state() && (stepCtrlError == STEPCTRL_NO_ERROR)){//look for button long press
 		f2_button_count++;
 		StepperCtrl_setControlMode(STEPCTRL_FEEDBACK_SOFT_TORQUE_OFF);
 	}
 	if(f2_button_count == (button_delay_calib-10U))	{Set_Func_LED(true);} 	//short LED blink
 	if(	f2_button_count == button_delay_calib)		{Set_Func_LED(false);}
-	if((f2_button_count >= button_delay_calib)  && (!F2_button_state())){ 	//wait for button release
+	if(f2_button_count == (button_delay_latency-10U))	{Set_Func_LED(true);} 	//second short LED blink
+	if(	f2_button_count == button_delay_latency)		{Set_Func_LED(false);}
+	if((f2_button_count >= button_delay_latency)  && (!F2_button_state())){ 	//wait for button release
+		runLatencyIdentification = true;
+	}else if((f2_button_count >= button_delay_calib)  && (!F2_button_state())){
 		runKbemfEstimation = true;
 	}
 	if(!F2_button_state()){
 		f2_button_count=0;
 	}
+
+	//Both function buttons - position PID autotune
+	static uint16_t f12_button_count = 0; //centiseconds
+	if(F1_button_state() && F2_button_state() && (stepCtrlError == STEPCTRL_NO_ERROR)){//look for buttons long press
+		f12_button_count++;
+		f1_button_count = 0;
+		f2_button_count = 0;
+		StepperCtrl_setControlMode(STEPCTRL_FEEDBACK_SOFT_TORQUE_OFF);
+	}
+	if(f12_button_count == (button_delay_calib-10U))	{Set_Func_LED(true);} 	//short LED blink
+	if(	f12_button_count == button_delay_calib)		{Set_Func_LED(false);}
+	if((f12_button_count >= button_delay_calib)  && (!F1_button_state()) && (!F2_button_state())){ 	//wait for buttons release
+		runAutotune = true;
+	}
+	if(!F1_button_state() && !F2_button_state()){
+		f12_button_count=0;
+	}
 }
 
 #ifndef PIO_UNIT_TESTING 
@@ -41,12 +41,12 @@ void app_upgrade_begin(void){
 	version_upgrade = 3000U;
 	if((read_previous_fw_version() < version_upgrade) && (read_current_fw_version() >= version_upgrade)){  // cppcheck-suppress  knownConditionTrueFalse
 		// upgrade angle cals to new voltage-control that uses different uses canonical Parke transformation
-		FlashCalData_t updated_cal;
+		FlashCalData_t updated_cal; //firmware before v3 only wrote legacy tables
 		updated_cal.status = nvmFlashCalData->status;
-		for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; ++i ){
+		for (uint16_t i=0; i < CALIBRATION_LEGACY_TABLE_SIZE; ++i ){
 			updated_cal.FlashCalData[i] = nvmFlashCalData->FlashCalData[i] + (uint16_t)(ANGLE_STEPS / nvmMirror.motorParams.fullStepsPerRotation);
 		}
-		nvmWriteCalTable(&updated_cal);
+		nvmWriteCalTable(&updated_cal, (uint16_t)sizeof(updated_cal));
 	}
 
 	//downgrade v3 -> v2
@@ -56,10 +56,10 @@ void app_upgrade_begin(void){
 		// upgrade angle cals to new voltage-control that uses different uses canonical Parke transformation
 		FlashCalData_t updated_cal;
 		updated_cal.status = nvmFlashCalData->status;
-		for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; ++i ){
+		for (uint16_t i=0; i < CALIBRATION_LEGACY_TABLE_SIZE; ++i ){
 			updated_cal.FlashCalData[i] = nvmFlashCalData->FlashCalData[i] - (uint16_t)(ANGLE_STEPS / nvmMirror.motorParams.fullStepsPerRotation);
 		}
-		nvmWriteCalTable(&updated_cal);
+		nvmWriteCalTable(&updated_cal, (uint16_t)sizeof(updated_cal));
 	}
 	
 	save_current_fw_version();
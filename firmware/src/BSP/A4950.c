@@ -53,25 +53,36 @@ const uint16_t dacPhaseLead[PHASE_LEAD_MAX_SPEED] = {
 
 volatile bool driverEnabled = false;
 
+//voltage drive of a bridge seen by its LSS sample
+typedef struct {
+	uint16_t pulse;	//PWM_TIM counts of the drive pulse either side of its center
+	bool positive;	//phase current direction through the sense resistor while driving
+} BridgeDrive_t;
+
+//last commands - apply at the next PWM_TIM update
+static BridgeDrive_t driveA_last;
+static BridgeDrive_t driveB_last;
+//bridge A is sampled at the overflow, half a period after the update that applied its command
+static BridgeDrive_t driveA_prev;
+
 /** 
  * Selects drive direction in current control mode
  * Compatible with GPIO_Mode_Out_PP and GPIO_Mode_AF_PP (timer) pin configurations
 **/
 inline static void bridgeA(int state){
-	//Make sure the PIN_A4950_INs timer is counting to 1 to emulate GPIO
-	TIM_SetAutoreload(PWM_TIM, PWM_TIM_MIN); //Count to 1. This is to use timer output as a gpio, because reconfiguring the pins to gpio online with CLR MODE register was annoying.
+	//PWM_TIM keeps its period (it paces the motion task) - the outputs are held with compare 0 or PWM_TIM_ON
 	if (state == 1){ //Forward
 		//User BRR BSRR reguisters to avoid ASSERT ehecution from HAL
 		PIN_A4950->BSRR = PIN_A4950_IN1;	//GPIO_SetBits(PIN_A4950, PIN_A4950_IN1);		//IN1=1
 		PIN_A4950->BRR = PIN_A4950_IN2;		//GPIO_ResetBits(PIN_A4950, PIN_A4950_IN2);		//IN2=0
-		TIM_SetCompare1(PWM_TIM, PWM_TIM_MIN+1);
+		TIM_SetCompare1(PWM_TIM, PWM_TIM_ON);
 		TIM_SetCompare2(PWM_TIM, 0);
 	}
 	if (state == 0){ //Reverse
 		PIN_A4950->BRR = PIN_A4950_IN1;		//GPIO_ResetBits(PIN_A4950, PIN_A4950_IN1);		//IN1=0	
 		PIN_A4950->BSRR = PIN_A4950_IN2;	//GPIO_SetBits(PIN_A4950, PIN_A4950_IN2);		//IN2=1
 		TIM_SetCompare1(PWM_TIM, 0);
-		TIM_SetCompare2(PWM_TIM, PWM_TIM_MIN+1);
+		TIM_SetCompare2(PWM_TIM, PWM_TIM_ON);
 	}
 	if (state == 3){ //Coast (off)
 		PIN_A4950->BRR = PIN_A4950_IN1;		//GPIO_ResetBits(PIN_A4950, PIN_A4950_IN1);		//IN1=0
@@ -82,8 +93,8 @@ inline static void bridgeA(int state){
 	if (state == 4){ //brake
 		PIN_A4950->BSRR = PIN_A4950_IN1;		//GPIO_SetBits(PIN_A4950, PIN_A4950_IN1);	//IN1=1
 		PIN_A4950->BSRR = PIN_A4950_IN2;		//GPIO_SetBits(PIN_A4950, PIN_A4950_IN2);	//IN2=1
-		TIM_SetCompare1(PWM_TIM, PWM_TIM_MIN+1);
-		TIM_SetCompare2(PWM_TIM, PWM_TIM_MIN+1);
+		TIM_SetCompare1(PWM_TIM, PWM_TIM_ON);
+		TIM_SetCompare2(PWM_TIM, PWM_TIM_ON);
 	}
 }
 
@@ -92,25 +103,24 @@ inline static void bridgeA(int state){
  * Compatible with GPIO_Mode_Out_PP and GPIO_Mode_AF_PP (timer) pin configurations
 **/
 inline static void bridgeB(int state){
-	// Make sure the PIN_A4950_INs timer is counting only to 1 to emulate GPIO
-	TIM_SetAutoreload(PWM_TIM, PWM_TIM_MIN); //Count to 1. This is to use timer output as a gpio, because reconfiguring the pins to gpio online with CLR MODE register was annoying.
+	//PWM_TIM keeps its period (it paces the motion task) - the outputs are held with compare 0 or PWM_TIM_ON
 	if (state == 1){ //Forward
 		PIN_A4950->BRR = PIN_A4950_IN3;	//GPIO_SetBits(PIN_A4950, PIN_A4950_IN3);		//IN3=1
 		PIN_A4950->BSRR = PIN_A4950_IN4;		//GPIO_ResetBits(PIN_A4950, PIN_A4950_IN4);		//IN4=0
 		TIM_SetCompare3(PWM_TIM, 0);
-		TIM_SetCompare4(PWM_TIM, PWM_TIM_MIN+1);
+		TIM_SetCompare4(PWM_TIM, PWM_TIM_ON);
 	}
 	if (state == 0){ //Reverse
 		PIN_A4950->BSRR = PIN_A4950_IN3;		//GPIO_ResetBits(PIN_A4950, PIN_A4950_IN3);		//IN3=0
 		PIN_A4950->BRR = PIN_A4950_IN4;	//GPIO_SetBits(PIN_A4950, PIN_A4950_IN4);		//IN4=1
-		TIM_SetCompare3(PWM_TIM, PWM_TIM_MIN+1);
+		TIM_SetCompare3(PWM_TIM, PWM_TIM_ON);
 		TIM_SetCompare4(PWM_TIM, 0);
 	}
 	if (state == 3){ //Coast (off)
 		PIN_A4950->BSRR = PIN_A4950_IN3;		//GPIO_ResetBits(PIN_A4950, PIN_A4950_IN3);		//IN3=0
 		PIN_A4950->BSRR = PIN_A4950_IN4;		//GPIO_ResetBits(PIN_A4950, PIN_A4950_IN4);		//IN4=0
-		TIM_SetCompare3(PWM_TIM, PWM_TIM_MIN+1);
-		TIM_SetCompare4(PWM_TIM, PWM_TIM_MIN+1);
+		TIM_SetCompare3(PWM_TIM, PWM_TIM_ON);
+		TIM_SetCompare4(PWM_TIM, PWM_TIM_ON);
 	}
 	if (state == 4){ //brake
 		PIN_A4950->BRR = PIN_A4950_IN3;	//GPIO_SetBits(PIN_A4950, PIN_A4950_IN1);		//IN3=1
@@ -137,7 +147,14 @@ static uint16_t current_to_Vref_duty(uint16_t current)
 	if(vref > mcu_volt){
 		vref = mcu_volt;
 	}
-	uint16_t vref_duty = (uint16_t)((uint32_t) vref * VREF_TIM_MAX / mcu_volt);
+	//VREF_TIM_MAX/mcu_volt in Q16 (rounded up so that vref == mcu_volt gives VREF_TIM_MAX), refreshed when the voltage changes
+	static uint16_t mcu_volt_src = 0;
+	static uint32_t vref_duty_mul = 0;
+	if(mcu_volt != mcu_volt_src){
+		mcu_volt_src = mcu_volt;
+		vref_duty_mul = (((uint32_t)VREF_TIM_MAX << 16) + mcu_volt - 1U) / max((uint32_t)mcu_volt, 1U);
+	}
+	uint16_t vref_duty = (uint16_t)(((uint32_t) vref * vref_duty_mul) >> 16);
 	return vref_duty;
 }
 
@@ -161,9 +178,6 @@ inline static void set_curr(uint16_t curr_lim_A, uint16_t curr_lim_B)
  */
 static const bool slow_decay = true;
 static void setPWM_bridgeA(uint16_t duty, bool quadrant1or2){
-	//Make sure the PIN_A4950_INs have running timer
-	TIM_SetAutoreload(PWM_TIM, PWM_TIM_MAX);
-
 	uint16_t pwm_count = min(duty, PWM_TIM_MAX);
 
 	if (slow_decay){ //slow decay, zero duty is brake (phase shorted to ground ob both ends)
@@ -197,9 +211,6 @@ static void setPWM_bridgeA(uint16_t duty, bool quadrant1or2){
  * @param quadrant3or4 - determines phase polarity
  */
 static void setPWM_bridgeB(uint16_t duty, bool quadrant3or4){
-	//Make sure the PIN_A4950_INs are configured as PWM
-	TIM_SetAutoreload(PWM_TIM, PWM_TIM_MAX);
-
 	uint16_t pwm_count = min(duty, PWM_TIM_MAX);
 
 	if (slow_decay){
@@ -249,7 +260,17 @@ void A4950_enable(bool enable)
  * @param I_b - phase B requested current
  * @param curr_lim - current limit applied to each phase
  */
+//drive pulses of the commands - the pulse is half of the drive time of the period, center aligned
+static void drive_record(uint16_t duty_a, bool positive_a, uint16_t duty_b, bool positive_b){
+	driveA_prev = driveA_last;
+	driveA_last.pulse = duty_a;
+	driveA_last.positive = positive_a;
+	driveB_last.pulse = duty_b;
+	driveB_last.positive = positive_b;
+}
+
 void phase_current_command(int16_t I_a, int16_t I_b){
+	drive_record(0, false, 0, false); //the A4950 regulator off time is not known - no valid samples
 	if (driverEnabled == false){
 		set_curr(0,0); 	//turn current off
 		bridgeA(3); 	//tri state bridge outputs
@@ -266,25 +287,73 @@ void phase_current_command(int16_t I_a, int16_t I_b){
 	}
 }
 
+/**
+ * @brief Dead time compensation - during the crossover delay of a switching output the current flows
+ * through a body diode, which pulls the phase voltage against the current by the bus voltage and two diode drops.
+ * 
+ * @param U - phase voltage, mV
+ * @param I - phase current reference, mA
+ * @param U_in - bus voltage, mV
+ * @return int16_t - compensated phase voltage, mV
+ */
+static int16_t dead_time_compensation(int16_t U, int16_t I, uint16_t U_in){
+	int32_t U_dead = (int32_t)(((uint32_t)U_in + (2U * BODY_DIODE_DROP_mV)) * CROSSOVER_DELAY_nS / ((uint32_t)SAMPLING_PERIOD_uS * us_to_ns)); //one delayed edge per PWM period
+	int32_t U_comp = U_dead * clip((int32_t)I, -DEAD_TIME_CURRENT_BAND, DEAD_TIME_CURRENT_BAND) / DEAD_TIME_CURRENT_BAND;
+	return (int16_t)clip((int32_t)U + U_comp, INT16_MIN, INT16_MAX);
+}
+
 /**
  * @brief Voltage based phase activation with current limit
  * 
  * @param U_a - phase A requested voltage
  * @param U_b - phase B requested voltage
+ * @param I_a - phase A current reference for the dead time compensation, zero without
+ * @param I_b - phase B current reference
  * @param curr_lim - current limit applied to each phase
  */
-void phase_voltage_command(int16_t U_a, int16_t U_b, uint16_t curr_lim){
+void phase_voltage_command(int16_t U_a, int16_t U_b, int16_t I_a, int16_t I_b, uint16_t curr_lim){
 	if (driverEnabled == false){
+		drive_record(0, false, 0, false);
 		set_curr(0,0); 	//turn current off
 		bridgeA(3); 	//tri state bridge outputs
 		bridgeB(3); 	//tri state bridge outputs
 	}else{
 		set_curr(curr_lim, curr_lim); 
 
+		//PWM_TIM_MAX/U_in in Q16, refreshed when the voltage changes
+		static uint16_t U_in_src = 0;
+		static uint32_t pwm_duty_mul = 0;
 		uint16_t U_in = GetMotorVoltage_mV();
-		uint16_t duty_a = (uint16_t)(fastAbs(U_a) * PWM_TIM_MAX / U_in);
-		uint16_t duty_b = (uint16_t)(fastAbs(U_b) * PWM_TIM_MAX / U_in);
+		if(U_in != U_in_src){
+			U_in_src = U_in;
+			pwm_duty_mul = (((uint32_t)PWM_TIM_MAX << 16) + U_in - 1U) / max((uint32_t)U_in, 1U);
+		}
+		U_a = dead_time_compensation(U_a, I_a, U_in);
+		U_b = dead_time_compensation(U_b, I_b, U_in);
+		uint16_t duty_a = (uint16_t)(((uint64_t)fastAbs(U_a) * pwm_duty_mul) >> 16);
+		uint16_t duty_b = (uint16_t)(((uint64_t)fastAbs(U_b) * pwm_duty_mul) >> 16);
 		setPWM_bridgeA(duty_a, (U_a > 0)); //PWM12
 		setPWM_bridgeB(duty_b, liveMotorParams.invertedPhase ? (U_b < 0) : (U_b > 0)); //PWM34
+		drive_record(duty_a, (U_a > 0), duty_b, (U_b > 0));
 	}
+}
+
+/**
+ * @brief Phase currents of the last LSS samples, taken at the center of the drive pulses (see board.c)
+ * The sense resistor sees the current only while the bridge drives it and only in the drive direction,
+ * the sign comes from the command. A phase is not valid when its pulse is too short to settle,
+ * or when the sample is zero - no current or current against the drive (regeneration through the high side).
+ * Call from the motion task before the next command.
+ * 
+ * @param sample - phase currents in mA
+ */
+void phase_current_sample(PhaseCurrents_t *sample){
+	uint16_t pulse_min = (uint16_t)((uint32_t)PWM_TIM_MAX * 2U * LSS_SAMPLE_SETTLE_uS / SAMPLING_PERIOD_uS); //PWM_TIM_MAX is half the period
+	uint16_t lss_a = Get_PhaseA_Current_mA();
+	uint16_t lss_b = Get_PhaseB_Current_mA();
+
+	sample->valid_a = (driveA_prev.pulse >= pulse_min) && (lss_a > 0U);
+	sample->valid_b = (driveB_last.pulse >= pulse_min) && (lss_b > 0U);
+	sample->I_a = (int16_t)(driveA_prev.positive ? lss_a : -lss_a);
+	sample->I_b = (int16_t)(driveB_last.positive ? lss_b : -lss_b);
 }
\ No newline at end of file
@@ -26,7 +26,6 @@
 
 //VREF_SCALER reduces PWM resolution by 2^VREF_SCALER but increases PWM freqency by 2^(VREF_SCALER-1)
 #define VREF_SCALER	6U
-#define PWM_SCALER	4U // lower numbers are audible (voltage control mode)
 #define SYS_Vin 14500U //mV
 #define V_TO_mV 1000
 
@@ -37,10 +36,22 @@ extern const uint16_t dacPhaseLead[PHASE_LEAD_MAX_SPEED];
 #define I_MAX_A4950       3300 //mA
 
 #define BODY_DIODE_DROP_mV 430U //  intrinsic body diode voltage drop - (AT8236 has 495mV)
+#define CROSSOVER_DELAY_nS 500U //  dead time of each switching bridge output, the body diodes conduct - not identified on a bench
+#define DEAD_TIME_CURRENT_BAND 100 //mA - the compensation ramps through the zero crossing of the current reference
+
+#define LSS_SAMPLE_SETTLE_uS 2U //drive pulse length before and after its center for a valid LSS sample - switching and 13.5 ADC cycles
+
+typedef struct {
+	int16_t I_a; //mA
+	int16_t I_b;
+	bool valid_a; //sampled during a drive pulse, current in the drive direction
+	bool valid_b;
+} PhaseCurrents_t;
 
 void A4950_enable(bool enable);
 void phase_current_command(int16_t I_a, int16_t I_b);
-void phase_voltage_command(int16_t U_a, int16_t U_b, uint16_t curr_lim);
+void phase_voltage_command(int16_t U_a, int16_t U_b, int16_t I_a, int16_t I_b, uint16_t curr_lim);
+void phase_current_sample(PhaseCurrents_t *sample);
 
 extern volatile bool driverEnabled;
 
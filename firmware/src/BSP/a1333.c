@@ -0,0 +1,149 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+#include "a1333.h"
+#include "spi.h"
+#include <stddef.h>
+
+/*
+ * Allegro A1333 on the TLE5012B pins - 4 wire SPI (MISO on PIN_AUX_3_3), mode 3, 16bit frames.
+ * Each frame answers the command of the previous one: the read started at the PWM update
+ * sends the angle command, the motion task clocks the answer out with the next command.
+ * The sensor has no speed or revolution registers.
+ */
+static bool readAhead; //the angle command was sent for the motion task
+static uint16_t faultsInRow;
+
+static uint16_t A1333_Transfer(uint16_t command)
+{
+  A1333_CS_L;
+  uint16_t answer = SPI_WriteAndRead(A1333_SPI, command);
+  A1333_CS_H;
+  return answer;
+}
+
+//answer of the previous command - false with the error flag set
+static bool A1333_Answer(uint16_t *angle)
+{
+  uint16_t answer = A1333_Transfer(A1333_READ_ANGLE);
+  *angle = (uint16_t)((answer & A1333_ANGLE_MASK) << 4U); //Scale (0-4095) -> (0-65535)
+  bool ok = ((answer & A1333_ANGLE_EF) == 0U);
+  if (ok){
+    faultsInRow = 0;
+  }else if (faultsInRow < UINT16_MAX){
+    faultsInRow++;
+  }
+  return ok;
+}
+
+static bool A1333_Read(uint16_t *angle)
+{
+  uint32_t basepri = __get_BASEPRI();
+  __set_BASEPRI(BASEPRI_MASK_MOTION_TASK);
+
+  readAhead = false;
+  (void)A1333_Transfer(A1333_READ_ANGLE);
+  bool ok = A1333_Answer(angle);
+
+  __set_BASEPRI(basepri);
+  return ok;
+}
+
+//SPI is set up for the TLE5012B by the board - it is restored when no A1333 answers
+static bool A1333_begin(void)
+{
+  uint16_t cr1 = A1333_SPI->CR1;
+  uint32_t crh = PIN_A1333->CRH;
+
+  SPI_Cmd(A1333_SPI, DISABLE);
+  GPIO_InitTypeDef gpio_initStructure;
+  gpio_initStructure.GPIO_Pin = PIN_A1333_SCK | PIN_A1333_MOSI;
+  gpio_initStructure.GPIO_Mode = GPIO_Mode_AF_PP;
+  gpio_initStructure.GPIO_Speed = GPIO_Speed_10MHz;
+  GPIO_Init(PIN_A1333, &gpio_initStructure);
+  gpio_initStructure.GPIO_Pin = PIN_A1333_MISO;
+  gpio_initStructure.GPIO_Mode = GPIO_Mode_IPU; //same pull as PIN_AUX_3_3 - reads the error flag without a sensor
+  GPIO_Init(PIN_A1333, &gpio_initStructure);
+
+  SPI_InitTypeDef spi_initStructure;
+  spi_initStructure.SPI_Direction = SPI_Direction_2Lines_FullDuplex;
+  spi_initStructure.SPI_Mode = SPI_Mode_Master;
+  spi_initStructure.SPI_DataSize = SPI_DataSize_16b;
+  spi_initStructure.SPI_CPOL = SPI_CPOL_High;
+  spi_initStructure.SPI_CPHA = SPI_CPHA_2Edge;
+  spi_initStructure.SPI_NSS = SPI_NSS_Soft;
+  spi_initStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_4; //8Mbps at 32Mhz PLCK1 - 10Mbps max
+  spi_initStructure.SPI_FirstBit = SPI_FirstBit_MSB;
+  spi_initStructure.SPI_CRCPolynomial = 7;
+  SPI_Init(A1333_SPI, &spi_initStructure);
+  SPI_Cmd(A1333_SPI, ENABLE);
+
+  uint16_t angle;
+  bool ok = A1333_Read(&angle);
+  if (!ok){
+    SPI_Cmd(A1333_SPI, DISABLE);
+    A1333_SPI->CR1 = cr1;
+    PIN_A1333->CRH = crh;
+  }
+  faultsInRow = 0;
+  return ok;
+}
+
+static uint16_t A1333_ReadAngle(void)
+{
+  uint16_t angle;
+  (void)A1333_Read(&angle);
+  return angle;
+}
+
+//from the motion task interrupts only
+static void A1333_StartRead(void)
+{
+  (void)A1333_Transfer(A1333_READ_ANGLE);
+  readAhead = true;
+}
+
+static bool A1333_Fetch(EncoderSample_t *sample)
+{
+  bool ok;
+  if (readAhead){
+    readAhead = false;
+    ok = A1333_Answer(&sample->angle);
+  }else{
+    ok = A1333_Read(&sample->angle);
+  }
+  sample->speed = 0;
+  sample->revolutions = 0;
+  return ok;
+}
+
+static uint16_t A1333_FaultsInRow(void)
+{
+  return faultsInRow;
+}
+
+const EncoderDriver_t A1333_driver = {
+  .name = "A1333",
+  .begin = A1333_begin,
+  .readAngle = A1333_ReadAngle,
+  .startRead = A1333_StartRead,
+  .fetch = A1333_Fetch,
+  .faultsInRow = A1333_FaultsInRow,
+  .setProfile = NULL, //no filter settings
+  .latency_us = {A1333_LATENCY_uS},
+};
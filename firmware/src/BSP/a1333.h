@@ -0,0 +1,39 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __A1333_H
+#define __A1333_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "board.h"
+#include "encoder.h"
+
+#define A1333_CS_H			PIN_A1333->BSRR = PIN_A1333_CS		//GPIO_SetBits(PIN_A1333, PIN_A1333_CS)
+#define A1333_CS_L			PIN_A1333->BRR  = PIN_A1333_CS		//GPIO_ResetBits(PIN_A1333, PIN_A1333_CS)
+
+/* SPI command for A1333 - the answer comes in the next frame */
+#define A1333_READ_ANGLE		0x2000U			//20h ANG, bit 15 clear - read
+
+#define A1333_ANGLE_MASK		0x0FFFU			//12bit angle
+#define A1333_ANGLE_EF			0x2000U			//error flag - the ERR register has the cause
+#define A1333_LATENCY_uS		10U				//time between sampling and reading the angle - datasheet response time, not identified on a bench
+
+extern const EncoderDriver_t A1333_driver;
+
+#endif
@@ -5,9 +5,16 @@
 
 #include "actuator_config.h"
 #include "stepper_controller.h"
+#include "encoder.h"
+#include "sine.h"
 
 // ----- should be set by the user --------------------------------------------------------------------------------
 const bool USE_VOLTAGE_CONTROL = false; // voltage or current control - voltage control recommended for hardware v0.3
+const bool USE_SPEED_OBSERVER = false; // speed estimate from the observer (observer.c) or from the filtered position difference - the observer depends on motor_inertia, not verified on hardware yet
+volatile uint8_t calibration_harmonics = 0; // encoder calibration stored as this many harmonics (up to CALIBRATION_HARMONICS_MAX) instead of the point table - smoother angle, needs recalibration
+volatile bool calibration_continuous = false; // encoder calibration spins the rotor at constant speed and samples every motion task tick - faster than stepping from point to point
+volatile bool calibration_refine = false; // refines the calibration table while the load turns the motor without current, stored when the motor is off and at rest
+volatile uint8_t sensor_profile = ENCODER_PROFILE_DEFAULT; // angle sensor filter profile (EncoderProfile_t) - stored at start up when changed, the sensor latency has to be identified again (hold F2 6s)
 
 // select simple or advanced parameters
 // simple parameters (rated torque and current) are usually overstated by manufacturers
@@ -25,12 +32,26 @@ volatile int16_t motor_k_bemf = 750; // mV/(rev/s) -   hold F2 to measure, use M
 // note, when motor_k_bemf is too low, the motor can have higher top speed when unloaded (unintentional field weakening via I_d), but power and torque will not be accurate
 volatile int16_t phase_R = 2400;         // mOhm -      it's best to measure this
 volatile int16_t phase_L = 3230;         // uH -        use datasheet value or RLC meter to measure - correct value maximizes peak motor power
+volatile uint8_t overmodulation = 115;         // % - voltage vector limit relative to the bus voltage (voltage control), 100 keeps sine waves, up to 127 (square waves) - more power near the base speed, more torque ripple
+volatile uint16_t field_weakening_current = 1000; // mA - negative d current budget above the base speed (voltage control), 0 disables - useful up to ~k_bemf/(2*pi*pole_pairs*phase_L)
 
 // specify gearing parameters here:
 const float motor_gearbox_ratio = 5.0F+(2.0F/11.0F); // gearbox ratio - enter planetary gearbox tooth calculation for best accuracy
 const float final_drive_ratio = 2.0F;                // assembly gearing ratio
 
-const int8_t anticogging_factor = 30; //minimizes cogging under load - (0-127) -value to be chosen experimentally 
+// specify inertia for the acceleration feedforward:
+const float motor_rotor_inertia = 54e-7F;   // kg*m^2 - motor datasheet
+const float actuator_load_inertia = 5e-3F;  // kg*m^2 - inertia seen at the actuator output
+
+// specify friction for the load torque estimate - replaced by the identified values after autotune (F1+F2):
+const float actuator_friction_coulomb = 0.4F;  // Nm - at the actuator output
+const float actuator_friction_viscous = 0.05F; // Nm/(rad/s) - at the actuator output
+const float actuator_friction_stiction = 0.4F; // Nm - at the actuator output, friction at zero speed
+const float actuator_friction_stribeck = 0.5F; // rad/s - at the actuator output, speed where the friction drops from stiction to coulomb
+const uint8_t friction_compensation = 80;      // % - identified friction added as feedforward in closeloop, lower if the actuator hunts at low speed
+
+volatile int8_t anticogging_factor = 30;     //minimizes cogging under load - 3rd harmonic of the commutation (-128-127 for -1/8-1/8) - value to be chosen experimentally
+volatile int8_t anticogging_factor_5th = 0;  //5th harmonic of the commutation (-128-127 for -1/8-1/8) - explore the profile with sine_profile.py
 
 // ------  end user settings --------------------------------------------------------------------------------------
 
@@ -41,6 +62,11 @@ float volatile gearing_ratio;
 float volatile actuatorTq_to_current; // mA/Nm - (ignores gearbox efficiency)
 float volatile current_to_actuatorTq; // Nm/mA - (ignores gearbox efficiency)
 volatile float motor_k_torque; // Nm/A
+volatile int32_t accel_to_current; // mA/(angleraw/s^2) * ACCEL_TO_CURRENT_SCALING
+volatile int16_t friction_coulomb_current; // mA
+volatile int32_t friction_viscous_current; // mA/(rev/s) * FRICTION_VISCOUS_SCALING
+volatile int16_t friction_stiction_current; // mA
+volatile int32_t friction_stribeck_speed; // angleraw/s
 
 // interprets motor parameters
 void update_actuator_parameters(bool use_simple_params){
@@ -59,6 +85,20 @@ void update_actuator_parameters(bool use_simple_params){
     current_to_actuatorTq = motor_k_torque / 1000 * gearing_ratio;
     actuatorTq_to_current = 1 / current_to_actuatorTq;
 
+    // load inertia is reflected to the motor shaft by the square of the gearing
+    float inertia = motor_rotor_inertia + (actuator_load_inertia / (gearing_ratio * gearing_ratio)); // kg*m^2
+    accel_to_current = (int32_t)(inertia * 2.0f * 3.1415f / (float)ANGLE_STEPS / motor_k_torque * 1000 * (float)ACCEL_TO_CURRENT_SCALING);
+
+    // friction reflected to the motor shaft
+    float gearing_abs = (gearing_ratio < 0) ? -gearing_ratio : gearing_ratio;
+    friction_coulomb_current = (int16_t)(actuator_friction_coulomb / gearing_abs / motor_k_torque * 1000);
+    friction_viscous_current = (int32_t)(actuator_friction_viscous / (gearing_ratio * gearing_ratio) * 2.0f * 3.1415f / motor_k_torque * 1000 * (float)FRICTION_VISCOUS_SCALING);
+    friction_stiction_current = (int16_t)(actuator_friction_stiction / gearing_abs / motor_k_torque * 1000);
+    friction_stribeck_speed = (int32_t)(actuator_friction_stribeck * gearing_abs / 2.0f / 3.1415f * (float)ANGLE_STEPS);
+
+
+    // commutation table with the harmonic profile - regenerated only when the factors changed
+    sine_ripple_profile(anticogging_factor, anticogging_factor_5th);
 
     closeLoopMaxDes = 2000U; // position control maximum close loop current [mA] to limit stresses and heat generation
 
@@ -31,17 +31,35 @@
 
 extern const bool USE_SIMPLE_PARAMETERS;
 extern const bool USE_VOLTAGE_CONTROL;
+extern const bool USE_SPEED_OBSERVER;
+extern volatile uint8_t calibration_harmonics;
+extern volatile bool calibration_continuous;
+extern volatile bool calibration_refine;
+extern volatile uint8_t sensor_profile;
 
 extern volatile int16_t phase_R; //mOhm
 extern volatile int16_t phase_L; //uH
 extern volatile int16_t motor_k_bemf; // mV/(rev/s)
+extern volatile uint16_t field_weakening_current; // mA
+extern volatile uint8_t overmodulation; // %
 
 //calculate actuator parameters to be used by control_api 
 extern volatile float gearing_ratio;
 extern volatile float actuatorTq_to_current;
 extern volatile float current_to_actuatorTq;
 
-extern const int8_t anticogging_factor;
+#define ACCEL_TO_CURRENT_SCALING (int32_t)(1 << 24)
+extern volatile int32_t accel_to_current; // acceleration feedforward gain
+
+#define FRICTION_VISCOUS_SCALING (int32_t)(1 << 8)
+extern volatile int16_t friction_coulomb_current; // motor shaft friction model
+extern volatile int32_t friction_viscous_current;
+extern volatile int16_t friction_stiction_current;
+extern volatile int32_t friction_stribeck_speed;
+extern const uint8_t friction_compensation;
+
+extern volatile int8_t anticogging_factor; // 3rd harmonic of the commutation
+extern volatile int8_t anticogging_factor_5th; // 5th harmonic of the commutation
 
 void update_actuator_parameters(bool use_simple_params);
 
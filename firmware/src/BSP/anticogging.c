@@ -0,0 +1,164 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Cogging (detent) torque of a hybrid stepper repeats with the rotor tooth pitch - 4 full steps, one electrical cycle.
+	The map is indexed by the shaft angle within the tooth pitch, so COGGING_TABLE_SIZE points cover every tooth
+	of the revolution and the measurements of all teeth are averaged together.
+
+	Calibration rotates the motor slowly at constant speed in the velocity loop, both directions, and bins the
+	closeloop current by position. Friction and the loop lag have the opposite sign in the two directions and
+	cancel out in the average, the mean (load, gravity) is removed. The pass is repeated with the map applied
+	and the residual is added, which corrects for what the loop could not follow the first time.
+	The map is stored in the second half of the calibration flash page and added to Iq by linear interpolation.
+*/
+
+#include "anticogging.h"
+#include "stepper_controller.h"
+#include "nonvolatile.h"
+#include "encoder.h"
+#include "delay.h"
+#include "board.h"
+#include "main.h"
+#include "utils.h"
+
+#define COGGING_SPEED			(int32_t)(ANGLE_STEPS / 2U)	//angleraw/s - above the stick-slip region, cogging (100Hz) still within the velocity loop bandwidth
+#define COGGING_CURRENT_LIM		1000	//mA - closeloop limit during the measurement
+#define COGGING_SETTLE_MS		300U	//velocity loop transient after the direction change
+#define COGGING_PASS_MS			2000U	//measurement per direction - one revolution
+#define COGGING_ITERATIONS		2U
+#define COGGING_MIN_SAMPLES		100U	//per point and iteration - otherwise the pass did not cover the tooth pitch
+
+#define COGGING_INDEX_SHIFT		(16U - COGGING_TABLE_BITS)
+#define COGGING_INDEX_MASK		((1U << COGGING_INDEX_SHIFT) - 1U)
+
+volatile bool anticoggingValid = false;
+
+static volatile int16_t coggingTable[COGGING_TABLE_SIZE]; //mA
+
+//recording - motion task
+static volatile bool recording = false;
+static volatile int32_t recordSum[COGGING_TABLE_SIZE];
+static volatile uint16_t recordCount[COGGING_TABLE_SIZE];
+
+//shaft angle to the position within the rotor tooth pitch (0-65535)
+static uint16_t tooth_phase(uint16_t angle){
+	return (uint16_t)((uint32_t)angle * (liveMotorParams.fullStepsPerRotation / 4U));
+}
+
+void Anticogging_init(void){
+	anticoggingValid = false;
+	if(valid == nvmFlashCoggingData->status){ // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+		for(uint16_t i=0; i < COGGING_TABLE_SIZE; i++){
+			coggingTable[i] = nvmFlashCoggingData->FlashCoggingData[i]; // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+		}
+		anticoggingValid = true;
+	}
+}
+
+int16_t Anticogging_current(uint16_t angle){
+	if (!anticoggingValid){
+		return 0;
+	}
+	uint16_t phase = tooth_phase(angle);
+	uint16_t idx1 = phase >> COGGING_INDEX_SHIFT;
+	uint16_t idx2 = (idx1 + 1U) & (COGGING_TABLE_SIZE - 1U);
+	int32_t frac = (int32_t)(uint32_t)(phase & COGGING_INDEX_MASK);
+	int32_t y1 = coggingTable[idx1];
+	int32_t y2 = coggingTable[idx2];
+
+	return (int16_t)(y1 + (((y2 - y1) * frac) >> COGGING_INDEX_SHIFT));
+}
+
+void Anticogging_record(uint16_t angle, int16_t current){
+	if (!recording){
+		return;
+	}
+	//nearest point
+	uint16_t phase = tooth_phase(angle) + (uint16_t)(1U << (COGGING_INDEX_SHIFT - 1U));
+	uint16_t idx = phase >> COGGING_INDEX_SHIFT;
+	recordSum[idx] += current;
+	if (recordCount[idx] < UINT16_MAX){
+		recordCount[idx]++;
+	}
+}
+
+// Measure the cogging map and store it in flash
+int8_t Anticogging_calibrate(void){
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+	if (GetMotorVoltage() < MIN_SUPPLY_VOLTAGE) {
+		return -1;
+	}
+
+	//start from scratch - a map learned with the old calibration table is not valid
+	anticoggingValid = false;
+	for(uint16_t i=0; i < COGGING_TABLE_SIZE; i++){
+		coggingTable[i] = 0;
+	}
+
+	for(uint16_t iteration = 0; iteration < COGGING_ITERATIONS; iteration++){
+		for(uint16_t i=0; i < COGGING_TABLE_SIZE; i++){
+			recordSum[i] = 0;
+			recordCount[i] = 0;
+		}
+
+		StepperCtrl_setCurrent(0);
+		StepperCtrl_setCloseLoopCurrentLim(COGGING_CURRENT_LIM);
+		StepperCtrl_setVelocity(0);
+		StepperCtrl_setMotionMode(STEPCTRL_FEEDBACK_VELOCITY);
+		anticoggingValid = (iteration > 0U); //measure the residual with the map applied
+		for(int8_t dir = 1; dir >= -1; dir -= 2){
+			StepperCtrl_setVelocity(dir * COGGING_SPEED);
+			delay_ms(COGGING_SETTLE_MS);
+			recording = true;
+			delay_ms(COGGING_PASS_MS);
+			recording = false;
+		}
+		StepperCtrl_setVelocity(0);
+		delay_ms(COGGING_SETTLE_MS);
+		StepperCtrl_setMotionMode(STEPCTRL_OFF);
+		anticoggingValid = false;
+
+		//average of both directions without the mean
+		int32_t mean = 0;
+		for(uint16_t i=0; i < COGGING_TABLE_SIZE; i++){
+			if (recordCount[i] < COGGING_MIN_SAMPLES){
+				debug_assert(0);
+				return -2;
+			}
+			recordSum[i] /= (int32_t)recordCount[i];
+			mean += recordSum[i];
+		}
+		mean /= (int32_t)COGGING_TABLE_SIZE;
+		for(uint16_t i=0; i < COGGING_TABLE_SIZE; i++){
+			coggingTable[i] = (int16_t)clip(coggingTable[i] + recordSum[i] - mean, -COGGING_CURRENT_LIM, COGGING_CURRENT_LIM);
+		}
+	}
+
+	FlashCoggingData_t data;
+	for(uint16_t i=0; i < COGGING_TABLE_SIZE; i++){
+		data.FlashCoggingData[i] = coggingTable[i];
+	}
+	data.status = valid;
+	nvmWriteCoggingTable(&data);
+
+	Anticogging_init();
+	return 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @ Description:
+ * Position indexed cogging current map - learned at calibration, added to Iq at runtime.
+ */
+
+#ifndef ANTICOGGING_H
+#define ANTICOGGING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//changing this requires recalibration
+#define COGGING_TABLE_BITS		7U
+#define COGGING_TABLE_SIZE		(1U << COGGING_TABLE_BITS)	//points per rotor tooth pitch (4 full steps)
+
+typedef struct {
+	int16_t FlashCoggingData[COGGING_TABLE_SIZE];	//mA
+	uint16_t status;
+} FlashCoggingData_t;
+
+//api
+extern volatile bool anticoggingValid;
+
+void Anticogging_init(void);
+int8_t Anticogging_calibrate(void);
+
+//motion task
+int16_t Anticogging_current(uint16_t angle);
+void Anticogging_record(uint16_t angle, int16_t current);
+
+#endif // ANTICOGGING_H
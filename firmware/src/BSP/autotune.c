@@ -0,0 +1,164 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Astrom-Hagglund relay experiment on the position loop.
+	The motion task drives the motor with +-AUTOTUNE_RELAY_CURRENT depending on which side of the start position
+	the shaft is (with hysteresis), which settles into a limit cycle at the ultimate frequency of the loop:
+		Ku = 4*d / (pi*a), Tu = oscillation period
+	PID gains place the ultimate point on the unit circle at AUTOTUNE_PHASE_MARGIN (modified Ziegler-Nichols):
+		Kp = Ku*cos(pm), Td = (tan(pm) + sqrt(tan(pm)^2 + 4/alpha)) / (2*wu), Ti = alpha*Td
+	The result is stored in flash as the pPID parameters.
+*/
+
+#include "autotune.h"
+#include "stepper_controller.h"
+#include "nonvolatile.h"
+#include "encoder.h"
+#include "delay.h"
+#include "board.h"
+#include "main.h"
+#include "utils.h"
+#include <math.h>
+
+#define AUTOTUNE_RELAY_CURRENT	1000	//mA - relay amplitude, has to overcome friction
+#define AUTOTUNE_MAX_DEVIATION	(int32_t)(ANGLE_STEPS / 2U)	//angleraw - abort if the shaft runs away
+#define AUTOTUNE_SKIP_CYCLES	2U		//transient before the limit cycle
+#define AUTOTUNE_CYCLES			6U		//averaged cycles
+#define AUTOTUNE_TIMEOUT_MS		3000U
+#define AUTOTUNE_TI_TD_RATIO	4.0f	//alpha
+#define AUTOTUNE_GAIN_MAX		((float)INT16_MAX / (float)CTRL_PID_SCALING) //largest gain stored in the int16 runtime parameters
+
+volatile float autotuneKu = 0.0f;
+volatile float autotuneTu = 0.0f;
+
+//relay state - motion task
+static volatile int32_t relay_center;
+static volatile int32_t relay_hysteresis;	//angleraw - rejects sensor noise
+static volatile int16_t relay_output;
+static volatile bool relay_abort;
+static volatile uint8_t relay_cycles;
+static uint32_t relay_ticks;				//since the last rising switch
+static int32_t relay_max;
+static int32_t relay_min;
+static volatile uint32_t relay_period_sum;	//ticks
+static volatile uint32_t relay_amplitude_sum;	//angleraw peak to peak
+
+void Autotune_reset(int32_t location){
+	relay_center = location;
+	relay_hysteresis = (int32_t)(ANGLE_STEPS / 8U / liveMotorParams.fullStepsPerRotation); //1/8 of a full step
+	relay_output = AUTOTUNE_RELAY_CURRENT;
+	relay_abort = false;
+	relay_cycles = 0;
+	relay_ticks = 0;
+	relay_max = 0;
+	relay_min = 0;
+	relay_period_sum = 0;
+	relay_amplitude_sum = 0;
+}
+
+int16_t Autotune_relay(int32_t location){
+	int32_t deviation = location - relay_center;
+	int32_t hysteresis = relay_hysteresis;
+
+	if ((deviation > AUTOTUNE_MAX_DEVIATION) || (deviation < -AUTOTUNE_MAX_DEVIATION) || relay_abort){
+		relay_abort = true;
+		return 0;
+	}
+	if (relay_cycles >= (AUTOTUNE_SKIP_CYCLES + AUTOTUNE_CYCLES)){
+		return 0; //done
+	}
+
+	relay_ticks++;
+	relay_max = max(relay_max, deviation);
+	relay_min = min(relay_min, deviation);
+
+	if ((relay_output > 0) && (deviation > hysteresis)){
+		relay_output = -AUTOTUNE_RELAY_CURRENT;
+	}else if ((relay_output < 0) && (deviation < -hysteresis)){
+		//rising switch - one full cycle since the last one
+		relay_output = AUTOTUNE_RELAY_CURRENT;
+		if (relay_cycles >= AUTOTUNE_SKIP_CYCLES){
+			relay_period_sum += relay_ticks;
+			relay_amplitude_sum += (uint32_t)(relay_max - relay_min);
+		}
+		relay_cycles++;
+		relay_ticks = 0;
+		relay_max = deviation;
+		relay_min = deviation;
+	}else{
+		//keep the output
+	}
+	return relay_output;
+}
+
+// Run relay experiment and store the position PID gains
+int8_t Autotune_pid(void){
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+	if (GetMotorVoltage() < MIN_SUPPLY_VOLTAGE) {
+		return -1;
+	}
+
+	Autotune_reset(currentLocation);
+	StepperCtrl_setMotionMode(STEPCTRL_FEEDBACK_AUTOTUNE);
+	uint32_t t = 0;
+	while ((relay_cycles < (AUTOTUNE_SKIP_CYCLES + AUTOTUNE_CYCLES)) && !relay_abort && (t < AUTOTUNE_TIMEOUT_MS)){
+		delay_ms(10);
+		t += 10U;
+	}
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+
+	if (relay_abort || (relay_cycles < (AUTOTUNE_SKIP_CYCLES + AUTOTUNE_CYCLES))){
+		debug_assert(0);
+		return -2;
+	}
+
+	float amplitude = (float)relay_amplitude_sum / (2.0f * (float)AUTOTUNE_CYCLES); //angleraw
+	float period = (float)relay_period_sum / (float)AUTOTUNE_CYCLES / (float)SAMPLING_HZ; //s
+	autotuneKu = 4.0f * (float)AUTOTUNE_RELAY_CURRENT / (3.1415f * amplitude);
+	autotuneTu = period;
+
+	const float pm = (float)AUTOTUNE_PHASE_MARGIN * 3.1415f / 180.0f;
+	float wu = 2.0f * 3.1415f / period;
+	float tan_pm = tanf(pm);
+	float Kp = autotuneKu * cosf(pm);									//mA/angleraw
+	float Td = (tan_pm + sqrtf((tan_pm * tan_pm) + (4.0f / AUTOTUNE_TI_TD_RATIO))) / (2.0f * wu); //s
+	float Ti = AUTOTUNE_TI_TD_RATIO * Td;								//s
+
+	//convert to the discrete PID in StepperCtrl_processMotion:
+	//iTerm = sum(error) * Ki / SAMPLING_PERIOD_uS, dTerm = delta(error) * Kd * SAMPLING_PERIOD_uS
+	const float T_us = (float)SAMPLING_PERIOD_uS;
+	float Ki = Kp / Ti * T_us * T_us / (float)S_to_uS;
+	float Kd = Kp * Td * (float)S_to_uS / (T_us * T_us);
+
+	if ((Kp > AUTOTUNE_GAIN_MAX) || (Ki > AUTOTUNE_GAIN_MAX) || (Kd > AUTOTUNE_GAIN_MAX)){
+		//keep the ratios, limit to what the runtime parameters can hold
+		float scale = AUTOTUNE_GAIN_MAX / fmaxf(Kp, fmaxf(Ki, Kd));
+		Kp *= scale;
+		Ki *= scale;
+		Kd *= scale;
+	}
+
+	nvmMirror.pPID.Kp = Kp;
+	nvmMirror.pPID.Ki = Ki;
+	nvmMirror.pPID.Kd = Kd;
+	nvmWriteConfParms();
+	return 0;
+}
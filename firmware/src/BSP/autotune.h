@@ -0,0 +1,43 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @ Description:
+ * Relay feedback autotuner of the position PID (pPID).
+ */
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AUTOTUNE_PHASE_MARGIN	45	//deg - robustness margin of the tuned loop (larger is slower and better damped)
+
+//api - last experiment
+extern volatile float autotuneKu;		//mA/angleraw - ultimate gain
+extern volatile float autotuneTu;		//s - ultimate period
+
+int8_t Autotune_pid(void);
+
+//motion task
+void Autotune_reset(int32_t location);
+int16_t Autotune_relay(int32_t location);
+
+#endif // AUTOTUNE_H
@@ -24,6 +24,10 @@
 #include "A4950.h"
 #include "stepper_controller.h"
 #include "utils.h"
+#include "encoder.h"
+#include "tle5012.h"
+#include "a1333.h"
+#include <stddef.h>
 
 //Init clock
 static void CLOCK_init(void)
@@ -54,11 +58,21 @@ static void NVIC_init(void)
 	nvic_initStructure.NVIC_IRQChannelSubPriority = 0;
 	NVIC_Init(&nvic_initStructure);
 
-	nvic_initStructure.NVIC_IRQChannel = TIM4_IRQn;//MOTION_TASK_TIM
+	nvic_initStructure.NVIC_IRQChannel = TLE5012B_DMA_RX_IRQn; //angle sensor transfer - ends it within a word time, the motion task may wait for it
+	nvic_initStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	nvic_initStructure.NVIC_IRQChannelSubPriority = 1;
+	NVIC_Init(&nvic_initStructure);
+
+	nvic_initStructure.NVIC_IRQChannel = TIM1_UP_IRQn;//PWM_TIM update - motion task sampling
 	nvic_initStructure.NVIC_IRQChannelPreemptionPriority = 1;
 	nvic_initStructure.NVIC_IRQChannelSubPriority = 0;
 	NVIC_Init(&nvic_initStructure);	
 
+	nvic_initStructure.NVIC_IRQChannel = ADC1_2_IRQn;//ADC_LSS_SYNC injected conversions - motion task compute
+	nvic_initStructure.NVIC_IRQChannelPreemptionPriority = 1;
+	nvic_initStructure.NVIC_IRQChannelSubPriority = 1;
+	NVIC_Init(&nvic_initStructure);	
+
 	nvic_initStructure.NVIC_IRQChannel = USB_LP_CAN1_RX0_IRQn; //CAN bus
 	nvic_initStructure.NVIC_IRQChannelPreemptionPriority = 2;
 	nvic_initStructure.NVIC_IRQChannelSubPriority = 0;
@@ -115,7 +129,28 @@ static void TLE5012B_init(void)
 	spi_initStructure.SPI_CRCPolynomial = 0x1D;
 	SPI_Init(TLE5012B_SPI, &spi_initStructure);
 
-}
+	//receive side of the transfer - memory address and length are set for each transfer
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+	DMA_DeInit(TLE5012B_DMA_RX);
+	DMA_InitTypeDef dma_initStructure;
+	dma_initStructure.DMA_PeripheralBaseAddr = (uint32_t)&TLE5012B_SPI->DR;
+	dma_initStructure.DMA_MemoryBaseAddr = 0;
+	dma_initStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+	dma_initStructure.DMA_BufferSize = 0;
+	dma_initStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	dma_initStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	dma_initStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+	dma_initStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+	dma_initStructure.DMA_Mode = DMA_Mode_Normal;
+	dma_initStructure.DMA_Priority = DMA_Priority_VeryHigh;
+	dma_initStructure.DMA_M2M = DMA_M2M_Disable;
+	DMA_Init(TLE5012B_DMA_RX, &dma_initStructure);
+	DMA_ITConfig(TLE5012B_DMA_RX, DMA_IT_TC, ENABLE);
+
+}
+
+//angle sensors on the TLE5012B footprint - probed in order by Encoder_begin()
+const EncoderDriver_t *const boardEncoders[] = {&TLE5012_driver, &A1333_driver, NULL};
 
 //Init switch IO
 static void SWITCH_init(void)
@@ -196,11 +231,13 @@ static void A4950_init(void)
 	
 	TIM_DeInit(PWM_TIM);
 	//Init PWM_TIM - PIN_A4950_IN1|PIN_A4950_IN2|PIN_A4950_IN3|PIN_A4950_IN4
-	timeBaseStructure.TIM_Period = PWM_TIM_MAX;
+	timeBaseStructure.TIM_Period = 0;		//counter stopped until Motion_task_init() sets the period
 	timeBaseStructure.TIM_Prescaler = 0;	//No prescaling - max cpu speed (MHz)
 	timeBaseStructure.TIM_ClockDivision = 0;
 	timeBaseStructure.TIM_CounterMode = TIM_CounterMode_CenterAligned1;
+	timeBaseStructure.TIM_RepetitionCounter = 1; //one update per PWM period - at the underflow, center of the CH1,CH2 pulses
 	TIM_TimeBaseInit(PWM_TIM, &timeBaseStructure);
+	TIM_SelectOutputTrigger(PWM_TIM, TIM_TRGOSource_Update); //starts ADC_LSS_SYNC and resets MOTION_TASK_TIM
 
 	tim_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
  	tim_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
@@ -219,10 +256,11 @@ static void A4950_init(void)
 	TIM_OC3Init(PWM_TIM, &tim_OCInitStructure);	//CH3
 	TIM_OC4Init(PWM_TIM, &tim_OCInitStructure);	//CH4
 
-	TIM_OC1PreloadConfig(PWM_TIM, TIM_OCPreload_Disable);
-	TIM_OC2PreloadConfig(PWM_TIM, TIM_OCPreload_Disable);
-	TIM_OC3PreloadConfig(PWM_TIM, TIM_OCPreload_Disable);
-	TIM_OC4PreloadConfig(PWM_TIM, TIM_OCPreload_Disable);
+	//compare values written by the motion task apply at the next update - never in the middle of a period
+	TIM_OC1PreloadConfig(PWM_TIM, TIM_OCPreload_Enable);
+	TIM_OC2PreloadConfig(PWM_TIM, TIM_OCPreload_Enable);
+	TIM_OC3PreloadConfig(PWM_TIM, TIM_OCPreload_Enable);
+	TIM_OC4PreloadConfig(PWM_TIM, TIM_OCPreload_Enable);
 
 	// Configure PWM_TIM break
 	gpio_initStructure.GPIO_Pin = PIN_A4950_ENABLE;
@@ -327,6 +365,15 @@ static void CAN_begin(void){
 
 static void Vrefint_adc_update(void);
 
+//ADC1 regular scan ranks
+#define ADC_RANK_TEMP		0U
+#define ADC_RANK_VMOT		1U
+#define ADC_RANK_VBAT		2U
+#define ADC_SCAN_CHANNELS	3U
+
+//written by DMA, the oldest scan is overwritten
+static volatile uint16_t adc_scan[ADC_OVERSAMPLING][ADC_SCAN_CHANNELS];
+
 static void Analog_init(void){
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_ADC1, ENABLE); 
 	RCC_ADCCLKConfig(RCC_PCLK2_Div6); //div6 default
@@ -352,12 +399,9 @@ static void Analog_init(void){
 	adc_initStructure.ADC_ContinuousConvMode = DISABLE;	 
 	adc_initStructure.ADC_ExternalTrigConv = ADC_ExternalTrigConv_None; 
 	adc_initStructure.ADC_DataAlign = ADC_DataAlign_Right;		   
-	adc_initStructure.ADC_NbrOfChannel = 5;
+	adc_initStructure.ADC_NbrOfChannel = 1;
 	ADC_Init(ADC1, &adc_initStructure);
 
-	ADC_DiscModeCmd(ADC1, ENABLE);
-	ADC_DiscModeChannelCountConfig(ADC1, 1);
-
 	/* Enable the temperature sensor and vref internal channel */ 
 	ADC_TempSensorVrefintCmd(ENABLE);
 	/* Enable ADC1 */
@@ -378,14 +422,73 @@ static void Analog_init(void){
 	//Measure VDDA shortly after ADC calibration
 	ADC_RegularChannelConfig(ADC1, ADC_Channel_Vrefint, 1, ADC_SampleTime_71Cycles5);
 	Vrefint_adc_update();
-	ADC_SoftwareStartConvCmd(ADC1, DISABLE);
 
-	/* ADC1 regular configuration */ 
-	ADC_RegularChannelConfig(ADC1, ADC_Channel_TempSensor, 1, ADC_SampleTime_71Cycles5);
-	ADC_RegularChannelConfig(ADC_VMOT, ADC_CH_VMOT, 2, ADC_SampleTime_13Cycles5);
-	ADC_RegularChannelConfig(ADC_VBAT, ADC_CH_VBAT, 3, ADC_SampleTime_13Cycles5);
-	ADC_RegularChannelConfig(ADC_LSS, ADC_CH_LSS_A, 4, ADC_SampleTime_239Cycles5);
-	ADC_RegularChannelConfig(ADC_LSS, ADC_CH_LSS_B, 5, ADC_SampleTime_239Cycles5);
+	/* ADC1 regular configuration - continuous scan into adc_scan by DMA --------------------------
+	 * (239.5 + 12.5) + 2 * (71.5 + 12.5) = 420 cycles, ~40uS at 10.7MHz (64MHz / 6) per scan.
+	 * The temperature sensor needs 17.1uS sampling time, the dividers settle with 71.5 cycles. */
+	adc_initStructure.ADC_ScanConvMode = ENABLE;
+	adc_initStructure.ADC_ContinuousConvMode = ENABLE;
+	adc_initStructure.ADC_NbrOfChannel = ADC_SCAN_CHANNELS;
+	ADC_Init(ADC1, &adc_initStructure);
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_TempSensor, ADC_RANK_TEMP + 1U, ADC_SampleTime_239Cycles5);
+	ADC_RegularChannelConfig(ADC_VMOT, ADC_CH_VMOT, ADC_RANK_VMOT + 1U, ADC_SampleTime_71Cycles5);
+	ADC_RegularChannelConfig(ADC_VBAT, ADC_CH_VBAT, ADC_RANK_VBAT + 1U, ADC_SampleTime_71Cycles5);
+
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+	DMA_DeInit(ADC_SCAN_DMA);
+	DMA_InitTypeDef dma_initStructure;
+	dma_initStructure.DMA_PeripheralBaseAddr = (uint32_t)&ADC1->DR;
+	dma_initStructure.DMA_MemoryBaseAddr = (uint32_t)adc_scan;
+	dma_initStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+	dma_initStructure.DMA_BufferSize = ADC_OVERSAMPLING * ADC_SCAN_CHANNELS;
+	dma_initStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	dma_initStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	dma_initStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+	dma_initStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+	dma_initStructure.DMA_Mode = DMA_Mode_Circular;
+	dma_initStructure.DMA_Priority = DMA_Priority_Low; //a word per ~13uS, the angle sensor transfer goes first
+	dma_initStructure.DMA_M2M = DMA_M2M_Disable;
+	DMA_Init(ADC_SCAN_DMA, &dma_initStructure);
+	DMA_Cmd(ADC_SCAN_DMA, ENABLE);
+	ADC_DMACmd(ADC1, ENABLE);
+	ADC_SoftwareStartConvCmd(ADC1, ENABLE);
+	while(DMA_GetFlagStatus(ADC_SCAN_DMA_FLAG_TC) == RESET){
+		//wait for the first ADC_OVERSAMPLING scans
+	}
+
+	/* LSS sampling ------------------------------------------------------------------------------
+	 * The phase current only flows through the A4950 sense resistor while the bridge drives it,
+	 * slow decay recirculates through the low sides. The bridges drive half a period apart
+	 * (see A4950_init), each is sampled at the center of its drive pulse - the mean of the ripple.
+	 * 13.5 cycles is ~1.3uS at 10.7MHz (64MHz / 6) - the LSS amplifier output is low impedance */
+
+	//ADC_LSS injected - LSS_A at the PWM_TIM overflow, MOTION_TASK_TIM compare (Motion_task_init)
+	//interrupts the regular scan, which resumes afterwards
+	ADC_InjectedSequencerLengthConfig(ADC_LSS, 1);
+	ADC_InjectedChannelConfig(ADC_LSS, ADC_CH_LSS_A, 1, ADC_SampleTime_13Cycles5);
+	ADC_ExternalTrigInjectedConvConfig(ADC_LSS, ADC_ExternalTrigInjecConv_T4_TRGO);
+	ADC_ExternalTrigInjectedConvCmd(ADC_LSS, ENABLE);
+
+	/* ADC_LSS_SYNC configuration - own ADC, its end of conversion paces the motion task --------*/
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_ADC2, ENABLE);
+	ADC_DeInit(ADC_LSS_SYNC);
+	adc_initStructure.ADC_NbrOfChannel = 1;			//regular group unused
+	ADC_Init(ADC_LSS_SYNC, &adc_initStructure);
+	ADC_Cmd(ADC_LSS_SYNC, ENABLE);
+	ADC_ResetCalibration(ADC_LSS_SYNC);
+	while(ADC_GetResetCalibrationStatus(ADC_LSS_SYNC) == SET){
+		//wait for adc calibration reset
+	}
+	ADC_StartCalibration(ADC_LSS_SYNC);
+	while(ADC_GetCalibrationStatus(ADC_LSS_SYNC) == SET){
+		//wait for adc calibration finish
+	}
+
+	//LSS_B at the PWM_TIM update - ~2.5uS with the conversion
+	ADC_InjectedSequencerLengthConfig(ADC_LSS_SYNC, 1); //before the channels - the ranks depend on the length
+	ADC_InjectedChannelConfig(ADC_LSS_SYNC, ADC_CH_LSS_B, 1, ADC_SampleTime_13Cycles5);
+	ADC_ExternalTrigInjectedConvConfig(ADC_LSS_SYNC, ADC_ExternalTrigInjecConv_T1_TRGO); //PWM_TIM update
+	ADC_ExternalTrigInjectedConvCmd(ADC_LSS_SYNC, ENABLE);
 }
 
 static uint16_t Get_ADC_raw_nextRank(ADC_TypeDef* adcx){
@@ -404,13 +507,31 @@ static float covnert_ADC_raw_volt(uint16_t adc_raw){
 	return adc_volt;
 }
 
+//sum of the last ADC_OVERSAMPLING conversions of a rank - 16 x 12bit fits in 16bit
+static uint16_t adc_scan_sum(uint8_t rank){
+	uint16_t sum = 0;
+	for (uint8_t i = 0; i < ADC_OVERSAMPLING; i++){
+		sum = (uint16_t)(sum + adc_scan[i][rank]);
+	}
+	return sum;
+}
+
 static uint16_t  vdda_adc_mV;
+static uint32_t vmot_scale; //mV per ADC sum in Q16, set with VDDA
+static uint32_t vbat_scale;
+
+static uint32_t adc_sum_to_mV_Q16(float div_ratio){
+	return (uint32_t)((float)(mVREFINT << 16) / ((float)vrefint_adc * (float)ADC_OVERSAMPLING * div_ratio));
+}
+
 //called only once during boot up
 static void Vrefint_adc_update(void){
 	vrefint_adc = Get_ADC_raw_nextRank(ADC1);
 	assert(vrefint_adc > 1357); //VDDA above 3.5V @ 1.16V vrefint
 	assert(vrefint_adc < 1587); //VDDA below 3.2V @ 1.24V vrefint
 	vdda_adc_mV = (uint16_t)(float)(GetVDDA() * (float)V_TO_mV);
+	vmot_scale = adc_sum_to_mV_Q16(VOLT_DIV_RATIO(R1_VDIV_VMOT, R2_VDIV_VMOT)); //~40k, x 65520 fits in 32bit
+	vbat_scale = adc_sum_to_mV_Q16(VOLT_DIV_RATIO(R1_VDIV_VBAT, R2_VDIV_VBAT));
 }
 
 float GetVDDA(void){
@@ -421,72 +542,46 @@ uint16_t GetMcuVoltage_mV(void){
 	return vdda_adc_mV;
 }
 
-static float chip_temp_adc;
-static void ChipTemp_adc_update(void){
-	float adc_volt = covnert_ADC_raw_volt(Get_ADC_raw_nextRank(ADC1));
+float GetChipTemp(void){
+	float adc_volt = (float)((uint32_t)adc_scan_sum(ADC_RANK_TEMP) * mVREFINT / vrefint_adc) / (float)(ADC_OVERSAMPLING * 1000U);
 	const float t0 = 25.0f; //deg Celsius
 	const float adcVolt_t0 = 1.385f; //! calibrate at some t0
 	const float tempSlop = 4.3f/1000.0f; //typically 4.3mV per C
-	chip_temp_adc = ((adcVolt_t0 - adc_volt) / tempSlop) + t0;
+	return ((adcVolt_t0 - adc_volt) / tempSlop) + t0;
 }
 
-float GetChipTemp(void){
-	return chip_temp_adc;
-}
-
-static float vmot_adc;
-static uint16_t vmot_adc_mV;
-static void Vmot_adc_update(void){
-	float adc_volt = covnert_ADC_raw_volt(Get_ADC_raw_nextRank(ADC_VMOT));
-	vmot_adc = adc_volt / VOLT_DIV_RATIO(R1_VDIV_VMOT, R2_VDIV_VMOT);
-	vmot_adc_mV = (uint16_t)(float)(vmot_adc * (float)V_TO_mV);
+//cheap enough for the motion task - duty cycle from the bus voltage of the last ~0.6ms
+uint16_t GetMotorVoltage_mV(void){
+	return (uint16_t)(((uint32_t)adc_scan_sum(ADC_RANK_VMOT) * vmot_scale) >> 16);
 }
-
 float GetMotorVoltage(void){
-	return vmot_adc;
-}
-uint16_t GetMotorVoltage_mV(void){
-	return vmot_adc_mV;
+	return (float)GetMotorVoltage_mV() / (float)V_TO_mV;
 }
 
-static float vbat_adc;
-static uint16_t vbat_adc_mV;
-static void Vbat_adc_update(void){
-	float adc_volt = covnert_ADC_raw_volt(Get_ADC_raw_nextRank(ADC_VBAT));
-	vbat_adc = adc_volt / VOLT_DIV_RATIO(R1_VDIV_VBAT, R2_VDIV_VBAT);
-	vbat_adc_mV = (uint16_t)(float)(vbat_adc * (float)V_TO_mV);
+uint16_t GetSupplyVoltage_mV(void){
+	return (uint16_t)(((uint32_t)adc_scan_sum(ADC_RANK_VBAT) * vbat_scale) >> 16);
 }
-
 float GetSupplyVoltage(void){
-	return vbat_adc;
+	return (float)GetSupplyVoltage_mV() / (float)V_TO_mV;
 }
-uint16_t GetSupplyVoltage_mV(void){
-	return vbat_adc_mV;
+
+static uint16_t lss_raw_to_mA(uint16_t adc_raw){
+	uint32_t mV = ((uint32_t)adc_raw * vdda_adc_mV) / ADC_12bit;
+	return (mV > LSS_OP_OFFSET_mV) ? (uint16_t)((mV - LSS_OP_OFFSET_mV) * A_to_mA / LSS_GAIN_mV_PER_A) : 0U;
 }
 
-static float lssA_adc;
-static float lssB_adc;
-static void LSS_adc_update(void){ //todo add filter
-	float adc_volt;
-	adc_volt = covnert_ADC_raw_volt(Get_ADC_raw_nextRank(ADC_LSS));
-	lssA_adc = max(adc_volt-LSS_OP_OFFSET, 0.0f) / 9.2f * 10.0f;
-	adc_volt = covnert_ADC_raw_volt(Get_ADC_raw_nextRank(ADC_LSS));
-	lssB_adc = max(adc_volt-LSS_OP_OFFSET, 0.0f) / 9.2f * 10.0f;
+uint16_t Get_PhaseA_Current_mA(void){
+	return lss_raw_to_mA(ADC_GetInjectedConversionValue(ADC_LSS, ADC_InjectedChannel_1));
+}
+uint16_t Get_PhaseB_Current_mA(void){
+	return lss_raw_to_mA(ADC_GetInjectedConversionValue(ADC_LSS_SYNC, ADC_InjectedChannel_1));
 }
 
 float Get_PhaseA_Current(void){
-	return lssA_adc;
+	return (float)Get_PhaseA_Current_mA() / (float)A_to_mA;
 }
 float Get_PhaseB_Current(void){
-	return lssB_adc;
-}
-
-void adc_update_all(void){
-	//order matters - see ADC1 regular configuration above
-	ChipTemp_adc_update();
-	Vmot_adc_update();
-	Vbat_adc_update();
-	LSS_adc_update();
+	return (float)Get_PhaseB_Current_mA() / (float)A_to_mA;
 }
 
 void board_init(void)
@@ -547,19 +642,47 @@ void Set_Error_LED(bool state)
 #define MOTION_TASK_TIM TIM4
 #define SERVICE_TASK_TIM  TIM2
 
+static uint16_t motion_task_period_us;
+uint16_t pwm_tim_max;
+
+/*
+ * Motion task pipeline, paced by the PWM_TIM update (once per PWM period):
+ * - the update starts the ADC_LSS_SYNC injected conversion and resets MOTION_TASK_TIM in hardware,
+ *   TIM1_UP_IRQHandler starts the encoder read
+ * - MOTION_TASK_TIM starts the ADC_LSS injected conversion half a period later, at the overflow
+ * - ADC1_2_IRQHandler runs the motion task when the conversions are done
+ * - the compare values it writes are preloaded and apply at the next update
+ */
 void Motion_task_init(uint16_t taskPeriod)
 {
-	//setup timer
+	motion_task_period_us = taskPeriod;
+
+	//center aligned - the period is two PWM_TIM_MAX counts
+	pwm_tim_max = (uint16_t)(SystemCoreClock / MHz_to_Hz * taskPeriod / 2U);
+	TIM_SetAutoreload(PWM_TIM, pwm_tim_max);
+
+	//setup timer - uS since the last PWM_TIM update
 	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM4, ENABLE);//MOTION_TASK_TIM
 
     TIM_DeInit(MOTION_TASK_TIM);
 	TIM_TimeBaseInitTypeDef timeBaseStructure;
 	timeBaseStructure.TIM_Prescaler = SystemCoreClock / MHz_to_Hz - 1U; //Prescale to 1MHz - 1uS
-	timeBaseStructure.TIM_Period = taskPeriod - 1U;
+	timeBaseStructure.TIM_Period = UINT16_MAX;
 	timeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
-	timeBaseStructure.TIM_RepetitionCounter = 0; //has to be zero to not skip period ticks
+	timeBaseStructure.TIM_RepetitionCounter = 0;
 	timeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
 	TIM_TimeBaseInit(MOTION_TASK_TIM, &timeBaseStructure);
+	TIM_SelectInputTrigger(MOTION_TASK_TIM, TIM_TS_ITR0); //PWM_TIM TRGO
+	TIM_SelectSlaveMode(MOTION_TASK_TIM, TIM_SlaveMode_Reset);
+
+	//CH1 reference rises at the PWM_TIM overflow and starts the ADC_LSS injected conversion, no pin output
+	TIM_OCInitTypeDef tim_OCInitStructure;
+	TIM_OCStructInit(&tim_OCInitStructure);
+	tim_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM2;
+	tim_OCInitStructure.TIM_OutputState = TIM_OutputState_Disable;
+	tim_OCInitStructure.TIM_Pulse = taskPeriod / 2U;
+	TIM_OC1Init(MOTION_TASK_TIM, &tim_OCInitStructure);
+	TIM_SelectOutputTrigger(MOTION_TASK_TIM, TIM_TRGOSource_OC1Ref);
 
 	TIM_SetCounter(MOTION_TASK_TIM, 0);
 	TIM_Cmd(MOTION_TASK_TIM, ENABLE);
@@ -588,7 +711,8 @@ void Serivice_task_init(void){
 	TIM_Cmd(SERVICE_TASK_TIM, ENABLE);
 }
 
-void TIM4_IRQHandler(void);//MOTION_TASK_TIM
+void TIM1_UP_IRQHandler(void);//PWM_TIM update
+void ADC1_2_IRQHandler(void);//ADC_LSS_SYNC
 void TIM2_IRQHandler(void);//SERVICE_TASK_TIM
 
 volatile bool motion_task_isr_enabled = false;
@@ -597,16 +721,20 @@ volatile bool motion_task_isr_enabled = false;
 void Motion_task_enable(void)
 {
 	motion_task_isr_enabled = true;
-	TIM_ClearITPendingBit(MOTION_TASK_TIM, TIM_IT_Update);
-	TIM_ITConfig(MOTION_TASK_TIM, TIM_IT_Update, ENABLE);
+	TIM_ClearITPendingBit(PWM_TIM, TIM_IT_Update);
+	ADC_ClearITPendingBit(ADC_LSS_SYNC, ADC_IT_JEOC);
+	TIM_ITConfig(PWM_TIM, TIM_IT_Update, ENABLE);
+	ADC_ITConfig(ADC_LSS_SYNC, ADC_IT_JEOC, ENABLE);
 }
 
 //disable motor fast loop interrupt
 void Motion_task_disable(void)
 {
 	motion_task_isr_enabled = false;
-	TIM_ITConfig(MOTION_TASK_TIM, TIM_IT_Update, DISABLE);
-	TIM_ClearITPendingBit(MOTION_TASK_TIM, TIM_IT_Update);
+	TIM_ITConfig(PWM_TIM, TIM_IT_Update, DISABLE);
+	ADC_ITConfig(ADC_LSS_SYNC, ADC_IT_JEOC, DISABLE);
+	TIM_ClearITPendingBit(PWM_TIM, TIM_IT_Update);
+	ADC_ClearITPendingBit(ADC_LSS_SYNC, ADC_IT_JEOC);
 }
 
 volatile bool motion_task_overrun;
@@ -617,23 +745,31 @@ volatile bool service_task_overrun;
 volatile uint32_t service_task_overrun_count;
 volatile uint16_t service_task_execution_us;
 
-void TIM4_IRQHandler(void) //MOTION_TASK_TIM
+void TIM1_UP_IRQHandler(void) //PWM_TIM update - motion task sampling
 {
-	if(TIM_GetITStatus(MOTION_TASK_TIM, TIM_IT_Update) != RESET)
-	{	
-		TIM_ClearITPendingBit(MOTION_TASK_TIM, TIM_IT_Update);
+	if(TIM_GetITStatus(PWM_TIM, TIM_IT_Update) != RESET)
+	{
+		TIM_ClearITPendingBit(PWM_TIM, TIM_IT_Update);
+		Encoder_startRead(); //the angle is transferred by DMA, ADC_LSS_SYNC was started by the update in hardware
+	}
+}
+
+void ADC1_2_IRQHandler(void) //ADC_LSS_SYNC injected conversions done - motion task compute
+{
+	if(ADC_GetITStatus(ADC_LSS_SYNC, ADC_IT_JEOC) != RESET)
+	{
+		ADC_ClearITPendingBit(ADC_LSS_SYNC, ADC_IT_JEOC);
 
 		// ! Call the task here !
 		Motion_task();
 		
 		//Task diagnostic
-		motion_task_execution_us = TIM_GetCounter(MOTION_TASK_TIM); //get current timer value in uS thanks to the prescaler
-		if(TIM_GetITStatus(MOTION_TASK_TIM, TIM_IT_Update) != RESET) //if timer reset during execution, we have an overrun
+		motion_task_execution_us = TIM_GetCounter(MOTION_TASK_TIM); //uS since the PWM_TIM update that sampled the inputs
+		if(TIM_GetFlagStatus(PWM_TIM, TIM_FLAG_Update) != RESET) //the next update came during execution - the compare values missed it, we have an overrun
 		{
 			motion_task_overrun = true;
-			motion_task_execution_us += MOTION_TASK_TIM->ARR; //assume that timer rolled over and add the full period to the current value
+			motion_task_execution_us += motion_task_period_us; //MOTION_TASK_TIM was reset by that update
 			motion_task_overrun_count++;
-			TIM_ClearITPendingBit(MOTION_TASK_TIM, TIM_IT_Update); //don't allow to reenter this task if it overruns. Being highest priority it would block everything.
 		}else{
 			motion_task_overrun = false;
 		}
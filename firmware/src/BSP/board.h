@@ -34,6 +34,7 @@
 #define ADC_12bit 4096
 //MCU power supply
 #define mVREFINT 1200u
+#define ADC_OVERSAMPLING 16U //regular scans averaged by the getters - ~40uS per scan
 
 
 //SW
@@ -67,16 +68,18 @@
 #define VREF_TIM_MAX		(SINE_MAX>>VREF_SCALER)  //timer threshold - higher frequency timer works better with voltage low pass filter - less ripple
 
 #define PWM_TIM             TIM1
-#define PWM_TIM_MAX         (SINE_MAX>>PWM_SCALER)
-#define PWM_TIM_MIN         2U
+#define PWM_TIM_MAX         pwm_tim_max  //center aligned - one PWM period per motion task period, the ARR copy kept by Motion_task_init()
+#define PWM_TIM_ON          (PWM_TIM_MAX + 1U) //compare above the period - output permanently active
 
 #define GPIO_LSS            GPIOA
 #define PIN_LSS_A           GPIO_Pin_0
 #define PIN_LSS_B           GPIO_Pin_1
 #define ADC_CH_LSS_A        ADC_Channel_0
 #define ADC_CH_LSS_B        ADC_Channel_1
-#define ADC_LSS             ADC1
-#define LSS_OP_OFFSET       0.080f //V
+#define ADC_LSS             ADC1 //LSS_A injected conversion at the PWM_TIM overflow - center of the bridge A drive pulse
+#define ADC_LSS_SYNC        ADC2 //LSS_B injected conversion at the PWM_TIM update - center of the bridge B drive pulse
+#define LSS_OP_OFFSET_mV    80U //mV
+#define LSS_GAIN_mV_PER_A   920U //mV/A - sense resistor and amplifier
 
 
 //DClink
@@ -96,6 +99,12 @@
 #define R1_VDIV_VBAT        56.0 //kohm
 #define R2_VDIV_VBAT        5.6  //kohm
 
+#define ADC_SCAN_DMA        DMA1_Channel1 //ADC1 regular scan
+#define ADC_SCAN_DMA_FLAG_TC DMA1_FLAG_TC1
+
+
+//angle sensor reads from the main loop mask the motion task, which reads the same sensor
+#define BASEPRI_MASK_MOTION_TASK	(1U << 5) //preemption priority 1 with NVIC_PriorityGroup_3
 
 //A1333
 #define PIN_A1333     		GPIOB
@@ -103,6 +112,7 @@
 #define PIN_A1333_SCK   	GPIO_Pin_13
 #define PIN_A1333_MISO   	GPIO_Pin_14
 #define PIN_A1333_MOSI   	GPIO_Pin_15
+#define A1333_SPI			SPI2
 
 //TLE5012B
 #define TLE5012B_SPIx		2
@@ -113,9 +123,17 @@
 #define PIN_TLE5012B_DATA   GPIO_Pin_15
 #if (TLE5012B_SPIx == 1)
     #define TLE5012B_SPI	SPI1
+    #define TLE5012B_DMA_RX				DMA1_Channel2
+    #define TLE5012B_DMA_RX_IRQn		DMA1_Channel2_IRQn
+    #define TLE5012B_DMA_RX_IRQHandler	DMA1_Channel2_IRQHandler
+    #define TLE5012B_DMA_RX_IT_TC		DMA1_IT_TC2
 #endif
 #if (TLE5012B_SPIx == 2)
     #define TLE5012B_SPI	SPI2
+    #define TLE5012B_DMA_RX				DMA1_Channel4
+    #define TLE5012B_DMA_RX_IRQn		DMA1_Channel4_IRQn
+    #define TLE5012B_DMA_RX_IRQHandler	DMA1_Channel4_IRQHandler
+    #define TLE5012B_DMA_RX_IT_TC		DMA1_IT_TC4
 #endif
     
 
@@ -133,8 +151,6 @@ bool F2_button_state(void);
 void Set_Error_LED(bool state);
 void Set_Func_LED(bool state);
 
-void adc_update_all(void);
-
 float GetVDDA(void);
 uint16_t GetMcuVoltage_mV(void);
 float GetChipTemp(void);
@@ -144,6 +160,8 @@ float GetSupplyVoltage(void); //V_bat
 uint16_t GetSupplyVoltage_mV(void);
 float Get_PhaseA_Current(void);
 float Get_PhaseB_Current(void);
+uint16_t Get_PhaseA_Current_mA(void); //last LSS sample, the bridge current only flows through the sense resistor while driving
+uint16_t Get_PhaseB_Current_mA(void);
 
 #define MHz_to_Hz	(uint32_t)(1000000)
 #define s_to_ms 	(1000U)
@@ -152,6 +170,8 @@ float Get_PhaseB_Current(void);
 void Motion_task_init(uint16_t taskPeriod);
 void Serivice_task_init(void);
 
+extern uint16_t pwm_tim_max; //PWM_TIM_MAX - read in the commutation instead of the timer register
+
 extern volatile bool motion_task_isr_enabled;
 void Motion_task_enable(void);
 void Motion_task_disable(void);
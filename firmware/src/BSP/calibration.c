@@ -20,6 +20,8 @@
  */
  
 #include "calibration.h"
+#include "calibration_lookup.h"
+#include "calibration_record.h"
 #include "nonvolatile.h"
 #include "flash.h"
 #include "motor.h"
@@ -30,12 +32,113 @@
 #include "utils.h"
 #include "board.h"
 #include <math.h>
+#include <stddef.h>
 
 static volatile CalData_t calData[CALIBRATION_TABLE_SIZE];
+static uint16_t calibrationCounter; //counter of the loaded record, the next calibration stores it incremented
+
+//harmonic fit - encoder error sampled between the calibration points of both passes
+#define CALIBRATION_HARMONIC_DECIMATION	16U	//microsteps between the samples
+static float harmonicSum[2U * CALIBRATION_HARMONICS_MAX];
+static uint32_t harmonicSamples;
+static uint16_t harmonicRef;
+
+//sensor latency identification - velocity loop on voltage commutation, both directions per candidate latency
+#define LATENCY_ID_POINTS				9U		//candidate latencies - 0 to twice the nominal delay, then around the vertex
+#define LATENCY_ID_STEP_FINE			32U		//us - candidate spacing of the last pass
+#define LATENCY_ID_SETTLE_MS			400U	//velocity loop transient after the speed change
+#define LATENCY_ID_MEASURE_MS			300U
+#define LATENCY_ID_SAMPLE_MS			10U		//the service task updates the phase currents
+#define LATENCY_ID_SPEED_MAX			(10U * ANGLE_STEPS)	//angleraw/s
+#define LATENCY_ID_CURRENT_LIM			2000	//mA - closeloop limit during the identification
+
+//continuous calibration - open loop rotation at constant speed, the encoder sampled every motion task tick
+#define CALIBRATION_SWEEP_BINS			(2U * CALIBRATION_TABLE_SIZE)	//centered on the calibration points and between them
+#define CALIBRATION_SWEEP_HALF_BIN		(ANGLE_STEPS / (2U * CALIBRATION_SWEEP_BINS))
+#define CALIBRATION_SWEEP_SPEED			2U		//rev/s
+#define CALIBRATION_SWEEP_REVOLUTIONS	1U		//measured per direction
+#define CALIBRATION_SWEEP_RAMP_MS		100U	//acceleration and deceleration
+#define CALIBRATION_SWEEP_SETTLE_MS		100U	//constant speed before the measurement - rotor lag and sensor hysteresis settle
+#define CALIBRATION_SWEEP_MEAN_Q		2U
+
+typedef enum {
+	SWEEP_IDLE = 0,
+	SWEEP_ACCELERATE,
+	SWEEP_SETTLE,
+	SWEEP_MEASURE,
+	SWEEP_DECELERATE
+} SweepState_t;
+
+typedef struct {
+	volatile SweepState_t state;	//set by the main loop when idle, by the motion task otherwise
+	int8_t dir;
+	int64_t elecAngle_q16;	//commanded electric angle
+	int32_t speed_q16;		//electric angle per tick
+	int32_t speedMax_q16;
+	int32_t accel_q16;		//speed change per tick
+	uint32_t ticks;			//ticks in the current state
+	uint32_t rampTicks;
+	uint32_t settleTicks;
+	uint32_t measureTicks;
+	uint16_t latencyComp;	//shaft angle traveled during the sensor latency
+	bool refSet;
+} CalibrationSweep_t;
+
+static CalibrationSweep_t sweep;
+static int32_t sweepSum[CALIBRATION_SWEEP_BINS];		//encoder error - sweepRef
+static uint16_t sweepCount[CALIBRATION_SWEEP_BINS];
+static int16_t sweepForward[CALIBRATION_SWEEP_BINS];	//mean error of the first pass, Q CALIBRATION_SWEEP_MEAN_Q
+static uint16_t sweepRef;
+
+//online refinement - a rotor turned by the load without current keeps its speed over a revolution,
+//so the time spent in each segment between the calibration points tells its real width
+#define CALIBRATION_REFINE_SPEED_MIN		(ANGLE_STEPS / 2U)	//rev/s/65536 - segment time fits the Q4 ticks
+#define CALIBRATION_REFINE_SPEED_MAX		(ANGLE_STEPS * 20U)	//rev/s/65536 - enough ticks per segment
+#define CALIBRATION_REFINE_TIME_Q			4U		//segment time in 1/16 ticks
+#define CALIBRATION_REFINE_ACCEL_MAX		64U		//revolution time change between revolutions up to 1/64
+#define CALIBRATION_REFINE_REVOLUTIONS		16U		//averaged per table update
+#define CALIBRATION_REFINE_ERROR_Q			4U
+#define CALIBRATION_REFINE_DRIFT			0.25f	//angleraw^2 - uncertainty added per update, lets the table follow a drifting sensor
+#define CALIBRATION_REFINE_COMMIT_ERROR		4		//angleraw - table change worth a flash write
+#define CALIBRATION_REFINE_UNSYNCED			0xFFU
+#define CALIBRATION_REFINE_UNTIMED			0xFEU
+
+typedef struct {
+	uint8_t segment;		//segment of the last sample
+	uint8_t segments;		//segments timed in this revolution, or unsynced / untimed
+	uint8_t start;			//first timed segment
+	int8_t dir;
+	uint16_t angle;			//last corrected angle
+	uint32_t time;			//in the current segment, Q CALIBRATION_REFINE_TIME_Q
+	uint16_t times[CALIBRATION_TABLE_SIZE];	//Q CALIBRATION_REFINE_TIME_Q
+} CalibrationRefine_t;
+
+typedef struct {
+	volatile bool ready;	//set by the motion task, cleared by the main loop
+	uint8_t start;
+	int8_t dir;
+	uint16_t times[CALIBRATION_TABLE_SIZE];
+} CalibrationRevolution_t;
+
+static CalibrationRefine_t refine = {.segments = CALIBRATION_REFINE_UNSYNCED};
+static CalibrationRevolution_t refineRevolution;
+static int32_t refineSum[CALIBRATION_TABLE_SIZE];		//error at the calibration points, Q CALIBRATION_REFINE_ERROR_Q
+static uint32_t refineSqSum[CALIBRATION_TABLE_SIZE];
+static uint16_t refineRevolutions;
+static uint32_t refineLastTime;						//time of the previous revolution
+static bool calibrationTable = false;				//calData holds a point table - harmonic models are not refined
+static bool refineUpdated = false;					//table changed since it was loaded
+static bool refineCommitted = false;				//one flash write per power cycle
+
+//hysteresis correction - the step passes measure the band, the direction of the last motion selects its side
+#define CALIBRATION_HYSTERESIS_SPEED		(ANGLE_STEPS / 4U)	//rev/s/65536 - above the speed noise at rest
+#define CALIBRATION_HYSTERESIS_SMOOTH		4		//points averaged on each side - a single point scatters with the rotor friction
+static int8_t hysteresisDir = 0;					//kept while the speed is within the band, 0 corrects the average
 
 static void CalibrationTable_updateTableValue(uint16_t index, uint16_t value){
 	calData[index].value =	value;
 	calData[index].error = ANGLE_STEPS / CALIBRATION_TABLE_SIZE;
+	calData[index].hysteresis = 0; //the sweep passes differ by the lag of the current at speed - only the step passes measure it
 }
 
 bool CalibrationTable_calValid(void){
@@ -60,68 +163,224 @@ static uint16_t interp(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint1
 	y = y1 + (uint16_t)((uint32_t)dx2 * dy / dx);
 	return y;
 }
-static uint16_t CalibrationTable_reverseLookup(uint16_t encoderAngle){
-	//guess matching index based on monotonicity and roughly regular spacing of the angle sensor
-	uint16_t idx1 = (uint16_t)((uint32_t)(uint16_t)(encoderAngle - calData[0].value) * CALIBRATION_TABLE_SIZE / ANGLE_STEPS);
-	//search precise match around guessed location
-	//at SAMPLING_PERIOD_uS==40, CPU can handle about 50 loops
-	uint16_t x = encoderAngle;
-	for(uint16_t i = 0; i < 20U; i++){//todo - make this a define
-		//compare the valeus
-		uint16_t x1 = calData[idx1].value;//(0-65535)
-		uint16_t x_x1 = x - x1;  //Utilize wrap around effect of subtraction to deal of with x2<x1 on calibration table wrap
-		if (((int16_t)x_x1 >= 0)){//} && (x_x1 < (2U * (uint16_t)(ANGLE_STEPS / CALIBRATION_TABLE_SIZE)))){
-			uint16_t idx2 = (idx1 + 1U)%CALIBRATION_TABLE_SIZE;
-			uint16_t x2 = calData[idx2].value;//(0-65535)
-			uint16_t x2_x = x2 - x;
-			if((int16_t)x2_x > 0){ //match has been found
-				//x1=a1  y1=b1=i*(65536/200)+0.5   x2=a2  y2=b2=(i+1)*(65536/200)+0.5   x=encoderAngle
-				uint16_t y1 = (uint16_t)((uint32_t) idx1 * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
-				uint16_t y2 = (uint16_t)((uint32_t) idx2 * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
-				uint16_t y = interp(x1,y1,x2,y2,x); //y=y1+k(x-x1), k=(y2-y1)/(x2-x1)
-				return y;//(0-65535)
-			}else{//actual match is further to the right
-				idx1=(idx1+1U)%CALIBRATION_TABLE_SIZE;
-			}
-		}else{//actual match is further to the left
-			idx1=(idx1-1U)%CALIBRATION_TABLE_SIZE;
+
+//motion task only - the sensor lags the motion by half the band, the calibration table alone is CalibrationLookup_angle()
+uint16_t GetCorrectedAngle(uint16_t encoderAngle){ //(0-65535)
+	uint16_t angle = CalibrationLookup_angle(encoderAngle);//0-65535
+	if (speed_slow > (int32_t)CALIBRATION_HYSTERESIS_SPEED){
+		hysteresisDir = 1;
+	}else if (speed_slow < -(int32_t)CALIBRATION_HYSTERESIS_SPEED){
+		hysteresisDir = -1;
+	}else{
+		//within the band - the sensor still lags the last motion
+	}
+	return angle - (uint16_t)(int16_t)(hysteresisDir * CalibrationLookup_hysteresis(angle));
+}
+
+//the refinement restarts with every new table
+static void CalibrationRefine_reset(void){
+	refine.segments = CALIBRATION_REFINE_UNSYNCED;
+	refineRevolution.ready = false;
+	refineRevolutions = 0;
+	refineLastTime = 0;
+	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+		refineSum[i] = 0;
+		refineSqSum[i] = 0;
+	}
+}
+
+//rebuild the inverse lookup after the calibration table changes
+static void CalibrationTable_updateLookup(void){
+	uint16_t values[CALIBRATION_TABLE_SIZE];
+	int16_t bands[CALIBRATION_TABLE_SIZE];
+	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+		values[i] = calData[i].value;
+		bands[i] = calData[i].hysteresis;
+	}
+	CalibrationLookup_build(values);
+	CalibrationLookup_buildHysteresis(bands);
+	calibrationTable = CalibrationTable_calValid(); //refined once measured
+	CalibrationRefine_reset();
+}
+
+//use a harmonic model - calData is filled from the model, so the table based code keeps working
+static void CalibrationTable_loadHarmonics(const FlashCalHarmonics_t *model){
+	const int16_t bands[CALIBRATION_TABLE_SIZE] = {0}; //not part of the model
+	CalibrationLookup_buildHarmonics(model);
+	CalibrationLookup_buildHysteresis(bands);
+	calibrationTable = false;
+	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+		//invert the model - the error slope is small, so it converges in a few iterations
+		uint16_t y = (uint16_t)((uint32_t)i * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+		uint16_t x = y + model->offset;
+		for (uint8_t n=0; n < 4U; n++){
+			x += (uint16_t)(int16_t)(uint16_t)(y - CalibrationLookup_angle(x));
 		}
+		calData[i].value = x;
+		calData[i].error = CALIBRATION_MIN_ERROR;
+		calData[i].hysteresis = 0;
 	}
-	return calData[idx1].value;	//calibration likely not linear - bail out with last best guess
 }
 
-uint16_t GetCorrectedAngle(uint16_t encoderAngle){ //(0-65535)
-	uint16_t fastLook = CalibrationTable_reverseLookup(encoderAngle);
-	return fastLook;//0-65535
+//project the encoder error on the harmonics of the encoder angle
+static void CalibrationHarmonics_accumulate(uint16_t encoderAngle, float error){
+	uint16_t harmonics = min((uint16_t)calibration_harmonics, (uint16_t)CALIBRATION_HARMONICS_MAX);
+
+	//cos(kx), sin(kx) by rotation
+	float x = 2.0f * 3.14159265f * (float)encoderAngle / (float)ANGLE_STEPS;
+	float c1 = cosf(x);
+	float s1 = sinf(x);
+	float ck = c1;
+	float sk = s1;
+	for (uint16_t k=0; k < harmonics; k++){
+		harmonicSum[2U * k] += error * ck;
+		harmonicSum[(2U * k) + 1U] += error * sk;
+		float c = (ck * c1) - (sk * s1);
+		sk = (sk * c1) + (ck * s1);
+		ck = c;
+	}
+	harmonicSamples++;
 }
 
-void CalibrationTable_saveToFlash(void){
-	FlashCalData_t data;
+static void CalibrationHarmonics_reset(void){
+	harmonicSamples = 0;
+	for (uint16_t k=0; k < (2U * CALIBRATION_HARMONICS_MAX); k++){
+		harmonicSum[k] = 0.0f;
+	}
+}
+
+static void CalibrationHarmonics_sample(int32_t electAngle){
+	uint16_t expectedAngle = (uint16_t)(int32_t)((int64_t)electAngle * (int64_t)ANGLE_STEPS / (int32_t)(liveMotorParams.fullStepsPerRotation * FULLSTEP_ELECTRIC_ANGLE));
+	uint16_t encoderAngle = ReadEncoderAngle();
+	if (harmonicSamples == 0U){
+		harmonicRef = encoderAngle - expectedAngle; //keeps the error small - the mean does not project on the harmonics
+	}
+	CalibrationHarmonics_accumulate(encoderAngle, (float)(int16_t)(uint16_t)(encoderAngle - expectedAngle - harmonicRef));
+}
+
+//a refined table keeps the cogging map, a new calibration erases it
+static void CalibrationTable_writeRecord(FlashCalRecord_t *record, bool keepCogging){
+	calibrationCounter++;
+	record->header.fullSteps = liveMotorParams.fullStepsPerRotation;
+	record->header.counter = calibrationCounter;
+	CalibrationRecord_seal(record);
+	uint16_t size = (uint16_t)sizeof(FlashCalHeader_t) + CalibrationRecord_payloadSize(&record->header);
+	if (keepCogging){
+		nvmUpdateCalTable(record, size);
+	}else{
+		nvmWriteCalTable(record, size); //CalTable
+	}
+}
+
+//fit the harmonics, load them and store them in flash instead of the point table
+static void CalibrationTable_saveHarmonics(void){
+	FlashCalHarmonics_t model = {0};
+	model.harmonics = min((uint16_t)calibration_harmonics, (uint16_t)CALIBRATION_HARMONICS_MAX);
+	float scale = 2.0f * (float)(1U << CALIBRATION_HARMONIC_Q) / (float)max(harmonicSamples, 1U);
+	for (uint16_t k=0; k < (2U * model.harmonics); k++){
+		model.coef[k] = (int16_t)clip(harmonicSum[k] * scale, (float)INT16_MIN, (float)INT16_MAX);
+	}
+
+	//offset from the calibration points - they are measured at rest, the commutation is aligned to them
+	model.offset = 0;
+	CalibrationLookup_buildHarmonics(&model);
+	uint16_t ref = calData[0].value;
+	int32_t sum = 0;
 	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
-		data.FlashCalData[i] = calData[i].value;
+		uint16_t y = (uint16_t)((uint32_t)i * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+		sum += (int16_t)(uint16_t)(CalibrationLookup_angle(calData[i].value) - y - ref);
 	}
-	data.status = valid;
-	
-	nvmWriteCalTable(&data); //CalTable
+	model.offset = ref + (uint16_t)(int16_t)(sum / (int32_t)CALIBRATION_TABLE_SIZE);
+
+	CalibrationTable_loadHarmonics(&model);
+
+	FlashCalRecord_t record = {0};
+	record.header.type = (uint16_t)CAL_RECORD_HARMONICS;
+	record.header.size = model.harmonics;
+	record.payload.harmonics = model;
+	CalibrationTable_writeRecord(&record, false);
 }
 
-//Reading Calibration from Flash
-static void CalibrationTable_loadFromFlash(void){
+static void CalibrationTable_saveTable(bool keepCogging){
+	FlashCalRecord_t record = {0};
+	record.header.type = (uint16_t)CAL_RECORD_TABLE_HYSTERESIS;
+	record.header.size = CALIBRATION_TABLE_SIZE;
+	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+		record.payload.table[i] = calData[i].value;
+		record.payload.table[CALIBRATION_TABLE_SIZE + i] = (uint16_t)calData[i].hysteresis;
+	}
+	CalibrationTable_writeRecord(&record, keepCogging);
+}
+
+void CalibrationTable_saveToFlash(void){
+	CalibrationTable_saveTable(false);
+}
+
+//table of any size - resampled to CALIBRATION_TABLE_SIZE, tables without the hysteresis band (NULL) correct the average
+static void CalibrationTable_loadTable(const uint16_t *table, const int16_t *bands, uint16_t size){
+	uint16_t values[CALIBRATION_TABLE_SIZE];
+	int16_t hysteresis[CALIBRATION_TABLE_SIZE] = {0};
+	CalibrationRecord_resample(table, size, values, CALIBRATION_TABLE_SIZE);
+	if (bands != NULL){
+		CalibrationRecord_resampleBand(bands, size, hysteresis, CALIBRATION_TABLE_SIZE);
+	}
 	for(uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++){
-		calData[i].value = nvmFlashCalData->FlashCalData[i]; // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+		calData[i].value = values[i];
 		calData[i].error = CALIBRATION_MIN_ERROR;
+		calData[i].hysteresis = hysteresis[i];
 	}
+	CalibrationTable_updateLookup();
+}
+
+//Reading Calibration from Flash
+static bool CalibrationTable_loadFromFlash(void){
+	const FlashCalRecord_t *record = nvmFlashCalRecord; // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+	if(CalibrationRecord_valid(record)){
+		if((liveMotorParams.fullStepsPerRotation != FULLSTEPS_NA) && (record->header.fullSteps != liveMotorParams.fullStepsPerRotation)){
+			return false; //calibrated on another motor - the table is aligned to its full steps
+		}
+		calibrationCounter = record->header.counter;
+		if(record->header.type == (uint16_t)CAL_RECORD_TABLE){
+			CalibrationTable_loadTable(record->payload.table, NULL, record->header.size);
+		}else if(record->header.type == (uint16_t)CAL_RECORD_TABLE_HYSTERESIS){
+			int16_t bands[CALIBRATION_HYSTERESIS_SIZE_MAX];
+			for (uint16_t i=0; i < record->header.size; i++){
+				bands[i] = CalibrationRecord_band(record, i);
+			}
+			CalibrationTable_loadTable(record->payload.table, bands, record->header.size);
+		}else{
+			FlashCalHarmonics_t model = record->payload.harmonics;
+			CalibrationTable_loadHarmonics(&model);
+		}
+		return true;
+	}
+
+	//legacy records - fixed size table or harmonics followed by status, kept until the next calibration
+	const FlashCalData_t *legacy = nvmFlashCalData; // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+	if(record->header.magic == CALIBRATION_RECORD_MAGIC){
+		return false; //corrupted record, not a legacy table
+	}
+	if(legacy->status == valid){
+		CalibrationTable_loadTable(legacy->FlashCalData, NULL, CALIBRATION_LEGACY_TABLE_SIZE);
+		return true;
+	}
+	if(legacy->status == CALIBRATION_LEGACY_HARMONIC_STATUS){
+		FlashCalHarmonics_t model = *nvmFlashCalHarmonics; // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+		CalibrationTable_loadHarmonics(&model);
+		return true;
+	}
+	return false;
 }
 
 void CalibrationTable_init(void){
-	if(valid == nvmFlashCalData->status){  // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
-		CalibrationTable_loadFromFlash();
-		
-	}else{
+	calibrationCounter = 0;
+	if(!CalibrationTable_loadFromFlash()){
 		for(uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++){
 			calData[i].value = 0;
 			calData[i].error = CALIBRATION_ERROR_NOT_SET;
+			calData[i].hysteresis = 0;
 		}
+		CalibrationTable_updateLookup();
 	}
 }
 
@@ -201,6 +460,7 @@ bool Learn_StepSize_WiringPolarity(void){
 //normalize the calData starting point regardles of what angle calibration was started at
 static void CalibrationTable_normalizeStartIdx(void){
 	uint16_t tempData[CALIBRATION_TABLE_SIZE];
+	int16_t tempBand[CALIBRATION_TABLE_SIZE];
 	uint16_t wrapIdx=0;
 	uint16_t wrapFinds=0;
 
@@ -208,6 +468,7 @@ static void CalibrationTable_normalizeStartIdx(void){
 	const uint16_t calData_2AngleSteps = ANGLE_STEPS / CALIBRATION_TABLE_SIZE * 2U;
 	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
 		tempData[i] = calData[i].value; //copy
+		tempBand[i] = calData[i].hysteresis;
 
 		//find wrap point
 		if((i>0U) && (calData[CALIBRATION_TABLE_SIZE-i].value < calData_2AngleSteps) \
@@ -232,11 +493,57 @@ static void CalibrationTable_normalizeStartIdx(void){
 		//shift data
 		for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
 			calData[(i + shiftBy)%CALIBRATION_TABLE_SIZE].value = tempData[i];
+			calData[(i + shiftBy)%CALIBRATION_TABLE_SIZE].hysteresis = tempBand[i];
 		}
 	}
 }
 
 
+//the friction holds the open loop rotor behind the command - both passes lag, in opposite directions,
+//which the difference of the passes would take for hysteresis
+static int16_t CalibrationHysteresis_frictionBand(int32_t frictionCurrent){
+	float load = clip((float)frictionCurrent / (float)CALIBRATION_STEPPING_CURRENT, 0.0f, 1.0f);
+	float polePairs = (float)liveMotorParams.fullStepsPerRotation / 4.0f;
+	float lag = asinf(load) * (float)ANGLE_STEPS / (2.0f * 3.14159265f * polePairs); //angleraw
+	return (int16_t)lroundf(-2.0f * lag);
+}
+
+//circular moving average of the band - the hysteresis changes slowly around the magnet
+static void CalibrationHysteresis_smooth(void){
+	int16_t bands[CALIBRATION_TABLE_SIZE];
+	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+		bands[i] = calData[i].hysteresis;
+	}
+	for (int16_t i=0; i < (int16_t)CALIBRATION_TABLE_SIZE; i++ ){
+		int32_t sum = 0;
+		for (int16_t k=-CALIBRATION_HYSTERESIS_SMOOTH; k <= CALIBRATION_HYSTERESIS_SMOOTH; k++){
+			sum += bands[(i + k + (int16_t)CALIBRATION_TABLE_SIZE) % (int16_t)CALIBRATION_TABLE_SIZE];
+		}
+		calData[i].hysteresis = (int16_t)(sum / ((2 * CALIBRATION_HYSTERESIS_SMOOTH) + 1));
+	}
+}
+
+//largest deviation of the table from a linear one
+static uint16_t CalibrationTable_maxError(void){
+	//calculate average sensor offset
+	int32_t sumCalOffset = 0;
+	for(uint16_t idx = 0; idx < CALIBRATION_TABLE_SIZE; ++idx){
+		uint16_t angleLinear = (uint16_t)(idx * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+		int16_t calOffset = (int16_t)(uint16_t)(calData[idx].value - angleLinear);
+		sumCalOffset += calOffset;
+	}
+	uint16_t angleCalOffsetAvg = (uint16_t)(int32_t)(sumCalOffset/(int16_t)CALIBRATION_TABLE_SIZE);
+
+	//find divergance from the average
+	uint16_t maxError = 0;
+	for(uint16_t idx = 0; idx < CALIBRATION_TABLE_SIZE; ++idx){
+		uint16_t angleLinear = (uint16_t)(idx * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+		uint16_t dist_abs = (uint16_t)fastAbs((int16_t)(uint16_t)(calData[idx].value - angleCalOffsetAvg - angleLinear));
+		maxError = (dist_abs > maxError) ? dist_abs : maxError;
+	}
+	return maxError;
+}
+
 //The encoder needs to be calibrated to the motor.
 // we will assume full step detents are correct,
 // ex 1.8 degree motor will have 200 steps for 360 degrees.
@@ -246,16 +553,19 @@ static void CalibrationTable_normalizeStartIdx(void){
 static uint16_t CalibrationRotation(int8_t dir, bool verifyOnly, bool firstPass){
 	const uint16_t stepCurrent = CALIBRATION_STEPPING_CURRENT;
 	const uint16_t microStepDelay = 30U;  	//[uS] controls calibration speed
-	const uint16_t stabilizationDelay = 0U; //[uS] wait for taking measurements - some medium stopping time can cause resonance, long stopping time can cause oveheat
+	const uint16_t stabilizationDelay = 10000U; //[uS] wait for taking measurements - the rotor still swings after a shorter stop, that would add to the hysteresis
 	const uint16_t stepOversampling = 3U;  		//measurements to take per point, note large will take some time
 	const uint16_t microStep = FULLSTEP_ELECTRIC_ANGLE; //microsteping resolution in between taking measurements
 
 	static int32_t electAngle;//electric angle - static carry value over between passes
 	if (firstPass){
 		electAngle = 0; //initialize angle only for the first pass
+		CalibrationHarmonics_reset();
 	}
+	const bool sampleHarmonics = !verifyOnly && (calibration_harmonics > 0U);
 	const uint16_t preRunSteps = CALIBRATION_TABLE_SIZE/2U; //half rotation preRun to saturate hysteresis of the angle sensor / magnet
 	const uint16_t passSteps = preRunSteps + CALIBRATION_TABLE_SIZE;
+	const int16_t frictionBand = CalibrationHysteresis_frictionBand(friction_coulomb_current);
 	
 	for (uint16_t step = 0; step < passSteps; ++step)
 	{
@@ -268,6 +578,7 @@ static uint16_t CalibrationRotation(int8_t dir, bool verifyOnly, bool firstPass)
 			
 			volatile uint16_t sampled = OverSampleEncoderAngle(stepOversampling);
 			volatile uint16_t anglePass; //stores average on the second pass
+			volatile int16_t band = 0; //turning up minus turning down, the second pass turns dir
 			if(firstPass){
 				anglePass = sampled;
 			}else{
@@ -286,12 +597,14 @@ static uint16_t CalibrationRotation(int8_t dir, bool verifyOnly, bool firstPass)
 					return (ANGLE_STEPS/2U) + (uint16_t)deltaCal; 
 				}
 				anglePass = cal + (uint16_t)(int16_t)(deltaCal/2);
+				band = (int16_t)(dir * deltaCal) - frictionBand;
 			}
 			if(!verifyOnly){
 				volatile int16_t calIdx;
 				calIdx = (calcStep / (int16_t)(uint16_t)(liveMotorParams.fullStepsPerRotation / CALIBRATION_TABLE_SIZE));
 				calIdx = (calIdx + (int16_t)CALIBRATION_TABLE_SIZE*2) % (int16_t)CALIBRATION_TABLE_SIZE; //adds 2*CALIBRATION_TABLE_SIZE, to make sure modulo gives positive value 
 				CalibrationTable_updateTableValue((uint16_t)calIdx, anglePass);
+				calData[calIdx].hysteresis = band;
 			}
 		}
 		const uint8_t stepDivCal_q4 = (uint8_t)(((uint16_t)(CALIBRATION_TABLE_SIZE << 4U)) / liveMotorParams.fullStepsPerRotation);
@@ -300,28 +613,328 @@ static uint16_t CalibrationRotation(int8_t dir, bool verifyOnly, bool firstPass)
 			electAngle += dir * (int32_t)(uint16_t)(FULLSTEP_ELECTRIC_ANGLE/microStep);//dir can be negative on first pass depending on higher level settings
 			openloop_step((uint16_t) electAngle, stepCurrent);
 			delay_us(microStepDelay);
+			if (sampleHarmonics && !preRun && ((i % CALIBRATION_HARMONIC_DECIMATION) == 0U)){
+				CalibrationHarmonics_sample(electAngle);
+			}
 		}
 	}
 
-	//calculate average sensor offset
-	int32_t sumCalOffset = 0;
-	for(uint16_t idx = 0; idx < CALIBRATION_TABLE_SIZE; ++idx){
-		uint16_t angleLinear = (uint16_t)(idx * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
-		int16_t calOffset = (int16_t)(uint16_t)(calData[idx].value - angleLinear);
-		sumCalOffset += calOffset;
+	return CalibrationTable_maxError();
+}
+
+//commanded shaft angle - the floor keeps both directions on the same grid
+static uint16_t CalibrationSweep_shaftAngle(void){
+	int32_t elecAngle_q8 = (int32_t)(sweep.elecAngle_q16 >> 8);
+	int32_t steps = (int32_t)liveMotorParams.fullStepsPerRotation;
+	int32_t angle = elecAngle_q8 / steps; //electric angle * ANGLE_STEPS / (steps * FULLSTEP_ELECTRIC_ANGLE)
+	if ((elecAngle_q8 % steps) < 0){
+		angle--;
 	}
-	uint16_t angleCalOffsetAvg = (uint16_t)(int32_t)(sumCalOffset/(int16_t)CALIBRATION_TABLE_SIZE);
+	return (uint16_t)angle;
+}
 
-	//find divergance from the average
-	uint16_t maxError = 0;
-	for(uint16_t idx = 0; idx < CALIBRATION_TABLE_SIZE; ++idx){
-		uint16_t angleLinear = (uint16_t)(idx * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
-		uint16_t dist_abs = (uint16_t)fastAbs((int16_t)(uint16_t)(calData[idx].value - angleCalOffsetAvg - angleLinear));
-		maxError = (dist_abs > maxError) ? dist_abs : maxError;
+static void CalibrationSweep_record(uint16_t encoderAngle, uint16_t shaftAngle){
+	if (!sweep.refSet){
+		sweepRef = encoderAngle - shaftAngle; //keeps the sums small
+		sweep.refSet = true;
 	}
-	return maxError;
+	int16_t error = (int16_t)(uint16_t)(encoderAngle - shaftAngle - sweepRef);
+	uint16_t bin = (uint16_t)(((uint32_t)(uint16_t)(shaftAngle + CALIBRATION_SWEEP_HALF_BIN) * CALIBRATION_SWEEP_BINS) >> 16);
+	sweepSum[bin] += error;
+	sweepCount[bin]++;
+}
+
+//motion task - one step of the open loop sweep, the encoder is read before the new angle is commanded
+void CalibrationSweep_process(void){
+	if (sweep.state == SWEEP_IDLE){
+		return;
+	}
+	sweep.ticks++;
+	switch (sweep.state){
+	case SWEEP_ACCELERATE:
+		sweep.speed_q16 += sweep.accel_q16;
+		if (sweep.ticks >= sweep.rampTicks){
+			sweep.speed_q16 = sweep.speedMax_q16;
+			sweep.ticks = 0;
+			sweep.state = SWEEP_SETTLE;
+		}
+		break;
+	case SWEEP_SETTLE:
+		if (sweep.ticks >= sweep.settleTicks){
+			sweep.ticks = 0;
+			sweep.state = SWEEP_MEASURE;
+		}
+		break;
+	case SWEEP_MEASURE:
+		//the sample was taken latency ago - the rotor lag and the rest of the latency cancel out between the directions
+		//a rejected sample is skipped - the bins are averages and do not need every tick
+		EncoderSample_t sample;
+		if (FetchEncoderSample(&sample)){
+			CalibrationSweep_record(sample.angle, CalibrationSweep_shaftAngle() - sweep.latencyComp);
+		}
+		if (sweep.ticks >= sweep.measureTicks){
+			sweep.ticks = 0;
+			sweep.state = SWEEP_DECELERATE;
+		}
+		break;
+	case SWEEP_DECELERATE:
+		sweep.speed_q16 = max(sweep.speed_q16 - sweep.accel_q16, 0);
+		if (sweep.ticks >= sweep.rampTicks){
+			sweep.speed_q16 = 0;
+			sweep.state = SWEEP_IDLE;
+		}
+		break;
+	default:
+		sweep.state = SWEEP_IDLE;
+		break;
+	}
+	sweep.elecAngle_q16 += (int64_t)sweep.dir * sweep.speed_q16;
+	openloop_step((uint16_t)(sweep.elecAngle_q16 >> 16), CALIBRATION_STEPPING_CURRENT);
+}
+
+//one direction - ramp up, settle, measure, ramp down
+static void CalibrationSweep_pass(int8_t dir){
+	const uint32_t elecPerRev = (uint32_t)liveMotorParams.fullStepsPerRotation * FULLSTEP_ELECTRIC_ANGLE;
+	sweep.dir = dir;
+	sweep.speed_q16 = 0;
+	sweep.ticks = 0;
+	sweep.measureTicks = CALIBRATION_SWEEP_REVOLUTIONS * SAMPLING_HZ / CALIBRATION_SWEEP_SPEED;
+	sweep.speedMax_q16 = (int32_t)(((uint64_t)elecPerRev * CALIBRATION_SWEEP_REVOLUTIONS << 16) / sweep.measureTicks); //whole revolutions
+	sweep.rampTicks = CALIBRATION_SWEEP_RAMP_MS * SAMPLING_HZ / 1000U;
+	sweep.settleTicks = CALIBRATION_SWEEP_SETTLE_MS * SAMPLING_HZ / 1000U;
+	sweep.accel_q16 = sweep.speedMax_q16 / (int32_t)sweep.rampTicks;
+	sweep.latencyComp = (uint16_t)(int16_t)(dir * (int32_t)(CALIBRATION_SWEEP_SPEED * ANGLE_STEPS * Encoder_latency_us() / S_to_uS));
+	sweep.state = SWEEP_ACCELERATE;
+	while (sweep.state != SWEEP_IDLE){
+		delay_ms(10);
+	}
+}
+
+//mean error of each bin, Q CALIBRATION_SWEEP_MEAN_Q - false if a bin was not sampled
+static bool CalibrationSweep_means(int16_t means[CALIBRATION_SWEEP_BINS]){
+	bool complete = true;
+	for (uint16_t b=0; b < CALIBRATION_SWEEP_BINS; b++){
+		if (sweepCount[b] == 0U){
+			complete = false;
+		}else{
+			means[b] = (int16_t)((sweepSum[b] * (1 << CALIBRATION_SWEEP_MEAN_Q)) / (int32_t)sweepCount[b]);
+		}
+		sweepSum[b] = 0;
+		sweepCount[b] = 0;
+	}
+	return complete;
+}
+
+//continuous calibration - both directions averaged like the two step passes
+static uint16_t CalibrationSweep(int8_t dir){
+	bool state = motion_task_isr_enabled;
+	sweep.state = SWEEP_IDLE;
+	sweep.elecAngle_q16 = 0; //starts at the electric angle of the holding step
+	sweep.refSet = false;
+	for (uint16_t b=0; b < CALIBRATION_SWEEP_BINS; b++){
+		sweepSum[b] = 0;
+		sweepCount[b] = 0;
+	}
+	StepperCtrl_setMotionMode(STEPCTRL_OPENLOOP_CALIBRATION);
+	Motion_task_enable();
+
+	int16_t reverse[CALIBRATION_SWEEP_BINS];
+	CalibrationSweep_pass(dir);
+	bool complete = CalibrationSweep_means(sweepForward);
+	CalibrationSweep_pass(-dir);
+	complete = CalibrationSweep_means(reverse) && complete;
+
+	if (!state){
+		Motion_task_disable();
+	}
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+	if (!complete){
+		return ANGLE_STEPS/2U; //the rotor did not follow
+	}
+
+	CalibrationHarmonics_reset();
+	for (uint16_t b=0; b < CALIBRATION_SWEEP_BINS; b++){
+		int16_t deltaCal = (int16_t)((sweepForward[b] - reverse[b]) / (1 << CALIBRATION_SWEEP_MEAN_Q));
+		if ((deltaCal > CALIBRATION_MAX_HYSTERESIS) || (deltaCal < -CALIBRATION_MAX_HYSTERESIS)){
+			return (ANGLE_STEPS/2U) + (uint16_t)fastAbs(deltaCal);
+		}
+		int32_t error_q = (int32_t)sweepForward[b] + reverse[b]; //Q CALIBRATION_SWEEP_MEAN_Q + 1
+		uint16_t angle = (uint16_t)((uint32_t)b * ANGLE_STEPS / CALIBRATION_SWEEP_BINS);
+		uint16_t encoderAngle = angle + sweepRef + (uint16_t)(int16_t)((error_q + (1 << CALIBRATION_SWEEP_MEAN_Q)) >> (CALIBRATION_SWEEP_MEAN_Q + 1U));
+		if ((b % (CALIBRATION_SWEEP_BINS / CALIBRATION_TABLE_SIZE)) == 0U){
+			CalibrationTable_updateTableValue(b / (CALIBRATION_SWEEP_BINS / CALIBRATION_TABLE_SIZE), encoderAngle);
+		}
+		if (calibration_harmonics > 0U){
+			CalibrationHarmonics_accumulate(encoderAngle, (float)error_q / (float)(2U << CALIBRATION_SWEEP_MEAN_Q));
+		}
+	}
+	//the bins average the error over their width - undo the attenuation of the harmonics
+	for (uint16_t k=0; k < CALIBRATION_HARMONICS_MAX; k++){
+		float x = 3.14159265f * (float)(k + 1U) / (float)CALIBRATION_SWEEP_BINS;
+		float gain = x / sinf(x);
+		harmonicSum[2U * k] *= gain;
+		harmonicSum[(2U * k) + 1U] *= gain;
+	}
+	return CalibrationTable_maxError();
+}
+
+
+
+//motion task - times the segments of the corrected angle, a whole revolution at a time
+void CalibrationRefine_process(uint16_t angle, int32_t speed){
+	CalibrationRefine_t *r = &refine;
+	uint32_t speedAbs = (uint32_t)((speed < 0) ? -speed : speed);
+	if (!calibration_refine || !calibrationTable || (speedAbs < CALIBRATION_REFINE_SPEED_MIN) || (speedAbs > CALIBRATION_REFINE_SPEED_MAX)){
+		r->segments = CALIBRATION_REFINE_UNSYNCED;
+		return;
+	}
+	int8_t dir = (speed > 0) ? 1 : -1;
+	uint8_t segment = (uint8_t)(((uint32_t)angle * CALIBRATION_TABLE_SIZE) >> 16);
+	if ((r->segments == CALIBRATION_REFINE_UNSYNCED) || (dir != r->dir)){
+		r->dir = dir;
+		r->segment = segment;
+		r->angle = angle;
+		r->segments = CALIBRATION_REFINE_UNTIMED; //timing starts at the next segment
+		return;
+	}
+	r->time += 1U << CALIBRATION_REFINE_TIME_Q;
+	if (segment != r->segment){
+		uint8_t next = (dir > 0) ? (uint8_t)((r->segment + 1U) % CALIBRATION_TABLE_SIZE) : (uint8_t)((r->segment + CALIBRATION_TABLE_SIZE - 1U) % CALIBRATION_TABLE_SIZE);
+		if (segment != next){
+			r->segments = CALIBRATION_REFINE_UNSYNCED;
+			return;
+		}
+		//part of the tick before the boundary - the angle is linear within a tick
+		uint16_t boundary = (uint16_t)(((uint32_t)((dir > 0) ? segment : r->segment) * ANGLE_STEPS) / CALIBRATION_TABLE_SIZE);
+		uint16_t before = (dir > 0) ? (uint16_t)(boundary - r->angle) : (uint16_t)(r->angle - boundary);
+		uint16_t step = (dir > 0) ? (uint16_t)(angle - r->angle) : (uint16_t)(r->angle - angle);
+		uint32_t part = ((uint32_t)before << CALIBRATION_REFINE_TIME_Q) / step;
+		uint32_t time = r->time - (1U << CALIBRATION_REFINE_TIME_Q) + part;
+		if (r->segments == CALIBRATION_REFINE_UNTIMED){
+			r->segments = 0;
+			r->start = segment;
+		}else if (time > UINT16_MAX){
+			r->segments = CALIBRATION_REFINE_UNSYNCED;
+			return;
+		}else{
+			r->times[r->segment] = (uint16_t)time;
+			r->segments++;
+		}
+		r->time = (1U << CALIBRATION_REFINE_TIME_Q) - part;
+		r->segment = segment;
+		if (r->segments == CALIBRATION_TABLE_SIZE){
+			if (!refineRevolution.ready){
+				refineRevolution.start = r->start;
+				refineRevolution.dir = r->dir;
+				for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+					refineRevolution.times[i] = r->times[i];
+				}
+				refineRevolution.ready = true;
+			}
+			r->segments = 0; //the next revolution starts here
+		}
+	}
+	r->angle = angle;
+}
+
+//error of the corrected angle at the calibration points from one revolution, Q CALIBRATION_REFINE_ERROR_Q, without the mean
+static bool CalibrationRefine_revolution(const CalibrationRevolution_t *rev, int32_t errors[CALIBRATION_TABLE_SIZE]){
+	uint32_t total = 0;
+	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+		total += rev->times[i];
+	}
+	int32_t change = (int32_t)(total - refineLastTime);
+	bool steady = (refineLastTime != 0U) && ((uint32_t)fastAbs(change) * CALIBRATION_REFINE_ACCEL_MAX <= total);
+	refineLastTime = total;
+	if (!steady){
+		return false;
+	}
+
+	//the segment time expected at constant acceleration - the revolution time changes linearly
+	float accel = (float)change / (float)total;
+	float scale = (float)(ANGLE_STEPS << CALIBRATION_REFINE_ERROR_Q) / (float)total;
+	int32_t error = 0; //at the point the rotor passes
+	for (uint16_t k=0; k < CALIBRATION_TABLE_SIZE; k++ ){
+		uint16_t i = (rev->dir > 0) ? (uint16_t)((rev->start + k) % CALIBRATION_TABLE_SIZE) : (uint16_t)((rev->start + CALIBRATION_TABLE_SIZE - k) % CALIBRATION_TABLE_SIZE);
+		uint16_t i2 = (i + 1U) % CALIBRATION_TABLE_SIZE;
+		uint16_t width = (uint16_t)((uint32_t)i2 * ANGLE_STEPS / CALIBRATION_TABLE_SIZE) - (uint16_t)((uint32_t)i * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+		float trend = 1.0f + (accel * ((((float)k + 0.5f) / (float)CALIBRATION_TABLE_SIZE) - 0.5f));
+		int32_t traveled = (int32_t)(((float)rev->times[i] * scale / trend) + 0.5f);
+		int32_t ahead = (int32_t)((uint32_t)width << CALIBRATION_REFINE_ERROR_Q) - traveled; //corrected angle against the rotor
+		if (rev->dir > 0){
+			errors[i] = error;
+			error += ahead;
+		}else{
+			errors[i2] = error;
+			error -= ahead;
+		}
+	}
+	//what is left after the revolution is a rounding error - spread it over the points
+	int32_t closure = error;
+	int32_t sum = 0;
+	for (uint16_t k=0; k < CALIBRATION_TABLE_SIZE; k++ ){
+		uint16_t i = (rev->dir > 0) ? (uint16_t)((rev->start + k) % CALIBRATION_TABLE_SIZE) : (uint16_t)((rev->start + 1U + CALIBRATION_TABLE_SIZE - k) % CALIBRATION_TABLE_SIZE);
+		errors[i] -= (closure * (int32_t)k) / (int32_t)CALIBRATION_TABLE_SIZE;
+		sum += errors[i];
+	}
+	int32_t mean = sum / (int32_t)CALIBRATION_TABLE_SIZE; //the offset is not observable, the commutation keeps it
+	for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+		errors[i] -= mean;
+		if ((uint32_t)fastAbs(errors[i]) > ((uint32_t)CALIBRATION_MAX_ERROR << CALIBRATION_REFINE_ERROR_Q)){
+			return false;
+		}
+	}
+	return true;
 }
 
+//main loop - averages the revolutions, blends them into the table weighted by the uncertainty of each point
+void CalibrationTable_refine(void){
+	if (refineRevolution.ready){
+		int32_t errors[CALIBRATION_TABLE_SIZE];
+		bool accepted = CalibrationRefine_revolution(&refineRevolution, errors);
+		refineRevolution.ready = false;
+		if (accepted){
+			for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+				refineSum[i] += errors[i];
+				refineSqSum[i] += (uint32_t)(errors[i] * errors[i]);
+			}
+			refineRevolutions++;
+		}
+	}
+
+	if (refineRevolutions >= CALIBRATION_REFINE_REVOLUTIONS){
+		const float q = (float)(1U << CALIBRATION_REFINE_ERROR_Q);
+		for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+			float mean = (float)refineSum[i] / (float)refineRevolutions;
+			float variance = ((float)refineSqSum[i] / (float)refineRevolutions) - (mean * mean);
+			float r = fmaxf(variance / (q * q * (float)refineRevolutions), 0.01f); //of the mean, angleraw^2
+			float p = ((float)calData[i].error * (float)calData[i].error) + CALIBRATION_REFINE_DRIFT;
+			float gain = p / (p + r);
+			//the corrected angle is ahead by the error at this point - the encoder reaches the point later
+			calData[i].value += (uint16_t)(int16_t)lroundf(gain * mean / q);
+			calData[i].error = (int16_t)max(lroundf(sqrtf(p * r / (p + r))), 1L);
+		}
+		CalibrationTable_updateLookup();
+		refineUpdated = true;
+	}
+
+	//commit when the motor is off and at rest - the flash write stalls the motion task
+	if (refineUpdated && !refineCommitted && calibrationTable && !enableSensored && ((uint32_t)fastAbs(speed_slow) < CALIBRATION_REFINE_SPEED_MIN)){
+		//a stored table of another size or a legacy one is replaced by any refinement
+		const FlashCalRecord_t *record = nvmFlashCalRecord; // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+		uint32_t change = (uint32_t)CALIBRATION_REFINE_COMMIT_ERROR;
+		if (CalibrationRecord_valid(record) && (record->header.type == (uint16_t)CAL_RECORD_TABLE_HYSTERESIS) && (record->header.size == CALIBRATION_TABLE_SIZE)){
+			change = 0;
+			for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+				change = max(change, fastAbs((int16_t)(uint16_t)(calData[i].value - record->payload.table[i])));
+			}
+		}
+		if (change >= (uint32_t)CALIBRATION_REFINE_COMMIT_ERROR){
+			CalibrationTable_saveTable(true);
+			refineCommitted = true;
+		}
+	}
+}
 
 uint16_t EncoderCalibrate(bool verifyOnly){
 	uint16_t maxError;
@@ -339,16 +952,33 @@ uint16_t EncoderCalibrate(bool verifyOnly){
 	}else{
 		dir = -1;
 	}
-	maxError = CalibrationRotation(dir, verifyOnly, true);
-	//wait holding two phases (half a step) for less heat generation before triggering second pass
-	openloop_step(FULLSTEP_ELECTRIC_ANGLE/2U, CALIBRATION_STEPPING_CURRENT); //first calibration pass finishes at electAngle = 0, so adding half a step wont't ruin next pass
-	delay_ms(1000);  	//give some time before motor starts to move the other direction
+	if(!verifyOnly && calibration_continuous){
+		maxError = CalibrationSweep(dir);
+	}else{
+		maxError = CalibrationRotation(dir, verifyOnly, true);
+		//wait holding two phases (half a step) for less heat generation before triggering second pass
+		openloop_step(FULLSTEP_ELECTRIC_ANGLE/2U, CALIBRATION_STEPPING_CURRENT); //first calibration pass finishes at electAngle = 0, so adding half a step wont't ruin next pass
+		delay_ms(1000);  	//give some time before motor starts to move the other direction
+		if(!verifyOnly){
+			//second calibration pass the other direction - the average cancels the magnetic hysteresis, the difference measures it
+			maxError = CalibrationRotation(-dir, verifyOnly, false);
+		}
+	}
 	if(!verifyOnly){
-		//second calibration pass the other direction - reduces influence of magnetic hysteresis
-		maxError = CalibrationRotation(-dir, verifyOnly, false);
 		if(maxError < CALIBRATION_MAX_ERROR){
+			CalibrationHysteresis_smooth();
 			CalibrationTable_normalizeStartIdx(); //this step is optional, but makes the calibration table more readable
-			CalibrationTable_saveToFlash(); //saves the calibration to flash
+			if(calibration_harmonics > 0U){
+				CalibrationTable_saveHarmonics(); //fits, loads and saves the harmonic model instead of the table
+			}else{
+				for (uint16_t i=0; i < CALIBRATION_TABLE_SIZE; i++ ){
+					calData[i].error = CALIBRATION_MIN_ERROR; //measured now - the online refinement starts from here
+				}
+				CalibrationTable_saveToFlash(); //saves the calibration to flash
+				CalibrationTable_updateLookup();
+			}
+		}else{
+			CalibrationTable_updateLookup();
 		}
 	}
 	//measure new starting point
@@ -420,3 +1050,124 @@ int8_t Estimate_motor_k_bemf(void) {
 	StepperCtrl_setMotionMode(STEPCTRL_OFF);
 	return motor_k_bemf;
 }
+
+// Select the angle sensor filter profile and store it - the latency identified with the previous one is dropped
+bool Select_sensor_profile(EncoderProfile_t profile) {
+	if (!Encoder_setProfile(profile)) {
+		return false;
+	}
+	Encoder_setLatency_us(ENCODER_LATENCY_NOMINAL);
+	nvmMirror.motorParams.sensorProfile = (uint16_t)profile;
+	nvmMirror.motorParams.sensorLatency = ENCODER_LATENCY_NOMINAL;
+	nvmWriteConfParms();
+	return true;
+}
+
+//squared phase current of both directions at each candidate latency, first + k*step - the vertex of the fitted parabola
+static float latency_vertex(int32_t speed, uint16_t first, uint16_t step) {
+	float current2[LATENCY_ID_POINTS]; //A^2
+	for (uint8_t k = 0; k < LATENCY_ID_POINTS; k++) {
+		Encoder_setLatency_us((uint16_t)(first + (k * step)));
+		current2[k] = 0.0f;
+		for (uint8_t pass = 0; pass < 2U; pass++) {
+			int32_t dir = (pass == 0U) ? 1 : -1; //alternate to stay around the start position
+			StepperCtrl_setVelocity(dir * speed);
+			delay_ms(LATENCY_ID_SETTLE_MS);
+			float sum = 0.0f;
+			uint16_t samples = 0;
+			for (uint16_t t = 0; t < LATENCY_ID_MEASURE_MS; t += LATENCY_ID_SAMPLE_MS) {
+				float i_a = Get_PhaseA_Current();
+				float i_b = Get_PhaseB_Current();
+				sum += (i_a * i_a) + (i_b * i_b); //constant over the electric period for sine currents
+				samples++;
+				delay_ms(LATENCY_ID_SAMPLE_MS);
+			}
+			current2[k] += sum / (float)samples;
+		}
+	}
+
+	//least squares over the centered candidates - the odd moments vanish
+	float xm = (float)step * (float)(LATENCY_ID_POINTS - 1U) / 2.0f;
+	float s2 = 0.0f;
+	float s4 = 0.0f;
+	float sy = 0.0f;
+	float sxy = 0.0f;
+	float sx2y = 0.0f;
+	for (uint8_t k = 0; k < LATENCY_ID_POINTS; k++) {
+		float x = ((float)k * (float)step) - xm;
+		s2 += x * x;
+		s4 += x * x * x * x;
+		sy += current2[k];
+		sxy += x * current2[k];
+		sx2y += x * x * current2[k];
+	}
+	float n = (float)LATENCY_ID_POINTS;
+	float c = ((n * sx2y) - (s2 * sy)) / ((n * s4) - (s2 * s2));
+	if (c <= 0.0f) {
+		return NAN; //no minimum
+	}
+	return (float)first + xm - (sxy / s2 / (2.0f * c));
+}
+
+// Identify the angle sensor latency - run after Estimate_motor_k_bemf()
+// The velocity loop holds a known speed on voltage commutation, the BEMF is fed forward at the compensated angle.
+// A latency error turns the applied voltage against the BEMF by speed*error and the difference drives direct axis
+// current - the phase current is smallest when the applied voltage crosses zero with the BEMF.
+// The squared current of both directions (a magnet offset cancels) is a parabola over the candidate latencies,
+// its vertex is the latency. A wrong phase_L biases the result by about I*dL/U.
+int8_t Identify_sensor_latency(void) {
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+	if (GetMotorVoltage() < MIN_SUPPLY_VOLTAGE) {
+		return -1;
+	}
+	if (motor_k_bemf <= 0) {
+		return -2;
+	}
+
+	//half of the base speed - the velocity loop keeps voltage headroom
+	int32_t speed = (int32_t)min((uint32_t)GetMotorVoltage_mV() * ANGLE_STEPS / (uint32_t)motor_k_bemf / 2U, LATENCY_ID_SPEED_MAX);
+	uint16_t identified = (nvmMirror.motorParams.sensorProfile == (uint16_t)Encoder_profile()) ? nvmMirror.motorParams.sensorLatency : ENCODER_LATENCY_NOMINAL;
+	Encoder_setLatency_us(ENCODER_LATENCY_NOMINAL);
+	uint16_t half = (uint16_t)(Encoder_latency_us() + ACTUATION_DELAY_uS);
+	uint16_t step = (uint16_t)(half / ((LATENCY_ID_POINTS - 1U) / 2U));
+	half = (uint16_t)(step * ((LATENCY_ID_POINTS - 1U) / 2U));
+
+	StepperCtrl_setCurrent(0);
+	StepperCtrl_setCloseLoopCurrentLim(LATENCY_ID_CURRENT_LIM);
+	StepperCtrl_setVelocity(0);
+	StepperCtrl_setMotionMode(STEPCTRL_FEEDBACK_VELOCITY_VOLTAGE);
+
+	//candidates from 0, then centered on the vertex with the step halved down to LATENCY_ID_STEP_FINE
+	//the parabola holds for small angle errors - the last pass repeats the fine step around a close vertex
+	uint16_t first = 0;
+	float latency = latency_vertex(speed, first, step);
+	bool found = (latency >= -(float)(2U * half)) && (latency <= (float)(4U * half)); //false for NAN
+	bool last = false;
+	while (found && !last) {
+		last = (step <= LATENCY_ID_STEP_FINE);
+		step = (uint16_t)max(step / 2U, min(step, LATENCY_ID_STEP_FINE));
+		half = (uint16_t)(step * ((LATENCY_ID_POINTS - 1U) / 2U));
+		first = (uint16_t)clip(lroundf(latency) - (long)half, 0L, (long)(UINT16_MAX - (2U * half)));
+		latency = latency_vertex(speed, first, step);
+		//the last vertex must fall between the candidates - below 0 the actuation delay is overestimated
+		float low = (first == 0U) ? -(float)(2U * half) : ((float)first - (float)(last ? step : (2U * half)));
+		float high = (float)first + (float)(last ? ((2U * half) + step) : (4U * half));
+		found = (latency >= low) && (latency <= high);
+	}
+
+	StepperCtrl_setVelocity(0);
+	delay_ms(LATENCY_ID_SETTLE_MS);
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+
+	if (!found) {
+		Encoder_setLatency_us(identified); //the previous latency stays
+		return -3;
+	}
+
+	identified = (uint16_t)max(lroundf(latency), 0L);
+	Encoder_setLatency_us(identified);
+	nvmMirror.motorParams.sensorLatency = identified;
+	nvmMirror.motorParams.sensorProfile = (uint16_t)Encoder_profile();
+	nvmWriteConfParms();
+	return 0;
+}
@@ -23,9 +23,13 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "encoder.h"
 
-//changing this requires recalibration
+//stored tables of a different size are resampled at boot
 #define	CALIBRATION_TABLE_SIZE			50U  // 50 is enough, 100, 200 also good
+#define CALIBRATION_TABLE_SIZE_MAX		248U //(FLASH_ROW_SIZE - sizeof(FlashCalHeader_t)) / 2 - the cogging map starts at the second row
+#define CALIBRATION_HYSTERESIS_SIZE_MAX	(CALIBRATION_TABLE_SIZE_MAX / 2U) //table followed by the hysteresis band
+#define CALIBRATION_TABLE_SIZE_MIN		8U
 
 #define CALIBRATION_STEPPING_CURRENT	(I_MAX_A4950)
 
@@ -34,17 +38,67 @@
 #define CALIBRATION_MAX_ERROR (546U)  //the maximal expected error on calibration 546 = 3deg
 #define CALIBRATION_MAX_HYSTERESIS (240)  //the maximal expected magnetic hysteresis between left / right calibration pass
 
+#if (CALIBRATION_TABLE_SIZE > CALIBRATION_HYSTERESIS_SIZE_MAX) || (CALIBRATION_TABLE_SIZE < CALIBRATION_TABLE_SIZE_MIN)
+#error "CALIBRATION_TABLE_SIZE does not fit the calibration record"
+#endif
+
+//record layout before the versioned format - fixed size table, status at the end
+#define CALIBRATION_LEGACY_TABLE_SIZE		50U
+#define CALIBRATION_LEGACY_HARMONIC_STATUS	(uint16_t)0x0002  //status of a legacy harmonic record, table records are valid
+
 typedef struct {
-	uint16_t FlashCalData[CALIBRATION_TABLE_SIZE];
+	uint16_t FlashCalData[CALIBRATION_LEGACY_TABLE_SIZE];
 	uint16_t status;
 } FlashCalData_t;
 
+//encoder error as a Fourier series
+#define CALIBRATION_HARMONICS_MAX		24U
+#define CALIBRATION_HARMONIC_Q			4U  //coefficients in 1/16 angleraw
+
+typedef struct {
+	uint16_t harmonics;		//number of harmonics
+	uint16_t offset;		//encoder angle at shaft angle 0, without the harmonics
+	int16_t  coef[2U * CALIBRATION_HARMONICS_MAX];	//cos, sin pairs of the encoder error vs. the encoder angle
+} FlashCalHarmonics_t; //sizeof(FlashCalHarmonics_t)=100 - the legacy status follows it
+
+//versioned calibration record - header followed by the payload
+#define CALIBRATION_RECORD_MAGIC		(uint16_t)0xCA1BU
+#define CALIBRATION_RECORD_VERSION		1U
+
+typedef enum {
+	CAL_RECORD_TABLE = 1,		//encoder angle at header.size equally spaced shaft angles
+	CAL_RECORD_HARMONICS = 2,	//FlashCalHarmonics_t, header.size harmonics
+	CAL_RECORD_TABLE_HYSTERESIS = 3	//table followed by the hysteresis band at the same points
+} CalRecordType_t;
+
+typedef struct {
+	uint16_t magic;			//CALIBRATION_RECORD_MAGIC - tells the record from a legacy table
+	uint16_t version;		//format version
+	uint16_t type;			//CalRecordType_t
+	uint16_t size;			//table points or harmonics
+	uint16_t fullSteps;		//motor full steps per rotation during calibration
+	uint16_t counter;		//incremented with every calibration
+	uint32_t crc;			//CRC32 of the header fields above and the payload
+} FlashCalHeader_t; //sizeof(FlashCalHeader_t)=16
+
+typedef struct {
+	FlashCalHeader_t header;
+	union {
+		uint16_t table[CALIBRATION_TABLE_SIZE_MAX]; //header.size points - CAL_RECORD_TABLE_HYSTERESIS stores the band after them, see CalibrationRecord_band()
+		FlashCalHarmonics_t harmonics;
+	} payload;
+} FlashCalRecord_t; //sizeof(FlashCalRecord_t)=FLASH_ROW_SIZE - covers any valid stored record
+
 typedef struct {
   uint16_t value;  //cal value
-  int16_t error; 	 //error assuming it is constantly updated
+  int16_t error; 	 //uncertainty of the value, angleraw - refined online
+  int16_t hysteresis; //encoder angle turning up minus turning down, angleraw
 } CalData_t;
 
 uint16_t EncoderCalibrate(bool update);
+void CalibrationSweep_process(void);
+void CalibrationRefine_process(uint16_t angle, int32_t speed);
+void CalibrationTable_refine(void);
 float MeasureStepSize(void);
 bool Learn_StepSize_WiringPolarity(void);
 bool CalibrationTable_calValid(void);
@@ -54,5 +108,7 @@ void CalibrationTable_saveToFlash(void);
 void CalibrationTable_init(void);
 
 int8_t Estimate_motor_k_bemf(void);
+bool Select_sensor_profile(EncoderProfile_t profile);
+int8_t Identify_sensor_latency(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,155 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	The calibration table holds the encoder angle at CALIBRATION_TABLE_SIZE equally spaced shaft angles.
+	The shaft angle is the linear interpolation between the two points around the encoder angle.
+	Instead of searching for them, the encoder angle is split into CALIBRATION_LOOKUP_SIZE buckets and each bucket
+	stores the segment its start falls into. A bucket is narrower than any segment, so the encoder angle is either
+	in that segment or in the next one - one comparison decides.
+	The division of the interpolation is replaced by the segment slope in Q24, rounded up. With 2^24 >= dx^2 the
+	result is the same as the integer division: the rounding error stays below 1/dx and can't cross an integer.
+
+	The point lookup is kept twice: a table refined online is built into the copy the motion task is not using,
+	then a single pointer write switches to it.
+
+	A harmonic record describes the encoder error directly as a function of the encoder angle. Its Fourier series
+	is evaluated once per bucket boundary at init, the motion task interpolates linearly between them.
+
+	The hysteresis band is stored per calibration point. The shaft angle times CALIBRATION_TABLE_SIZE gives the
+	segment in the upper and the position within it in the lower 16 bits - no search and no division.
+*/
+
+#include "calibration_lookup.h"
+#include "encoder.h"
+#include <math.h>
+
+#define SLOPE_Q				24U
+#define BUCKET_SHIFT		(16U - CALIBRATION_LOOKUP_BITS)
+#define BUCKET_MASK			((1U << BUCKET_SHIFT) - 1U)
+
+typedef struct {
+	uint16_t x;			//encoder angle at the segment start
+	uint16_t y;			//shaft angle at the segment start
+	uint32_t slope;		//dy/dx in Q24, rounded up
+} Segment_t;
+
+typedef struct {
+	Segment_t segments[CALIBRATION_TABLE_SIZE + 1U]; //last one repeats the first - no wrap in the motion task
+	uint8_t buckets[CALIBRATION_LOOKUP_SIZE];
+} PointLookup_t;
+
+static PointLookup_t lookups[2];
+static const PointLookup_t * volatile lookup = &lookups[0]; //read by the motion task
+
+static bool useHarmonics = false;
+static uint16_t harmonicOffset;
+static int16_t harmonicError[CALIBRATION_LOOKUP_SIZE + 1U]; //encoder error at the bucket boundaries, Q CALIBRATION_HARMONIC_Q
+
+static int16_t hysteresisBand[CALIBRATION_TABLE_SIZE + 1U]; //last one repeats the first
+
+void CalibrationLookup_build(const uint16_t calValues[CALIBRATION_TABLE_SIZE]){
+	PointLookup_t *next = (lookup == &lookups[0]) ? &lookups[1] : &lookups[0];
+	Segment_t *segments = next->segments;
+	for (uint16_t i = 0; i < CALIBRATION_TABLE_SIZE; i++){
+		uint16_t i2 = (i + 1U) % CALIBRATION_TABLE_SIZE;
+		uint16_t y1 = (uint16_t)((uint32_t)i * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+		uint16_t y2 = (uint16_t)((uint32_t)i2 * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+		uint16_t dx = calValues[i2] - calValues[i];
+		uint16_t dy = y2 - y1;
+		segments[i].x = calValues[i];
+		segments[i].y = y1;
+		segments[i].slope = (dx != 0U) ? (uint32_t)((((uint64_t)dy << SLOPE_Q) + dx - 1U) / dx) : 0U;
+	}
+	segments[CALIBRATION_TABLE_SIZE] = segments[0];
+
+	for (uint16_t b = 0; b < CALIBRATION_LOOKUP_SIZE; b++){
+		uint16_t x = (uint16_t)(b << BUCKET_SHIFT);
+		next->buckets[b] = 0;
+		for (uint8_t i = 0; i < CALIBRATION_TABLE_SIZE; i++){
+			//wrap around distances - same match condition as the search it replaces
+			if (((int16_t)(uint16_t)(x - segments[i].x) >= 0) && ((int16_t)(uint16_t)(segments[i + 1U].x - x) > 0)){
+				next->buckets[b] = i;
+				break;
+			}
+		}
+	}
+	lookup = next;
+	useHarmonics = false;
+}
+
+void CalibrationLookup_buildHarmonics(const FlashCalHarmonics_t *model){
+	uint16_t harmonics = (model->harmonics < CALIBRATION_HARMONICS_MAX) ? model->harmonics : CALIBRATION_HARMONICS_MAX;
+	for (uint16_t b = 0; b < CALIBRATION_LOOKUP_SIZE; b++){
+		//cos(kx), sin(kx) by rotation - one sinf, cosf per point
+		float x = 2.0f * 3.14159265f * (float)b / (float)CALIBRATION_LOOKUP_SIZE;
+		float c1 = cosf(x);
+		float s1 = sinf(x);
+		float ck = c1;
+		float sk = s1;
+		float error = 0.0f;
+		for (uint16_t k = 0; k < harmonics; k++){
+			error += ((float)model->coef[2U * k] * ck) + ((float)model->coef[(2U * k) + 1U] * sk);
+			float c = (ck * c1) - (sk * s1);
+			sk = (sk * c1) + (ck * s1);
+			ck = c;
+		}
+		harmonicError[b] = (int16_t)((error >= 0.0f) ? (error + 0.5f) : (error - 0.5f));
+	}
+	harmonicError[CALIBRATION_LOOKUP_SIZE] = harmonicError[0];
+	harmonicOffset = model->offset;
+	useHarmonics = true;
+}
+
+void CalibrationLookup_buildHysteresis(const int16_t bands[CALIBRATION_TABLE_SIZE]){
+	for (uint16_t i = 0; i < CALIBRATION_TABLE_SIZE; i++){
+		hysteresisBand[i] = bands[i];
+	}
+	hysteresisBand[CALIBRATION_TABLE_SIZE] = bands[0];
+}
+
+uint16_t CalibrationLookup_angle(uint16_t encoderAngle){
+	if (useHarmonics){
+		uint16_t b = encoderAngle >> BUCKET_SHIFT;
+		int32_t e1 = harmonicError[b];
+		int32_t e2 = harmonicError[b + 1U];
+		int32_t error = e1 + (((e2 - e1) * (int32_t)(encoderAngle & BUCKET_MASK)) >> BUCKET_SHIFT);
+		error = (error + (1 << (CALIBRATION_HARMONIC_Q - 1U))) >> CALIBRATION_HARMONIC_Q; //rounded to angleraw
+		return (uint16_t)(encoderAngle - harmonicOffset - (uint16_t)(int16_t)error);
+	}
+	const PointLookup_t *points = lookup;
+	uint16_t i = points->buckets[encoderAngle >> BUCKET_SHIFT];
+	if ((int16_t)(uint16_t)(encoderAngle - points->segments[i + 1U].x) >= 0){
+		i++;
+	}
+	const Segment_t *seg = &points->segments[i];
+	uint16_t dx2 = encoderAngle - seg->x;
+	return (uint16_t)(seg->y + (uint16_t)(((uint64_t)dx2 * seg->slope) >> SLOPE_Q));
+}
+
+//half of the band at the shaft angle - the encoder is ahead by it turning up, behind turning down
+int16_t CalibrationLookup_hysteresis(uint16_t angle){
+	uint32_t position = (uint32_t)angle * CALIBRATION_TABLE_SIZE;
+	uint16_t i = (uint16_t)(position >> 16);
+	int32_t b1 = hysteresisBand[i];
+	int32_t b2 = hysteresisBand[i + 1U];
+	int32_t band = b1 + (((b2 - b1) * (int32_t)(position & 0xFFFFU)) / (int32_t)ANGLE_STEPS);
+	return (int16_t)(band / 2);
+}
@@ -0,0 +1,47 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @ Description:
+ * Inverse of the calibration table (encoder angle -> shaft angle) in O(1).
+ * A harmonic calibration record is expanded into a correction table of the same resolution.
+ * The hysteresis band between the directions is interpolated at the shaft angle.
+ * No hardware dependencies - unit tested on the host.
+ */
+
+#ifndef CALIBRATION_LOOKUP_H
+#define CALIBRATION_LOOKUP_H
+
+#include <stdint.h>
+#include "calibration.h"
+
+//buckets must be narrower than the shortest calibration segment (ANGLE_STEPS/CALIBRATION_TABLE_SIZE - 2*CALIBRATION_MAX_ERROR)
+#define CALIBRATION_LOOKUP_BITS		9U
+#define CALIBRATION_LOOKUP_SIZE		(1U << CALIBRATION_LOOKUP_BITS)
+
+//api
+void CalibrationLookup_build(const uint16_t calValues[CALIBRATION_TABLE_SIZE]);
+void CalibrationLookup_buildHarmonics(const FlashCalHarmonics_t *model);
+void CalibrationLookup_buildHysteresis(const int16_t bands[CALIBRATION_TABLE_SIZE]);
+
+//motion task
+uint16_t CalibrationLookup_angle(uint16_t encoderAngle);
+int16_t CalibrationLookup_hysteresis(uint16_t angle);
+
+#endif // CALIBRATION_LOOKUP_H
@@ -0,0 +1,119 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	The calibration page starts with a FlashCalHeader_t describing the payload that follows it - format version,
+	record type, table size and the motor it was calibrated on. The CRC32 (IEEE 802.3, as zlib) covers the header
+	up to the crc field and the payload, so a half written or foreign page is never used.
+	Tables are stored with the size they were measured with. The loader resamples them to CALIBRATION_TABLE_SIZE with
+	the same linear interpolation the calibration uses between its points, so changing the table size
+	does not force a recalibration.
+	The hysteresis band is a small signed value per point - resampled without the wrap around of the encoder angles.
+*/
+
+#include "calibration_record.h"
+#include "encoder.h"
+#include <stddef.h>
+
+#define CRC32_POLYNOMIAL	0xEDB88320U //reflected 0x04C11DB7
+
+uint32_t CalibrationRecord_crc32(const uint8_t *data, uint32_t length, uint32_t crc){
+	crc = ~crc;
+	for (uint32_t i = 0; i < length; i++){
+		crc ^= data[i];
+		for (uint8_t bit = 0; bit < 8U; bit++){
+			crc = (crc >> 1) ^ (CRC32_POLYNOMIAL & (0U - (crc & 1U)));
+		}
+	}
+	return ~crc;
+}
+
+//payload length in bytes, 0 for an unknown type or size
+uint16_t CalibrationRecord_payloadSize(const FlashCalHeader_t *header){
+	if ((header->type == (uint16_t)CAL_RECORD_TABLE) && (header->size >= CALIBRATION_TABLE_SIZE_MIN) && (header->size <= CALIBRATION_TABLE_SIZE_MAX)){
+		return header->size * (uint16_t)sizeof(uint16_t);
+	}
+	if ((header->type == (uint16_t)CAL_RECORD_TABLE_HYSTERESIS) && (header->size >= CALIBRATION_TABLE_SIZE_MIN) && (header->size <= CALIBRATION_HYSTERESIS_SIZE_MAX)){
+		return 2U * header->size * (uint16_t)sizeof(uint16_t);
+	}
+	if ((header->type == (uint16_t)CAL_RECORD_HARMONICS) && (header->size <= CALIBRATION_HARMONICS_MAX)){
+		return (uint16_t)sizeof(FlashCalHarmonics_t);
+	}
+	return 0;
+}
+
+static uint32_t CalibrationRecord_calcCrc(const FlashCalRecord_t *record, uint16_t payloadSize){
+	uint32_t crc = CalibrationRecord_crc32((const uint8_t *)&record->header, (uint32_t)offsetof(FlashCalHeader_t, crc), 0U);
+	return CalibrationRecord_crc32((const uint8_t *)&record->payload, payloadSize, crc);
+}
+
+//type, size, fullSteps, counter and the payload are set by the caller
+void CalibrationRecord_seal(FlashCalRecord_t *record){
+	record->header.magic = CALIBRATION_RECORD_MAGIC;
+	record->header.version = CALIBRATION_RECORD_VERSION;
+	record->header.crc = CalibrationRecord_calcCrc(record, CalibrationRecord_payloadSize(&record->header));
+}
+
+//works on the flash mapped record - the payload spans the row, a stored table of any valid size stays within it
+bool CalibrationRecord_valid(const FlashCalRecord_t *record){
+	if ((record->header.magic != CALIBRATION_RECORD_MAGIC) || (record->header.version != CALIBRATION_RECORD_VERSION)){
+		return false;
+	}
+	uint16_t payloadSize = CalibrationRecord_payloadSize(&record->header);
+	if (payloadSize == 0U){
+		return false;
+	}
+	if ((record->header.type == (uint16_t)CAL_RECORD_HARMONICS) && (record->payload.harmonics.harmonics != record->header.size)){
+		return false;
+	}
+	return CalibrationRecord_calcCrc(record, payloadSize) == record->header.crc;
+}
+
+//hysteresis band at table point i of a CAL_RECORD_TABLE_HYSTERESIS record - the words after the header.size points
+int16_t CalibrationRecord_band(const FlashCalRecord_t *record, uint16_t i){
+	return (int16_t)record->payload.table[record->header.size + i];
+}
+
+//encoder angles at srcSize equally spaced shaft angles -> at dstSize, linear interpolation with wrap around
+void CalibrationRecord_resample(const uint16_t *src, uint16_t srcSize, uint16_t *dst, uint16_t dstSize){
+	for (uint16_t j = 0; j < dstSize; j++){
+		uint16_t y = (uint16_t)((uint32_t)j * ANGLE_STEPS / dstSize);
+		uint16_t i1 = (uint16_t)((uint32_t)y * srcSize / ANGLE_STEPS);
+		uint16_t i2 = (i1 + 1U) % srcSize;
+		uint16_t y1 = (uint16_t)((uint32_t)i1 * ANGLE_STEPS / srcSize);
+		uint16_t y2 = (uint16_t)((uint32_t)i2 * ANGLE_STEPS / srcSize);
+		uint16_t dy = y2 - y1;
+		uint16_t dx = src[i2] - src[i1];
+		uint16_t dy2 = y - y1;
+		dst[j] = src[i1] + (uint16_t)(((uint32_t)dy2 * dx + (dy / 2U)) / dy); //rounded - repeated resampling doesn't drift
+	}
+}
+
+//hysteresis band at srcSize equally spaced shaft angles -> at dstSize, linear interpolation
+void CalibrationRecord_resampleBand(const int16_t *src, uint16_t srcSize, int16_t *dst, uint16_t dstSize){
+	for (uint16_t j = 0; j < dstSize; j++){
+		uint32_t y = (uint32_t)j * srcSize; //source position in 1/dstSize points
+		uint16_t i1 = (uint16_t)(y / dstSize);
+		uint16_t i2 = (i1 + 1U) % srcSize;
+		int32_t frac = (int32_t)(y % dstSize);
+		int32_t band = ((int32_t)src[i1] * ((int32_t)dstSize - frac)) + ((int32_t)src[i2] * frac);
+		dst[j] = (int16_t)((band + ((band >= 0) ? ((int32_t)dstSize / 2) : -((int32_t)dstSize / 2))) / (int32_t)dstSize);
+	}
+}
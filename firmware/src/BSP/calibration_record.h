@@ -0,0 +1,42 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @ Description:
+ * Versioned calibration record - integrity check and resampling of tables stored with another size.
+ * No hardware dependencies - unit tested on the host.
+ */
+
+#ifndef CALIBRATION_RECORD_H
+#define CALIBRATION_RECORD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "calibration.h"
+
+//api
+uint32_t CalibrationRecord_crc32(const uint8_t *data, uint32_t length, uint32_t crc);
+uint16_t CalibrationRecord_payloadSize(const FlashCalHeader_t *header);
+void CalibrationRecord_seal(FlashCalRecord_t *record);
+bool CalibrationRecord_valid(const FlashCalRecord_t *record);
+int16_t CalibrationRecord_band(const FlashCalRecord_t *record, uint16_t i);
+void CalibrationRecord_resample(const uint16_t *src, uint16_t srcSize, uint16_t *dst, uint16_t dstSize);
+void CalibrationRecord_resampleBand(const int16_t *src, uint16_t srcSize, int16_t *dst, uint16_t dstSize);
+
+#endif // CALIBRATION_RECORD_H
@@ -117,6 +117,31 @@ void CAN_TransmitMotorStatus(uint32_t frame){
   CheckTxStatus(_transmitMailbox);
 }
 
+// external torque estimate - separate frame since STEERING_STATUS is full
+void CAN_TransmitLoadStatus(uint32_t frame){
+  CanTxMsg txMessage;
+  txMessage.RTR=CAN_RTR_DATA;
+  txMessage.IDE=CAN_ID_STD;
+  txMessage.StdId=MSG_STEERING_LOAD_FRAME_ID;
+  txMessage.DLC=MSG_STEERING_LOAD_LENGTH;
+
+  // populate message structure:
+  struct Msg_steering_load_t loadStatus;
+  loadStatus.checksum = 0;
+  loadStatus.counter = frame & 0xFU;
+  loadStatus.load_torque = Msg_steering_load_load_torque_encode(StepperCtrl_getLoadTorque());
+
+  // calculate checksum:
+  uint8_t dataTemp[MSG_STEERING_LOAD_LENGTH];
+  Msg_steering_load_pack(dataTemp, &loadStatus, sizeof(dataTemp));
+  loadStatus.checksum = Msg_calc_checksum_8bit(dataTemp, MSG_STEERING_LOAD_LENGTH, MSG_STEERING_LOAD_FRAME_ID);
+  Msg_steering_load_pack((&txMessage)->Data, &loadStatus, sizeof(txMessage.Data)); //pack again with the checksum
+
+  // transmit
+  uint8_t _transmitMailbox=CAN_Transmit(CAN1, &txMessage);
+  CheckTxStatus(_transmitMailbox);
+}
+
 static volatile uint16_t can_control_cmd_cnt = 0;
 struct Msg_steering_command_t ControlCmds;
 static void CAN_InterpretMesssages(CanRxMsg message) { 
@@ -124,7 +149,11 @@ static void CAN_InterpretMesssages(CanRxMsg message) {
   	case MSG_STEERING_COMMAND_FRAME_ID: {      
       Msg_steering_command_unpack(&ControlCmds, message.Data, sizeof(message.Data));
       // Note signals may correspond to different motor sample
-      StepperCtrl_setDesiredAngle(Msg_steering_command_steer_angle_decode(ControlCmds.steer_angle));
+      if (ControlCmds.steer_mode == MSG_STEERING_COMMAND_STEER_MODE_VELOCITY_CONTROL_CHOICE){
+        StepperCtrl_setDesiredVelocity(Msg_steering_command_steer_angle_decode(ControlCmds.steer_angle)); //steer_angle carries deg/s
+      }else{
+        StepperCtrl_setDesiredAngle(Msg_steering_command_steer_angle_decode(ControlCmds.steer_angle));
+      }
       StepperCtrl_setFeedForwardTorque(Msg_steering_command_steer_torque_decode(ControlCmds.steer_torque));
       StepperCtrl_setControlMode(ControlCmds.steer_mode); //set control mode
       
@@ -24,6 +24,7 @@
 extern CAN_TypeDef hcan;
 
 void CAN_TransmitMotorStatus(uint32_t frame);
+void CAN_TransmitLoadStatus(uint32_t frame);
 void CAN_MsgsFiltersSetup(void);
 bool Check_Control_CAN_rx_validate_tick(void);
 
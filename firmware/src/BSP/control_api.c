@@ -30,6 +30,9 @@
 #include "actuator_config.h"
 #include "nonvolatile.h"
 #include "encoder.h"
+#include "setpoint.h"
+#include "observer.h"
+#include "utils.h"
 #include "main.h"
 #include "Msg.h"
 
@@ -55,6 +58,17 @@ void StepperCtrl_setDesiredAngle(float actuator_angle_delta){
 	
 	if (api_allow_control) {
 		desiredLocation = newLocation_int;
+		Setpoint_command(newLocation_int);
+	}
+}
+
+//sets actuator velocity [deg/s] for the velocity control mode
+void StepperCtrl_setDesiredVelocity(float actuator_speed){
+	float newVelocity = roundf(DIR_SIGN(DEGREES_TO_ANGLERAW(actuator_speed * gearing_ratio)));
+	int32_t newVelocity_int = (int32_t)clip(newVelocity, (float)-SETPOINT_VEL_MAX, (float)SETPOINT_VEL_MAX);
+
+	if (api_allow_control) {
+		StepperCtrl_setVelocity(newVelocity_int);
 	}
 }
 
@@ -114,6 +128,9 @@ void StepperCtrl_setControlMode(uint8_t mode){
 		case MSG_STEERING_COMMAND_STEER_MODE_SOFT_OFF_CHOICE:
 			StepperCtrl_setMotionMode(STEPCTRL_FEEDBACK_SOFT_TORQUE_OFF);
 			break;
+		case MSG_STEERING_COMMAND_STEER_MODE_VELOCITY_CONTROL_CHOICE:
+			StepperCtrl_setMotionMode(STEPCTRL_FEEDBACK_VELOCITY);
+			break;
 		default:
 			StepperCtrl_setMotionMode(STEPCTRL_FEEDBACK_SOFT_TORQUE_OFF);
 	}
@@ -145,6 +162,13 @@ float StepperCtrl_getControlOutput(void) {
 	return DIR_SIGN(ret) * current_to_actuatorTq; //convert total control (mA) to actuator output torque
 }
 
+//returns external torque applied to the actuator (i.e. by the driver) as estimated by the observer
+float StepperCtrl_getLoadTorque(void) {
+	int16_t ret;
+	ret = observerLoadCurrent;
+	return DIR_SIGN(ret) * current_to_actuatorTq; //convert load current (mA) to actuator output torque
+}
+
 //returns current actuator speed in rev/s
 float StepperCtrl_getSpeedRev(void) { //revolutions/s
 	int32_t ret;
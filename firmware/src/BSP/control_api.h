@@ -27,6 +27,7 @@
 void apiAllowControl(bool allow);
 
 void StepperCtrl_setDesiredAngle(float deltaLocation);
+void StepperCtrl_setDesiredVelocity(float actuator_speed);
 void StepperCtrl_setFeedForwardTorque(float Iq_feedforward);
 void StepperCtrl_setCloseLoopTorque(float Iq_closeloopLim);
 void StepperCtrl_setControlMode(uint8_t mode);
@@ -36,6 +37,7 @@ int32_t StepperCtrl_getAngleFromEncoderRaw(void);
 float StepperCtrl_getAngleFromEncoder(void);
 float StepperCtrl_getCloseLoop(void);
 float StepperCtrl_getControlOutput(void);
+float StepperCtrl_getLoadTorque(void);
 float StepperCtrl_getSpeedRev(void);
 float StepperCtrl_getPositionError(void);
 uint16_t StepperCtrl_getStatuses(void);
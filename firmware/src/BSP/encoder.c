@@ -21,15 +21,88 @@
 
 #include "encoder.h"
 #include "calibration.h"
-#include "tle5012.h"
+#include <stddef.h>
 
+static const EncoderDriver_t *encoder; //selected by Encoder_begin() - call it first
+static EncoderProfile_t profile = ENCODER_PROFILE_DEFAULT;
+static uint16_t latencyIdentified = ENCODER_LATENCY_NOMINAL;
+volatile int32_t encoderLatency_q20;
+
+//the motion task reads the latency every sample - convert it once per change
+static void update_latency(void){
+	encoderLatency_q20 = (int32_t)(((uint32_t)Encoder_latency_us() << 20) / 1000000U); //us to seconds, Q20
+}
+
+//probes the board sensors in order - without an answer the first one stays selected and its reads fail
 bool Encoder_begin(void){
-	return TLE5012_begin();
+	encoder = boardEncoders[0];
+	profile = ENCODER_PROFILE_DEFAULT; //the drivers start with it
+	latencyIdentified = ENCODER_LATENCY_NOMINAL;
+	bool found = false;
+	for (uint8_t i = 0; boardEncoders[i] != NULL; i++){
+		if (boardEncoders[i]->begin()){
+			encoder = boardEncoders[i];
+			found = true;
+			break;
+		}
+	}
+	update_latency();
+	return found;
+}
+
+const EncoderDriver_t *Encoder_driver(void){
+	return encoder;
+}
+
+//false if the sensor does not support the profile - the previous one stays
+bool Encoder_setProfile(EncoderProfile_t newProfile){
+	bool ok;
+	if (newProfile >= ENCODER_PROFILES){
+		ok = false;
+	}else if (encoder->setProfile == NULL){
+		ok = (newProfile == ENCODER_PROFILE_DEFAULT);
+	}else{
+		ok = encoder->setProfile(newProfile);
+	}
+	if (ok){
+		profile = newProfile;
+		update_latency();
+	}
+	return ok;
+}
+
+EncoderProfile_t Encoder_profile(void){
+	return profile;
+}
+
+//latency identified on the motor - ENCODER_LATENCY_NOMINAL returns to the driver value
+void Encoder_setLatency_us(uint16_t latency){
+	latencyIdentified = latency;
+	update_latency();
+}
+
+uint16_t Encoder_latency_us(void){
+	return (latencyIdentified != ENCODER_LATENCY_NOMINAL) ? latencyIdentified : encoder->latency_us[profile];
 }
 
 uint16_t ReadEncoderAngle(void){ 
-	//TLE5012 is 15bits - 32767 corresponds to 360deg
-	return (uint16_t)(TLE5012_ReadAngle()<<1U); //Scale (0-32767) -> (0-65535)
+	return encoder->readAngle();
+}
+
+//start sampling in the background - called at the PWM update that samples the motion task inputs
+void Encoder_startRead(void){
+	encoder->startRead();
+}
+
+//sample started by Encoder_startRead() - falls back to a direct read if none was started
+//false if the sensor rejected it
+bool FetchEncoderSample(EncoderSample_t *sample){
+	return encoder->fetch(sample);
+}
+
+//rejected reads since the last good one
+uint16_t Encoder_faultsInRow(void){
+	return encoder->faultsInRow();
 }
 
 //Get oversampled encoder angle - simple averaging
@@ -38,7 +111,7 @@ uint16_t OverSampleEncoderAngle(uint16_t numSamples){
 	uint16_t x0 = ReadEncoderAngle();
 	
 	for(uint16_t k=0; k < numSamples; k++){
-		int16_t diff = (int16_t)(x0 - ReadEncoderAngle());
+		int16_t diff = (int16_t)(ReadEncoderAngle() - x0);
 		sum += diff;
 	}
 	
@@ -31,8 +31,48 @@
 #define DEGREES_TO_ANGLERAW(x) ( ((float)(x) / 360.0f * (float)ANGLE_STEPS) )
 #define ANGLERAW_T0_DEGREES(x) ( ((float)(x) * 360.0f / (float)ANGLE_STEPS) )
 
+typedef struct {
+	uint16_t angle;			//0-65535
+	int16_t speed;			//sensor speed register, raw
+	int16_t revolutions;	//sensor revolution counter
+} EncoderSample_t;
+
+//sensor filter settings - trade the angle noise against its latency
+typedef enum {
+	ENCODER_PROFILE_LOW_LATENCY = 0,	//fastest update, prediction - the default
+	ENCODER_PROFILE_BALANCED,
+	ENCODER_PROFILE_LOW_NOISE,
+	ENCODER_PROFILES
+} EncoderProfile_t;
+
+#define ENCODER_PROFILE_DEFAULT				ENCODER_PROFILE_LOW_LATENCY
+#define ENCODER_LATENCY_NOMINAL				0xFFFFU	//no identified latency - the driver value of the profile applies
+
+//angle sensor driver - the board lists the ones it can carry, Encoder_begin() selects the first that answers
+typedef struct {
+	const char *name;
+	bool (*begin)(void);					//probe and configure the sensor
+	uint16_t (*readAngle)(void);			//blocking read, 0-65535
+	void (*startRead)(void);				//start sampling in the background - at the PWM update
+	bool (*fetch)(EncoderSample_t *sample);	//sample of startRead(), or a blocking one if none was started - false if rejected
+	uint16_t (*faultsInRow)(void);			//rejected reads since the last good one
+	bool (*setProfile)(EncoderProfile_t profile);	//program the sensor filters - NULL if only the default is supported
+	uint16_t latency_us[ENCODER_PROFILES];	//nominal time between sampling and reading the angle, per profile
+} EncoderDriver_t;
+
+extern const EncoderDriver_t *const boardEncoders[]; //NULL terminated - defined by the board
+
 bool Encoder_begin(void);
+const EncoderDriver_t *Encoder_driver(void);
+bool Encoder_setProfile(EncoderProfile_t profile);
+EncoderProfile_t Encoder_profile(void);
+void Encoder_setLatency_us(uint16_t latency);
+uint16_t Encoder_latency_us(void);
+extern volatile int32_t encoderLatency_q20; //Encoder_latency_us() in seconds, Q20 - kept up to date by the functions above
 uint16_t ReadEncoderAngle(void);
+void Encoder_startRead(void);
+bool FetchEncoderSample(EncoderSample_t *sample);
+uint16_t Encoder_faultsInRow(void);
 uint16_t OverSampleEncoderAngle(uint16_t numSamples);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,234 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Friction current of the motor shaft (gearbox and load reflected):
+		I_f(v) = sign(v) * (Ic + (Is - Ic) * exp(-(v/vs)^2)) + Kv*v
+	The motion task interpolates the Stribeck curve from a table.
+	Near zero speed the sign of the friction is unknown, so the dry part fades in linearly up to 2^fade_q angleraw/s.
+
+	Identification runs the velocity loop at constant speed segments, both directions, and averages the closeloop
+	current. Half of the difference between the directions is the friction - a constant load (gravity) cancels.
+	The model is fitted by linear least squares for a set of Stribeck speeds and the best fit is stored in NVM.
+*/
+
+#include "friction.h"
+#include "stepper_controller.h"
+#include "actuator_config.h"
+#include "nonvolatile.h"
+#include "encoder.h"
+#include "delay.h"
+#include "board.h"
+#include "main.h"
+#include "utils.h"
+#include <math.h>
+
+#define FRICTION_ID_SPEEDS			7U
+#define FRICTION_ID_SETTLE_MS		400U	//velocity loop transient after the speed change
+#define FRICTION_ID_MEASURE_MS		400U
+#define FRICTION_ID_CURRENT_LIM		2000	//mA - closeloop limit during the identification
+#define FRICTION_FIT_STRIBECK_STEPS	13U		//candidate Stribeck speeds - half octaves from the slowest segment
+#define FRICTION_STRIBECK_SCALING	4U		//rev/s/4096 in NVM to angleraw/s
+#define STRIBECK_LUT_STEP_Q			5U		//table step 1/8 in Q8 of v/vs
+#define STRIBECK_LUT_SIZE			25U
+
+//exp(-(v/vs)^2) for v/vs = 0..3 in steps of 1/8, Q12
+static const uint16_t stribeck_lut[STRIBECK_LUT_SIZE] = {
+	4096, 4032, 3848, 3559, 3190, 2771, 2334, 1905, 1507, 1155, 859, 618, 432, 292, 192, 122, 75, 45, 26, 15, 8, 4, 2, 1, 1
+};
+
+static const int32_t id_speed[FRICTION_ID_SPEEDS] = { //angleraw/s - slower segments do not settle through the stick-slip
+	(int32_t)(ANGLE_STEPS / 16U), (int32_t)(ANGLE_STEPS / 8U), (int32_t)(ANGLE_STEPS / 4U), (int32_t)(ANGLE_STEPS / 2U),
+	(int32_t)ANGLE_STEPS, (int32_t)(3U * ANGLE_STEPS / 2U), (int32_t)(2U * ANGLE_STEPS)
+};
+
+volatile bool frictionIdentified = false;
+static volatile bool identifying = false; //no feedforward while measuring
+
+//load the identified model - otherwise keep the actuator_config.c values
+void Friction_init(void){
+	frictionIdentified = (nvmMirror.friction.parametersValid == valid);
+	if (frictionIdentified){
+		friction_coulomb_current = nvmMirror.friction.coulomb;
+		friction_stiction_current = nvmMirror.friction.stiction;
+		friction_stribeck_speed = (int32_t)nvmMirror.friction.stribeck << FRICTION_STRIBECK_SCALING;
+		friction_viscous_current = nvmMirror.friction.viscous;
+	}
+}
+
+int32_t Friction_current(int32_t speed, uint8_t fade_q){
+	//Stribeck curve in Q12, v/vs in Q8
+	//1/vs in Q24, refreshed when the Stribeck speed changes
+	static int32_t vs_src = 0;
+	static uint32_t vs_inv = 0;
+	if (friction_stribeck_speed != vs_src){
+		vs_src = friction_stribeck_speed;
+		vs_inv = ((uint32_t)1U << 24U) / max((uint32_t)vs_src >> 8, 1U);
+	}
+	uint32_t v = min(fastAbs(speed), (uint32_t)INT16_MAX << 8);
+	uint32_t w = (uint32_t)(((uint64_t)v * vs_inv) >> 24U);
+	uint32_t idx = w >> STRIBECK_LUT_STEP_Q;
+	int32_t stribeck = 0;
+	if (idx < (STRIBECK_LUT_SIZE - 1U)){
+		int32_t y1 = stribeck_lut[idx];
+		int32_t y2 = stribeck_lut[idx + 1U];
+		int32_t frac = (int32_t)(w & ((1U << STRIBECK_LUT_STEP_Q) - 1U));
+		stribeck = y1 + (((y2 - y1) * frac) >> STRIBECK_LUT_STEP_Q);
+	}
+	int32_t level = friction_coulomb_current + (((friction_stiction_current - friction_coulomb_current) * stribeck) >> 12);
+
+	int32_t fade = clip(speed, -((int32_t)1 << fade_q), (int32_t)1 << fade_q);
+	int32_t dry = (fade * level) >> fade_q;
+	//ANGLE_STEPS * FRICTION_VISCOUS_SCALING = 2^24
+	int32_t viscous = (int32_t)(((int64_t)speed * friction_viscous_current) >> 24);
+	return dry + viscous;
+}
+
+int16_t Friction_feedforward(int32_t speed){
+	if (!frictionIdentified || identifying){
+		return 0;
+	}
+	return (int16_t)(Friction_current(speed, FRICTION_FF_SPEED_Q) * friction_compensation / 100);
+}
+
+//least squares of f = Ic + D*g(v) + Kv*v, g(v) = exp(-(v/vs)^2) - D=0 fits Coulomb and viscous only
+//returns sum of squared residuals, negative when the fit is not physical
+static float fit(const float *v, const float *f, float vs, float *p){
+	float a[3][3] = {{0}};
+	float b[3] = {0};
+	uint8_t n = (vs > 0.0f) ? 3U : 2U;
+	for (uint8_t i = 0; i < FRICTION_ID_SPEEDS; i++){
+		float w = (vs > 0.0f) ? (v[i] / vs) : 0.0f;
+		float basis[3] = {1.0f, v[i], expf(-(w * w))};
+		for (uint8_t r = 0; r < n; r++){
+			for (uint8_t c = 0; c < n; c++){
+				a[r][c] += basis[r] * basis[c];
+			}
+			b[r] += basis[r] * f[i];
+		}
+	}
+	//Gauss elimination
+	for (uint8_t k = 0; k < n; k++){
+		if (a[k][k] <= 0.0f){
+			return -1.0f;
+		}
+		for (uint8_t r = k + 1U; r < n; r++){
+			float m = a[r][k] / a[k][k];
+			for (uint8_t c = k; c < n; c++){
+				a[r][c] -= m * a[k][c];
+			}
+			b[r] -= m * b[k];
+		}
+	}
+	p[2] = 0.0f;
+	for (int8_t k = (int8_t)n - 1; k >= 0; k--){
+		float sum = b[k];
+		for (uint8_t c = (uint8_t)k + 1U; c < n; c++){
+			sum -= a[k][c] * p[c];
+		}
+		p[k] = sum / a[k][k];
+	}
+	if ((p[0] < 0.0f) || (p[1] < 0.0f) || (p[2] < 0.0f)){
+		return -1.0f;
+	}
+
+	float sse = 0.0f;
+	for (uint8_t i = 0; i < FRICTION_ID_SPEEDS; i++){
+		float w = (vs > 0.0f) ? (v[i] / vs) : 0.0f;
+		float e = f[i] - (p[0] + (p[1] * v[i]) + ((vs > 0.0f) ? (p[2] * expf(-(w * w))) : 0.0f));
+		sse += e * e;
+	}
+	return sse;
+}
+
+// Sweep constant speed segments, fit the friction model and store it in NVM
+int8_t Friction_identify(void){
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+	if (GetMotorVoltage() < MIN_SUPPLY_VOLTAGE) {
+		return -1;
+	}
+
+	identifying = true;
+	StepperCtrl_setCurrent(0);
+	StepperCtrl_setCloseLoopCurrentLim(FRICTION_ID_CURRENT_LIM);
+	StepperCtrl_setVelocity(0);
+	StepperCtrl_setMotionMode(STEPCTRL_FEEDBACK_VELOCITY);
+
+	float v[FRICTION_ID_SPEEDS]; //rev/s
+	float f[FRICTION_ID_SPEEDS]; //mA
+	bool saturated = false;
+	for (uint8_t i = 0; i < FRICTION_ID_SPEEDS; i++){
+		int32_t mean[2];
+		for (uint8_t pass = 0; pass < 2U; pass++){
+			int32_t dir = (pass == 0U) ? 1 : -1; //alternate to stay around the start position
+			StepperCtrl_setVelocity(dir * id_speed[i]);
+			delay_ms(FRICTION_ID_SETTLE_MS);
+			int32_t sum = 0;
+			for (uint16_t t = 0; t < FRICTION_ID_MEASURE_MS; t++){
+				sum += control;
+				saturated = saturated || (fastAbs(control) >= (uint32_t)FRICTION_ID_CURRENT_LIM);
+				delay_ms(1);
+			}
+			mean[pass] = sum / (int32_t)FRICTION_ID_MEASURE_MS;
+		}
+		v[i] = (float)id_speed[i] / (float)ANGLE_STEPS;
+		f[i] = (float)(mean[0] - mean[1]) / 2.0f;
+	}
+	StepperCtrl_setVelocity(0);
+	delay_ms(FRICTION_ID_SETTLE_MS);
+	StepperCtrl_setMotionMode(STEPCTRL_OFF);
+	identifying = false;
+
+	if (saturated){
+		debug_assert(0);
+		return -2;
+	}
+
+	//best Stribeck speed - vs=0 is the model without the Stribeck effect
+	float best[3] = {0};
+	float best_vs = 0.0f;
+	float best_sse = fit(v, f, 0.0f, best);
+	for (uint8_t k = 0; k < FRICTION_FIT_STRIBECK_STEPS; k++){
+		float p[3];
+		float vs = v[0] * powf(2.0f, (float)k / 2.0f);
+		float sse = fit(v, f, vs, p);
+		if ((sse >= 0.0f) && ((best_sse < 0.0f) || (sse < best_sse))){
+			best_sse = sse;
+			best_vs = vs;
+			best[0] = p[0];
+			best[1] = p[1];
+			best[2] = p[2];
+		}
+	}
+	if (best_sse < 0.0f){
+		debug_assert(0);
+		return -3;
+	}
+
+	nvmMirror.friction.coulomb = (int16_t)min(best[0], (float)INT16_MAX);
+	nvmMirror.friction.stiction = (int16_t)min(best[0] + best[2], (float)INT16_MAX);
+	nvmMirror.friction.stribeck = (uint16_t)min(best_vs * (float)ANGLE_STEPS / (float)(1U << FRICTION_STRIBECK_SCALING), (float)UINT16_MAX);
+	nvmMirror.friction.viscous = (uint16_t)min(best[1] * (float)FRICTION_VISCOUS_SCALING, (float)UINT16_MAX);
+	nvmMirror.friction.parametersValid = valid;
+	nvmWriteConfParms();
+
+	Friction_init();
+	return 0;
+}
@@ -0,0 +1,43 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @ Description:
+ * Friction model (Coulomb + viscous + Stribeck) of the motor shaft, its identification and feedforward.
+ */
+
+#ifndef FRICTION_H
+#define FRICTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FRICTION_FF_SPEED_Q		12U		//angleraw/s - 2^12 = 1/16 rev/s where the feedforward is fully developed
+
+//api
+extern volatile bool frictionIdentified;
+
+void Friction_init(void);
+int8_t Friction_identify(void);
+
+//motion task
+int32_t Friction_current(int32_t speed, uint8_t fade_q);
+int16_t Friction_feedforward(int32_t speed);
+
+#endif // FRICTION_H
@@ -6,13 +6,14 @@
 #include "encoder.h"
 #include "utils.h"
 #include "board.h"
+#include "anticogging.h"
 
 static void inverse_park_transform(uint16_t elecAngle, int16_t Q, int16_t D, int16_t *A, int16_t *B){
 	//calculate sine and cosine with ripple compensation
-	int16_t sin = sine_ripple(elecAngle, anticogging_factor);
-	int16_t cos = cosine_ripple(elecAngle, anticogging_factor);
+	int16_t sin = sine_ripple(elecAngle);
+	int16_t cos = cosine_ripple(elecAngle);
 
-	// max practical phase voltage is U_lim*sqrt(2)
+	//the voltage vector is limited by voltage_modulation()
 	int32_t a = ((((int32_t)cos * D) - ((int32_t)sin * Q)) / (int32_t)SINE_MAX);
 	int32_t b = ((((int32_t)sin * D) + ((int32_t)cos * Q)) / (int32_t)SINE_MAX);
 
@@ -21,6 +22,23 @@ static void inverse_park_transform(uint16_t elecAngle, int16_t Q, int16_t D, int
 	*B = (int16_t)(int32_t)clip(b, INT16_MIN, INT16_MAX);
 }
 
+//Park transform of the measured phase currents - the inverse of inverse_park_transform without the ripple
+//the phases are sampled at different electric angles, the Clarke transform is the identity for the two phase motor
+static void park_transform(uint16_t elecAngleA, uint16_t elecAngleB, int16_t A, int16_t B, int16_t *Q, int16_t *D){
+	int16_t sin_a = sine(elecAngleA);
+	int16_t cos_a = cosine(elecAngleA);
+	int16_t sin_b = sine(elecAngleB);
+	int16_t cos_b = cosine(elecAngleB);
+
+	//A = cos_a*D - sin_a*Q, B = sin_b*D + cos_b*Q - the determinant is cos(elecAngleA - elecAngleB)
+	int32_t det = max((int32_t)cosine((uint16_t)(elecAngleA - elecAngleB) % SINE_STEPS), (int32_t)SINE_MAX / 2);
+	int32_t d = ((((int32_t)cos_b * A) + ((int32_t)sin_a * B)) / det);
+	int32_t q = ((((int32_t)cos_a * B) - ((int32_t)sin_b * A)) / det);
+
+	*D = (int16_t)(int32_t)clip(d, INT16_MIN, INT16_MAX);
+	*Q = (int16_t)(int32_t)clip(q, INT16_MIN, INT16_MAX);
+}
+
 /**
  * @brief Current commutation scheme
  * 
@@ -37,20 +55,87 @@ static void current_commutation(uint16_t elecAngle, int16_t I_q, int16_t I_d)
 	phase_current_command(I_a, I_b);
 }
 
+//phase voltage amplitude for a fundamental of 100-127% of the bus voltage in 1% steps, Q8 - the bridges clip the phases
+static const uint16_t overmodulation_gain[OVERMODULATION_MAX - 100U + 1U] = {
+	256, 259, 262, 266, 270, 275, 279, 285, 290, 297, 304, 312, 320, 330,
+	340, 352, 366, 382, 400, 422, 448, 480, 521, 576, 655, 780, 1030, 2074,
+};
+
+//largest voltage vector the modulation synthesizes
+static int16_t modulation_limit(uint16_t U_bus){
+	uint32_t limit = (uint32_t)U_bus * clip(overmodulation, 100U, OVERMODULATION_MAX) / 100U;
+	return (int16_t)min(limit, (uint32_t)INT16_MAX);
+}
+
+/**
+ * @brief Modulation - circular limit of the voltage vector, overmodulation above the bus voltage.
+ * The d voltage has priority - it keeps the current in phase, the q voltage gives way.
+ * Each bridge drives its phase up to the bus voltage. Sine waves synthesize a circle of the bus voltage,
+ * above it the phase voltages are boosted and clipped by the bridges towards square waves (4/pi).
+ * 
+ * @param U_q - quadrature voltage, mV
+ * @param U_d - direct voltage, mV
+ * @param U_bus - bus voltage, mV
+ * @return uint16_t - phase voltage gain in Q8
+ */
+static uint16_t voltage_modulation(int16_t *U_q, int16_t *U_d, uint16_t U_bus){
+	int32_t U_max = modulation_limit(U_bus);
+	int32_t d = clip((int32_t)*U_d, -U_max, U_max);
+	int32_t q = *U_q;
+	uint32_t U_sq = (uint32_t)(q * q) + (uint32_t)(d * d);
+	if (U_sq > (uint32_t)(U_max * U_max)){
+		int32_t q_max = isqrt32((uint32_t)(U_max * U_max) - (uint32_t)(d * d));
+		q = clip(q, -q_max, q_max);
+		U_sq = (uint32_t)(q * q) + (uint32_t)(d * d);
+	}
+	*U_q = (int16_t)q;
+	*U_d = (int16_t)d;
+
+	uint16_t gain = overmodulation_gain[0];
+	uint32_t U_mag = isqrt32(U_sq);
+	if ((U_mag > U_bus) && (U_bus > 0U)){
+		uint32_t pos = (U_mag - U_bus) * 100U * 16U / U_bus; //1/16 %
+		uint32_t i = min(pos / 16U, OVERMODULATION_MAX - 101U);
+		uint32_t frac = min(pos - (i * 16U), 16U);
+		gain = (uint16_t)(overmodulation_gain[i] + (((uint32_t)(overmodulation_gain[i + 1U] - overmodulation_gain[i]) * frac) / 16U));
+	}
+	return gain;
+}
+
+//overmodulated phase voltage - clipped by the bridge
+static int16_t phase_overmodulation(int16_t U, uint16_t gain, uint16_t U_bus){
+	int32_t U_phase = ((int32_t)U * gain) / (int32_t)overmodulation_gain[0];
+	return (int16_t)clip(U_phase, -(int32_t)U_bus, (int32_t)U_bus);
+}
+
 /**
  * @brief Voltage commutation scheme
  * 
  * @param elecAngle - current angle in electrical degrees - 360 corresponds to SINE_STEPS
  * @param U_q - quadrature voltage command - corresponds to torque generating current command + BEMF compensation 
  * @param U_d - direct voltage command - corresponds to flux generating current + current lag compesantion
+ * @param I_q - quadrature current reference - dead time compensation, zero without
+ * @param I_d - direct current reference
+ * @param curr_lim - current limit applied to each phase
  */
-static void voltage_commutation(uint16_t elecAngle, int16_t U_q, int16_t U_d, uint16_t curr_lim)
+static void voltage_commutation(uint16_t elecAngle, int16_t U_q, int16_t U_d, int16_t I_q, int16_t I_d, uint16_t curr_lim)
 {	
+	uint16_t U_bus = GetMotorVoltage_mV();
+	uint16_t gain = voltage_modulation(&U_q, &U_d, U_bus);
+
 	int16_t U_a = 0;
 	int16_t U_b = 0;
 	inverse_park_transform(elecAngle, U_q, U_d, &U_a, &U_b);
+	if (gain != overmodulation_gain[0]){
+		U_a = phase_overmodulation(U_a, gain, U_bus);
+		U_b = phase_overmodulation(U_b, gain, U_bus);
+	}
+
+	int16_t I_a = 0;
+	int16_t I_b = 0;
+	inverse_park_transform(elecAngle, I_q, I_d, &I_a, &I_b);
 	
-	phase_voltage_command(U_a, U_b, curr_lim);
+	phase_voltage_command(U_a, U_b, I_a, I_b, curr_lim);
 }
 
 void openloop_step(uint16_t elecAngleStep, uint16_t curr_tar){
@@ -64,13 +149,14 @@ void openloop_step(uint16_t elecAngleStep, uint16_t curr_tar){
  */
 static uint16_t calc_electric_angle(bool volt_control){
 	
-	int16_t angleSensLatency = 64u;  //angle sensor delay - bigger value can result in higher speed (because it fakes field weakening), but can be detrimental to motor power and efficiency
+	//angle sensor delay and sampling to PWM update - a bigger value fakes field weakening, detrimental to motor power and efficiency - see field_weakening()
+	int32_t angleSensLatency_q20 = encoderLatency_q20 + (int32_t)(((uint32_t)ACTUATION_DELAY_uS << 20) / S_to_uS); //seconds, Q20
 
-	int16_t angleSpeedComp = (int16_t) (speed_slow * angleSensLatency / (int32_t) S_to_uS);
+	int16_t angleSpeedComp = (int16_t) ((speed_slow * angleSensLatency_q20) >> 20);
 
 	//convert load angle to electrical angle domain (0-1023 full turn)
 	uint16_t absoluteAngle = (uint16_t)(((uint32_t)(int32_t)(currentLocation + angleSpeedComp)) & ANGLE_MAX); //add load angle to current location
-	uint16_t electricAngle = absoluteAngle * liveMotorParams.fullStepsPerRotation * FULLSTEP_ELECTRIC_ANGLE / ANGLE_STEPS;
+	uint16_t electricAngle = (uint16_t)((uint32_t)absoluteAngle * liveMotorParams.fullStepsPerRotation * FULLSTEP_ELECTRIC_ANGLE / ANGLE_STEPS);
 
 	//calculate microsteps phase lead for current control
 	if (volt_control == false){
@@ -92,49 +178,179 @@ void base_speed_test(int16_t dir) {
 
 	int16_t U_lim = (int16_t)min(GetMotorVoltage_mV(), INT16_MAX);
 	if (dir != 0) {
-		voltage_commutation(electricAngle, clip(dir, -1, 1) * U_lim, 0, safety_torque_limit);
+		voltage_commutation(electricAngle, clip(dir, -1, 1) * U_lim, 0, 0, 0, safety_torque_limit);
 	}else{
 		// freewheeling
 		int32_t U_emf = (int32_t)((int64_t)motor_k_bemf * speed_slow / (int32_t)ANGLE_STEPS);
 		int16_t U_emf_sat = (int16_t)clip(U_emf, -U_lim, U_lim);
-		voltage_commutation(electricAngle, U_emf_sat, 0, safety_torque_limit);
+		voltage_commutation(electricAngle, U_emf_sat, 0, 0, 0, safety_torque_limit);
 	}
 }
 
-void field_oriented_control(int16_t current_target) {
+//d/q current regulators - integral terms in uV
+static int32_t U_q_integral = 0;
+static int32_t U_d_integral = 0;
+//last voltage commands - bridge B is sampled at the update that applies the last one,
+//bridge A half a period earlier, between the last two
+static uint16_t electricAngle_last = 0;
+static uint16_t electricAngle_prev = 0;
+//field weakening d current - mA, zero or negative
+static int16_t I_d_fw = 0;
+
+void current_loop_reset(void){
+	U_q_integral = 0;
+	U_d_integral = 0;
+	I_d_fw = 0;
+}
 
-	const bool volt_control = USE_VOLTAGE_CONTROL;
+/**
+ * @brief PI current regulator step, the integral only grows when the output is not saturated in the same direction
+ * 
+ * @param error - mA
+ * @param integral - uV, limited to U_lim
+ * @param U_ff - feedforward voltage, mV
+ * @param U_lim - mV
+ * @return int16_t - voltage command, mV
+ */
+static int16_t current_regulator(int32_t error, int32_t *integral, int32_t U_ff, int16_t U_lim){
+	int32_t Kp = (int32_t)phase_L * CURRENT_LOOP_BANDWIDTH / (int32_t)Ohm_to_mOhm; //mOhm - pole at the electrical time constant is cancelled
+	int32_t Ki = (int32_t)phase_R * CURRENT_LOOP_BANDWIDTH / (int32_t)SAMPLING_HZ; //mOhm per sample
+
+	int32_t U = U_ff + ((error * Kp) / (int32_t)Ohm_to_mOhm) + (*integral / (int32_t)Ohm_to_mOhm);
+	int32_t U_sat = clip(U, -U_lim, U_lim);
+	if ((U == U_sat) || ((U > U_sat) == (error < 0))){
+		int32_t integral_lim = (int32_t)U_lim * (int32_t)Ohm_to_mOhm;
+		*integral = clip(*integral + (error * Ki), -integral_lim, integral_lim);
+	}
+	return (int16_t)U_sat;
+}
+
+/**
+ * @brief Field weakening step - negative d current keeps the voltage vector inside the bus limit above the base speed.
+ * The d current follows the voltage excess through the phase impedance. It is limited by the current budget
+ * and by -U_emf*X_L/(X_L^2+R^2), beyond which more negative current raises the voltage again.
+ * 
+ * @param U_q - quadrature voltage demand of the target current, mV
+ * @param U_d - direct voltage demand of the target current, mV
+ * @param X_L - phase reactance, signed with the speed, mOhm
+ * @param U_emf - back EMF, mV
+ * @param U_lim - voltage vector limit, mV
+ */
+static void field_weakening(int32_t U_q, int32_t U_d, int32_t X_L, int32_t U_emf, int16_t U_lim){
+	int32_t U_fw = (int32_t)U_lim * FIELD_WEAKENING_VOLTAGE / 100;
+	if (U_fw <= 0){
+		I_d_fw = 0;
+		return;
+	}
+	//1/(2*U_fw) in Q24 (rounded up), refreshed when the limit changes
+	static int32_t U_fw_src = 0;
+	static int64_t excess_mul = 0;
+	if (U_fw != U_fw_src){
+		U_fw_src = U_fw;
+		excess_mul = (((int64_t)1 << 24) + (2 * U_fw) - 1) / (2 * U_fw);
+	}
+	//|U| - U_fw linearized around the limit
+	int64_t excess_sq = ((int64_t)U_q * U_q) + ((int64_t)U_d * U_d) - ((int64_t)U_fw * U_fw);
+	int32_t excess = (int32_t)clip((excess_sq * excess_mul) >> 24, (int64_t)INT16_MIN, (int64_t)INT16_MAX);
+
+	uint32_t X = fastAbs(X_L);
+	int32_t Z = max((int32_t)X + phase_R, 1); //mOhm - not below |X_L + jR|
+	int32_t step = (excess * Ohm_to_mOhm) / Z / FIELD_WEAKENING_FILTER; //mA
+
+	int32_t I_d_min = -(int32_t)min(field_weakening_current, MAX_CURRENT);
+	if (excess > 0){
+		//U_emf*X/(X^2+R^2) = U_emf/(X+R^2/X) - fits the 32 bit divider, none useful at standstill
+		int32_t I_d_useful = 0;
+		if (X > 0U){
+			uint32_t Z_sq_per_X = X + ((uint32_t)((int32_t)phase_R * phase_R) / X); //mOhm
+			uint32_t U_emf_abs = min(fastAbs(U_emf), UINT32_MAX / Ohm_to_mOhm); //mV
+			I_d_useful = -(int32_t)min((U_emf_abs * Ohm_to_mOhm) / Z_sq_per_X, (uint32_t)INT16_MAX);
+		}
+		I_d_min = max(I_d_min, I_d_useful);
+	}
+	I_d_fw = (int16_t)clip((int32_t)I_d_fw - step, I_d_min, 0);
+}
+
+void field_oriented_control(int16_t current_target, Commutation_t commutation) {
 
 	int16_t current_actual;
+	bool volt_control = (commutation != COMMUTATION_CURRENT);
 	uint16_t electricAngle = calc_electric_angle(volt_control);
 
-	int16_t I_q = current_target;
+	int16_t I_cog = Anticogging_current((uint16_t)currentLocation);
+	int16_t I_q = (int16_t)clip(current_target + I_cog, -MAX_CURRENT, MAX_CURRENT);
 	if(volt_control == true){
 		//Iq, Id, Uq, Ud per FOC nomencluture
+		int16_t I_d = (commutation == COMMUTATION_VOLTAGE) ? I_d_fw : 0;
+		if (I_d != 0){
+			//the d current takes its share of the phase current
+			int16_t I_q_max = (int16_t)isqrt32((uint32_t)((int32_t)MAX_CURRENT * MAX_CURRENT) - (uint32_t)((int32_t)I_d * I_d));
+			I_q = (int16_t)clip(I_q, -I_q_max, I_q_max);
+		}
+		uint16_t motor_rev_to_elec_rad = (uint16_t)((uint32_t)TWO_PI_X1024 * liveMotorParams.fullStepsPerRotation / 4U / 1024U); //typically 314 (or 628 for 0.9deg motor)
+		int32_t e_rad_s = (int32_t)((int64_t)motor_rev_to_elec_rad * speed_slow / (int32_t)ANGLE_STEPS);
 
 		//Qadrature axis
-		//U_q = I_q*R + U_emf
+		//U_q = I_q*R + U_emf + I_d*ω*L
 		int16_t U_IR = (int16_t)((int32_t)I_q * phase_R / Ohm_to_mOhm);
-		int32_t U_emf = (int32_t)((int64_t)motor_k_bemf * speed_slow / (int32_t)ANGLE_STEPS);
+		int32_t U_bemf = (int32_t)((int64_t)motor_k_bemf * speed_slow / (int32_t)ANGLE_STEPS);
+		int32_t U_emf = U_bemf + (int32_t)((int64_t)I_d * e_rad_s * phase_L / H_to_uH); //field weakening lowers the effective back EMF
 		int32_t U_q = U_IR + U_emf;
-		int16_t U_lim = (int16_t)min(GetMotorVoltage_mV(), INT16_MAX);
+		int16_t U_lim = modulation_limit(GetMotorVoltage_mV());
 		int16_t U_emf_sat = (int16_t)clip(U_emf, -U_lim, U_lim);
 		int16_t U_IR_sat = (int16_t)clip(U_IR, -U_lim - U_emf_sat, U_lim - U_emf_sat);
 		U_IR_sat = (int16_t)clip(U_IR_sat, -U_lim, U_lim);
 		int16_t U_q_sat = U_IR_sat + U_emf_sat;
 		int16_t I_q_act = (int16_t)((int32_t)U_IR_sat * Ohm_to_mOhm / phase_R);
-		current_actual = I_q_act;
+		current_actual = I_q_act - I_cog; //cogging compensation cancels the cogging torque - does not accelerate the load
 
 		//Direct Axis
-		//U_d = I_q*ω*Rl
-		uint16_t motor_rev_to_elec_rad = (uint16_t)((uint32_t)TWO_PI_X1024 * liveMotorParams.fullStepsPerRotation / 4U / 1024U); //typically 314 (or 628 for 0.9deg motor)
-		int32_t e_rad_s = (int32_t)((int64_t)motor_rev_to_elec_rad * speed_slow / (int32_t)ANGLE_STEPS);
-		int32_t U_d = (int32_t)((int64_t)(-I_q_act) * e_rad_s * phase_L / H_to_uH) ; //Vd=Iq * ω*Rl
+		//U_d = I_d*R - I_q*ω*L
+		int32_t U_d = (int32_t)((int64_t)(-I_q_act) * e_rad_s * phase_L / H_to_uH) + ((int32_t)I_d * phase_R / Ohm_to_mOhm);
 
 		int16_t U_d_sat = (int16_t)(clip(U_d, -U_lim, U_lim));
-		uint16_t magnitude = (uint16_t)((current_target > 0) ? I_q_act : -I_q_act); //abs
-		voltage_commutation(electricAngle, U_q_sat, U_d_sat, magnitude);
+		uint16_t magnitude = (uint16_t)((I_q > 0) ? I_q_act : -I_q_act); //abs
+		if (I_d != 0){
+			magnitude = isqrt32((uint32_t)((int32_t)I_q_act * I_q_act) + (uint32_t)((int32_t)I_d * I_d));
+		}
+
+		if (commutation == COMMUTATION_VOLTAGE){
+			//currents of the last commands - without both samples the model estimate stays
+			PhaseCurrents_t sample;
+			phase_current_sample(&sample);
+			int32_t I_q_error = 0;
+			int32_t I_d_error = 0;
+			if (sample.valid_a && sample.valid_b){
+				int16_t turn = (int16_t)((uint16_t)(electricAngle_last - electricAngle_prev + (SINE_STEPS / 2U)) % SINE_STEPS) - (int16_t)(SINE_STEPS / 2U);
+				uint16_t electricAngle_a = (uint16_t)(electricAngle_last - (turn / 2)) % SINE_STEPS;
+				int16_t I_q_meas;
+				int16_t I_d_meas;
+				park_transform(electricAngle_a, electricAngle_last, sample.I_a, sample.I_b, &I_q_meas, &I_d_meas);
+				I_q_error = (int32_t)I_q - I_q_meas;
+				I_d_error = (int32_t)I_d - I_d_meas;
+				current_actual = I_q_meas - I_cog;
+			}else{
+				//short drive pulses at low speed - the correction fades out (2.5ms), the model is accurate there
+				U_q_integral -= U_q_integral / 64;
+				U_d_integral -= U_d_integral / 64;
+			}
+
+			//the regulators correct the model - feedforward keeps the response at speed
+			U_q_sat = current_regulator(I_q_error, &U_q_integral, U_q_sat, U_lim);
+			U_d_sat = current_regulator(I_d_error, &U_d_integral, U_d_sat, U_lim);
+
+			//voltage demand of the target current - unsaturated
+			int32_t X_L = (int32_t)((int64_t)e_rad_s * phase_L / (H_to_uH / Ohm_to_mOhm)); //mOhm
+			int32_t U_d_demand = (int32_t)((int64_t)(-I_q) * e_rad_s * phase_L / H_to_uH) + ((int32_t)I_d * phase_R / Ohm_to_mOhm);
+			field_weakening(U_q, U_d_demand, X_L, U_bemf, U_lim);
+		}else{
+			current_loop_reset();
+		}
+		electricAngle_prev = electricAngle_last;
+		electricAngle_last = electricAngle;
+		voltage_commutation(electricAngle, U_q_sat, U_d_sat, I_q_act, I_d, magnitude);
 	}else{
+		current_loop_reset();
 		current_commutation(electricAngle, I_q, 0);
 		current_actual = current_target; // simplification for higher speeds - //todo estimate or measure actual current
 
@@ -8,8 +8,20 @@
 
 #define FULLSTEP_ELECTRIC_ANGLE (uint16_t) 256U //Full step electrical angle
 #define MAX_CURRENT I_MAX_A4950
+#define CURRENT_LOOP_BANDWIDTH 3000 //rad/s - d/q current regulators, the LSS samples lag the command by up to 1.5 PWM periods
+#define FIELD_WEAKENING_VOLTAGE 95 //% of the modulation limit, the rest is headroom for the current regulators
+#define OVERMODULATION_MAX 127U //% of the bus voltage - square waves, 4/pi
+#define FIELD_WEAKENING_FILTER 32 //motion task periods - time constant of the field weakening loop (1.3ms)
+
+typedef enum {
+	COMMUTATION_CURRENT = 0,	//A4950 current regulators, set through VREF
+	COMMUTATION_VOLTAGE = 1,	//PWM voltage - motor model feedforward, the d/q current regulators and field weakening
+	COMMUTATION_VOLTAGE_FEEDFORWARD = 2,	//PWM voltage from the motor model only
+} Commutation_t;
+
 void openloop_step(uint16_t elecAngleStep, uint16_t curr_tar);
-void field_oriented_control(int16_t current_target);
+void field_oriented_control(int16_t current_target, Commutation_t commutation);
+void current_loop_reset(void);
 void base_speed_test(int16_t dir);
 
 #endif // MOTOR_H_
\ No newline at end of file
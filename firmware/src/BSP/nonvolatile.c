@@ -23,6 +23,7 @@
 #include "board.h"
 #include "stepper_controller.h"
 #include "encoder.h"
+#include "calibration_record.h"
 
 volatile MotorParams_t liveMotorParams;
 volatile SystemParams_t liveSystemParams;
@@ -50,12 +51,13 @@ void nonvolatile_begin(void)
 	}
 }
 
-void nvmWriteCalTable(void *ptrData)
+//size in bytes
+void nvmWriteCalTable(void *ptrData, uint16_t size)
 {
 	bool state = motion_task_isr_enabled;
 	Motion_task_disable(); 
 	
-	Flash_ProgramPage(CALIBRATION_FLASH_ADDR, ptrData, (sizeof(FlashCalData_t)/2U));
+	Flash_ProgramPage(CALIBRATION_FLASH_ADDR, ptrData, ((size + 1U)/2U));
 	
 	if (state) {
 		Motion_task_enable();
@@ -80,6 +82,53 @@ bool nvmFlashCheck(uint32_t address, size_t n)
 	return true;
 }
 
+//size in bytes - replaces the calibration record, the cogging map learned with it is kept
+void nvmUpdateCalTable(void *ptrData, uint16_t size)
+{
+	bool state = motion_task_isr_enabled;
+	Motion_task_disable();
+
+	uint16_t coggingRow[sizeof(FlashCoggingData_t)/2U];
+	bool cogging = (nvmFlashCheck(COGGING_FLASH_ADDR, sizeof(FlashCoggingData_t)/2U) == false);
+	if(cogging){
+		for(uint16_t i=0; i < (sizeof(FlashCoggingData_t)/2U); i++){
+			coggingRow[i] = Flash_readHalfWord(COGGING_FLASH_ADDR + (i * 2U));
+		}
+	}
+	Flash_ProgramPage(CALIBRATION_FLASH_ADDR, ptrData, ((size + 1U)/2U));
+	if(cogging){
+		Flash_ProgramSize(COGGING_FLASH_ADDR, coggingRow, (sizeof(FlashCoggingData_t)/2U));
+	}
+
+	if (state) {
+		Motion_task_enable();
+	}
+}
+
+void nvmWriteCoggingTable(void *ptrData)
+{
+	bool state = motion_task_isr_enabled;
+	Motion_task_disable();
+
+	if(nvmFlashCheck(COGGING_FLASH_ADDR, sizeof(FlashCoggingData_t)/2U) == false){
+		//overwriting an older map - erase the page and restore the calibration record, whatever its size or format
+		uint16_t calRow[FLASH_ROW_SIZE/2U];
+		uint16_t size = (uint16_t)sizeof(FlashCalData_t);
+		if(CalibrationRecord_valid(nvmFlashCalRecord)){ // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+			size = (uint16_t)sizeof(FlashCalHeader_t) + CalibrationRecord_payloadSize(&nvmFlashCalRecord->header); // cppcheck-suppress  misra-c2012-11.4 - loading values from mapped flash structure
+		}
+		for(uint16_t i=0; i < ((size + 1U)/2U); i++){
+			calRow[i] = Flash_readHalfWord(CALIBRATION_FLASH_ADDR + (i * 2U));
+		}
+		Flash_ProgramPage(CALIBRATION_FLASH_ADDR, calRow, ((size + 1U)/2U));
+	}
+	Flash_ProgramSize(COGGING_FLASH_ADDR, ptrData, (sizeof(FlashCoggingData_t)/2U));
+
+	if (state) {
+		Motion_task_enable();
+	}
+}
+
 
 //currently only used once - after first boot
 void nvmWriteConfParms(void){
@@ -132,9 +181,9 @@ void validateAndInitNVMParams(void)
 		nvmMirror.systemParams.fw_version = VERSION;
 		
 		nvmMirror.pPID.Kp = .5f;  nvmMirror.pPID.Ki = .0002f;  nvmMirror.pPID.Kd = 1.0f;  //range: 0-7.99 when CTRL_PID_SCALING=4096
-		nvmMirror.vPID.Kp = 2.0f;   nvmMirror.vPID.Ki = 1.0f; 	 nvmMirror.vPID.Kd = 1.0f;
+		nvmMirror.vPID.Kp = 1.0f;   nvmMirror.vPID.Ki = 2.0f; 	 nvmMirror.vPID.Kd = 0.0f;  //Kp [A/(rev/s)], Ki [10A/rev], Kd unused
 
-		nvmMirror.systemParams.controllerMode = CTRL_TORQUE;  //unused
+		nvmMirror.systemParams.controllerMode = CTRL_TORQUE;  //CTRL_POS_VELOCITY_PID - angle control through the velocity cascade
 		nvmMirror.systemParams.dirRotation = CCW_ROTATION;
 		nvmMirror.systemParams.errorLimit = 0U;  //unused
 		nvmMirror.systemParams.errorPinMode = ERROR_PIN_MODE_ACTIVE_LOW_ENABLE;  //default to !enable pin
@@ -143,6 +192,8 @@ void validateAndInitNVMParams(void)
 	if(nvmMirror.motorParams.parametersValid != valid){
 		nvmMirror.motorParams.invertedPhase = false;
 		nvmMirror.motorParams.fullStepsPerRotation = FULLSTEPS_NA; //it will be detected along with invertedPhase
+		nvmMirror.motorParams.sensorLatency = ENCODER_LATENCY_NOMINAL;
+		nvmMirror.motorParams.sensorProfile = ENCODER_PROFILE_DEFAULT;
 	}
 
 	if((nvmMirror.systemParams.parametersValid != valid) || (nvmMirror.motorParams.parametersValid != valid)){
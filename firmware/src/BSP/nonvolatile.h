@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "calibration.h"
+#include "anticogging.h"
 #include "stepper_controller.h"
 #include "flash.h"
 
@@ -40,8 +41,8 @@ typedef struct {
 } SystemParams_t; //sizeof(SystemParams_t)=12
 
 typedef struct {
-	uint16_t reserved1;
-	uint16_t reserved2;
+	uint16_t sensorLatency;			//us - identified with sensorProfile, ENCODER_LATENCY_NOMINAL if not
+	uint16_t sensorProfile;			//EncoderProfile_t - erased flash selects the default
 	bool     invertedPhase;			// motor rotating in opposite direction to angle sensor
 	uint8_t  reserved3;
 	uint16_t fullStepsPerRotation; //how many full steps per rotation is the motor
@@ -55,10 +56,13 @@ typedef struct {
 } PIDparams_t; //2xsizeof(PIDparams_t)=12
 
 typedef struct {
-	uint32_t reserved1;
-	uint32_t reserved2;
-	uint32_t reserved3;
-} Reserved_t;
+	int16_t  coulomb;		//mA - motor shaft friction at high speed
+	int16_t  stiction;		//mA - friction at zero speed (top of the Stribeck curve)
+	uint16_t stribeck;		//rev/s/4096 - Stribeck speed
+	uint16_t viscous;		//mA/(rev/s) * FRICTION_VISCOUS_SCALING
+	uint16_t reserved1;
+	uint16_t parametersValid;
+} FrictionParams_t; //sizeof(FrictionParams_t)=12
 
 #pragma pack(2) //removes 2byte padding between motorParams and pPid - this is mostly for back compatibility at this point
 typedef struct {
@@ -66,15 +70,25 @@ typedef struct {
 	MotorParams_t 	motorParams;
 	PIDparams_t 	pPID; //simple PID parameters
 	PIDparams_t 	vPID; //position PID parameters
-	Reserved_t 		reserved;
+	FrictionParams_t friction; //identified friction model
 } nvm_t; //sizeof(nvm_t)=58
 #pragma pack()
 
 #define PARAMETERS_FLASH_ADDR  		FLASH_PAGE62_ADDR
 #define CALIBRATION_FLASH_ADDR  	FLASH_PAGE63_ADDR
 
+// cppcheck-suppress-macro  misra-c2012-11.4 - loading values from mapped flash structure
+#define nvmFlashCalRecord			((FlashCalRecord_t*)CALIBRATION_FLASH_ADDR)
+//legacy layouts - read only
 // cppcheck-suppress-macro  misra-c2012-11.4 - loading values from mapped flash structure
 #define nvmFlashCalData				((FlashCalData_t*)CALIBRATION_FLASH_ADDR)
+// cppcheck-suppress-macro  misra-c2012-11.4 - loading values from mapped flash structure
+#define nvmFlashCalHarmonics		((FlashCalHarmonics_t*)CALIBRATION_FLASH_ADDR)
+
+//cogging map shares the calibration page - erased together with the calibration table
+#define COGGING_FLASH_ADDR			(CALIBRATION_FLASH_ADDR + FLASH_ROW_SIZE)
+// cppcheck-suppress-macro  misra-c2012-11.4 - loading values from mapped flash structure
+#define nvmFlashCoggingData			((FlashCoggingData_t*)COGGING_FLASH_ADDR)
 
 
 //this is for wear leveling - sizeof(nvm_t) + 4bytes gap = 62 
@@ -90,7 +104,9 @@ extern volatile SystemParams_t liveSystemParams;
 extern volatile MotorParams_t liveMotorParams;
 
 void nonvolatile_begin(void);
-void nvmWriteCalTable(void *ptrData);
+void nvmWriteCalTable(void *ptrData, uint16_t size);
+void nvmUpdateCalTable(void *ptrData, uint16_t size);
+void nvmWriteCoggingTable(void *ptrData);
 void nvmWriteConfParms(void);
 void validateAndInitNVMParams(void);
 
@@ -0,0 +1,105 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Luenberger observer of the motor shaft, one step per control loop tick:
+		pos += vel + K1*e
+		vel += acc_model + acc_dist + K2*e
+		acc_dist += K3*e
+	where e is the encoder location minus the estimated position and acc_model is the applied current divided by the inertia.
+	The current term predicts the commanded acceleration without lag, acc_dist picks up friction, load and inertia mismatch.
+	Gains K1=3c, K2=3c^2, K3=c^3 put the three poles of the estimation error at z=1-c.
+	States are kept per tick in Q16 so that the update needs no division.
+
+	Load torque (disturbance observer):
+		J*acc_dist = T_load - T_friction  ->  I_load = acc_dist*accel_to_current + I_friction(speed)
+	At standstill the friction sign is unknown, so the dry friction (friction.c) fades in over OBS_FRICTION_SPEED.
+*/
+
+#include "observer.h"
+#include "stepper_controller.h"
+#include "actuator_config.h"
+#include "friction.h"
+#include "encoder.h"
+#include "utils.h"
+
+#define OBS_Q				16U		//states fraction bits
+#define OBS_GAIN_Q			24U		//gains fraction bits
+#define OBS_OMEGA_DT		(2.0f * 3.1415f * (float)OBSERVER_BANDWIDTH * (float)SAMPLING_PERIOD_uS / (float)S_to_uS)
+#define OBS_C				(OBS_OMEGA_DT / (1.0f + OBS_OMEGA_DT))	//pole distance from z=1
+#define OBS_K1				(int64_t)(3.0f * OBS_C * (float)(1UL << OBS_GAIN_Q))
+#define OBS_K2				(int64_t)(3.0f * OBS_C * OBS_C * (float)(1UL << OBS_GAIN_Q))
+#define OBS_K3				(int64_t)(OBS_C * OBS_C * OBS_C * (float)(1UL << OBS_GAIN_Q))
+#define OBS_RESET_ERR		(int32_t)(ANGLE_STEPS / 16U)	//larger innovation means a location jump - restart the estimate
+#define OBS_CURRENT_Q		8U		//extra fraction bits of the current to acceleration gain
+#define OBS_FRICTION_SPEED_Q	14U		//angleraw/s - 2^14 = 0.25 rev/s where the coulomb friction is fully developed
+
+volatile int32_t observerLocation = 0;
+volatile int32_t observerSpeed = 0;
+volatile int32_t observerAcceleration = 0;
+volatile int32_t observerDisturbance = 0;
+volatile int16_t observerLoadCurrent = 0;
+
+static int64_t obs_pos = 0;		//angleraw, Q16
+static int64_t obs_vel = 0;		//angleraw/tick, Q16
+static int64_t obs_dist = 0;	//angleraw/tick^2, Q16
+
+//current [mA] to acceleration [angleraw/tick^2, Q16+OBS_CURRENT_Q], refreshed when the actuator parameters change
+static int32_t current_to_acc = 0;
+static int32_t current_to_acc_src = 0;
+
+void Observer_reset(int32_t location){
+	obs_pos = (int64_t)location << OBS_Q;
+	obs_vel = 0;
+	obs_dist = 0;
+	observerLocation = location;
+	observerSpeed = 0;
+	observerAcceleration = 0;
+	observerDisturbance = 0;
+	observerLoadCurrent = 0;
+}
+
+void Observer_process(int32_t location, int16_t current){
+	int32_t a2c = accel_to_current;
+	if (a2c != current_to_acc_src){
+		current_to_acc_src = a2c;
+		current_to_acc = (a2c > 0) ? (int32_t)(((int64_t)ACCEL_TO_CURRENT_SCALING << (OBS_Q + OBS_CURRENT_Q)) / ((int64_t)SAMPLING_HZ * (int64_t)SAMPLING_HZ * a2c)) : 0;
+	}
+
+	int64_t e = ((int64_t)location << OBS_Q) - obs_pos;
+	if ((e > ((int64_t)OBS_RESET_ERR << OBS_Q)) || (e < -((int64_t)OBS_RESET_ERR << OBS_Q))){
+		Observer_reset(location);
+		return;
+	}
+	int64_t acc_model = ((int64_t)current * current_to_acc) >> OBS_CURRENT_Q;
+	int64_t acc = acc_model + obs_dist;
+
+	obs_pos += obs_vel + ((e * OBS_K1) >> OBS_GAIN_Q);
+	obs_vel += acc + ((e * OBS_K2) >> OBS_GAIN_Q);
+	obs_dist += (e * OBS_K3) >> OBS_GAIN_Q;
+
+	observerLocation = (int32_t)(obs_pos >> OBS_Q);
+	observerSpeed = (int32_t)((obs_vel * (int32_t)SAMPLING_HZ) >> OBS_Q);
+	observerAcceleration = (int32_t)((acc * (int64_t)SAMPLING_HZ * (int32_t)SAMPLING_HZ) >> OBS_Q);
+	observerDisturbance = (int32_t)((obs_dist * (int64_t)SAMPLING_HZ * (int32_t)SAMPLING_HZ) >> OBS_Q);
+
+	int32_t load = (int32_t)(((int64_t)observerDisturbance * a2c) / (int32_t)ACCEL_TO_CURRENT_SCALING) + Friction_current(observerSpeed, OBS_FRICTION_SPEED_Q);
+	observerLoadCurrent = (int16_t)clip(load, INT16_MIN, INT16_MAX);
+}
@@ -0,0 +1,45 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @ Description:
+ * Tracking observer - estimates motor position, speed and acceleration
+ * from the corrected encoder angle and the applied current.
+ * The unexplained acceleration, corrected by the friction model, gives the external load torque.
+ */
+
+#ifndef OBSERVER_H
+#define OBSERVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OBSERVER_BANDWIDTH	300	//Hz - triple pole of the estimation error
+
+//api - estimates
+extern volatile int32_t observerLocation;		//angleraw
+extern volatile int32_t observerSpeed;			//angleraw/s
+extern volatile int32_t observerAcceleration;	//angleraw/s^2
+extern volatile int32_t observerDisturbance;	//angleraw/s^2 - acceleration not explained by the applied current
+extern volatile int16_t observerLoadCurrent;	//mA - external load torque expressed as motor current
+
+void Observer_reset(int32_t location);
+void Observer_process(int32_t location, int16_t current);
+
+#endif // OBSERVER_H
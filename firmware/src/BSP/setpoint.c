@@ -0,0 +1,196 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Position commands come every ~10ms while the control loop runs at SAMPLING_HZ.
+	The commanded velocity is estimated from the last three samples and the command is extrapolated
+	between samples (first order hold), so a ramp command produces a ramp target without lag.
+	The smaller of the two sample slopes is used (zero if they disagree in sign), so a step is not mistaken for a ramp.
+	The target is followed by a limited trajectory:
+		position error -> velocity (linear near the target, sqrt braking curve further away)
+		velocity error -> acceleration (limited), acceleration slew limited by jerk
+	Setpoint_process() is called from the motion task, Setpoint_command() from the lower priority task.
+	The per tick integration multiplies by 1/SAMPLING_HZ in Q SETPOINT_TICK_Q and keeps the fractions - no divisions.
+*/
+
+#include "setpoint.h"
+#include "stepper_controller.h"
+#include "actuator_config.h"
+#include "motor.h"
+#include "utils.h"
+
+#define SETPOINT_KV				80	//1/s - position error to velocity
+#define SETPOINT_KA				480	//1/s - velocity error to acceleration (>4*KV - overdamped to absorb the jerk limit lag)
+#define SETPOINT_JERK_STEP		(int32_t)(SETPOINT_JERK_MAX / (int32_t)SAMPLING_HZ)	//acceleration change per tick
+#define SETPOINT_LINEAR_ERR		(uint32_t)(SETPOINT_ACC_MAX / (SETPOINT_KV * SETPOINT_KV)) //where the braking curve meets the linear part
+#define SETPOINT_HOLD_TICKS_MAX	(uint16_t)(SAMPLING_HZ / 20U)	//50ms - longer gaps between commands are treated as steps
+#define SETPOINT_TICK_Q			32U
+#define SETPOINT_TICK_MUL		(int64_t)((((int64_t)1 << SETPOINT_TICK_Q) + ((int64_t)SAMPLING_HZ / 2)) / (int64_t)SAMPLING_HZ) //1/SAMPLING_HZ in Q SETPOINT_TICK_Q
+#define SETPOINT_DELTA_MAX		(int32_t)((SETPOINT_VEL_MAX + (int32_t)SAMPLING_HZ - 1) / (int32_t)SAMPLING_HZ) //angleraw per tick at SETPOINT_VEL_MAX, rounded up
+
+volatile int32_t setpointVelocity = 0;
+volatile int32_t setpointAcceleration = 0;
+
+//written by Setpoint_command()
+static volatile int32_t cmd_location = 0;
+static volatile uint16_t cmd_seq = 0;
+
+//command sample tracking
+static uint16_t cmd_seq_last = 0;
+static int32_t sample_last = 0;
+static int32_t sample_vel = 0;			//angleraw/s
+static int32_t sample_slope_last = 0;	//angleraw/s - slope between the previous two samples
+static uint16_t sample_ticks = 0;		//ticks since the last sample
+static uint16_t sample_period = 0;		//ticks between the last two samples
+static int64_t sample_step = 0;			//sample_vel per tick, Q SETPOINT_TICK_Q
+static int64_t sample_offset = 0;		//extrapolation from sample_last, Q SETPOINT_TICK_Q
+
+//trajectory
+static int32_t sp_pos = 0;
+static int32_t sp_vel = 0;
+static int32_t sp_acc = 0;
+static uint32_t pos_rem = 0;			//sub-angleraw position fraction, Q SETPOINT_TICK_Q
+static uint32_t vel_rem = 0;			//velocity fraction, Q SETPOINT_TICK_Q
+
+//bitwise integer square root - only used far from the target
+static uint32_t isqrt64(uint64_t x){
+	uint64_t res = 0;
+	uint64_t bit = (uint64_t)1U << 62U;
+	while (bit > x){
+		bit >>= 2U;
+	}
+	while (bit != 0U){
+		if (x >= (res + bit)){
+			x -= res + bit;
+			res = (res >> 1U) + bit;
+		}else{
+			res >>= 1U;
+		}
+		bit >>= 2U;
+	}
+	return (uint32_t)res;
+}
+
+void Setpoint_command(int32_t location){
+	cmd_location = location;
+	cmd_seq++;
+}
+
+//start the trajectory from the given location at rest - the latest command becomes the target
+void Setpoint_reset(int32_t location){
+	sp_pos = location;
+	sp_vel = 0;
+	sp_acc = 0;
+	pos_rem = 0;
+	vel_rem = 0;
+
+	cmd_seq_last = cmd_seq;
+	sample_last = cmd_location;
+	sample_vel = 0;
+	sample_slope_last = 0;
+	sample_ticks = SETPOINT_HOLD_TICKS_MAX;
+	sample_period = 0;
+	sample_step = 0;
+	sample_offset = 0;
+
+	setpointVelocity = 0;
+	setpointAcceleration = 0;
+}
+
+int32_t Setpoint_process(void){
+	//new command sample - estimate commanded velocity from the last two samples
+	uint16_t seq = cmd_seq;
+	if (seq != cmd_seq_last){
+		int32_t sample = cmd_location;
+		cmd_seq_last = seq;
+		int32_t slope = 0;
+		if ((sample_ticks > 0U) && (sample_ticks < SETPOINT_HOLD_TICKS_MAX)){
+			//larger steps are clipped to SETPOINT_VEL_MAX anyway - keeps the product in 32 bits, a hardware division once per sample
+			int32_t delta_max = (int32_t)sample_ticks * SETPOINT_DELTA_MAX;
+			int32_t delta = clip(sample - sample_last, -delta_max, delta_max);
+			slope = clip((delta * (int32_t)SAMPLING_HZ) / (int32_t)sample_ticks, -SETPOINT_VEL_MAX, SETPOINT_VEL_MAX);
+			sample_period = sample_ticks;
+		}else{
+			sample_period = 0;
+		}
+		//slope limiter
+		if ((slope > 0) && (sample_slope_last > 0)){
+			sample_vel = min(slope, sample_slope_last);
+		}else if ((slope < 0) && (sample_slope_last < 0)){
+			sample_vel = max(slope, sample_slope_last);
+		}else{
+			sample_vel = 0;
+		}
+		sample_slope_last = slope;
+		sample_last = sample;
+		sample_ticks = 0;
+		sample_step = (int64_t)sample_vel * SETPOINT_TICK_MUL;
+		sample_offset = 0;
+	}
+	if (sample_ticks < SETPOINT_HOLD_TICKS_MAX){
+		sample_ticks++;
+	}
+
+	//extrapolate the command until the next sample is due
+	int32_t target_vel = 0;
+	if (sample_ticks <= sample_period){
+		sample_offset += sample_step;
+		target_vel = sample_vel;
+	}
+	int32_t target_pos = sample_last + (int32_t)(sample_offset >> SETPOINT_TICK_Q);
+
+	//position error to velocity
+	int32_t error = target_pos - sp_pos;
+	uint32_t error_abs = fastAbs(error);
+	int32_t vel_corr;
+	if (error_abs < SETPOINT_LINEAR_ERR){
+		vel_corr = error * SETPOINT_KV;
+	}else{
+		//braking curve v = sqrt(2 * a/2 * e) - half of the deceleration leaves room for the jerk limit
+		vel_corr = (int32_t)min(isqrt64((uint64_t)SETPOINT_ACC_MAX * error_abs), (uint32_t)SETPOINT_VEL_MAX);
+		if (error < 0){
+			vel_corr = -vel_corr;
+		}
+	}
+	int32_t vel_des = clip(target_vel + vel_corr, -SETPOINT_VEL_MAX, SETPOINT_VEL_MAX);
+
+	//velocity error to acceleration, jerk limited
+	int64_t acc_des = (int64_t)(vel_des - sp_vel) * SETPOINT_KA;
+	acc_des = clip(acc_des, -SETPOINT_ACC_MAX, SETPOINT_ACC_MAX);
+	sp_acc += clip((int32_t)acc_des - sp_acc, -SETPOINT_JERK_STEP, SETPOINT_JERK_STEP);
+
+	//integrate keeping the fractional parts
+	int64_t vel_step = ((int64_t)sp_acc * SETPOINT_TICK_MUL) + vel_rem;
+	sp_vel += (int32_t)(vel_step >> SETPOINT_TICK_Q);
+	vel_rem = (uint32_t)vel_step;
+	int64_t pos_step = ((int64_t)sp_vel * SETPOINT_TICK_MUL) + pos_rem;
+	sp_pos += (int32_t)(pos_step >> SETPOINT_TICK_Q);
+	pos_rem = (uint32_t)pos_step;
+
+	setpointVelocity = sp_vel;
+	setpointAcceleration = sp_acc;
+	return sp_pos;
+}
+
+//acceleration feedforward - current needed to accelerate the rotor and the load
+int16_t Setpoint_inertiaCurrent(void){
+	int64_t current = (int64_t)setpointAcceleration * accel_to_current / (int32_t)ACCEL_TO_CURRENT_SCALING;
+	return (int16_t)clip(current, -(int64_t)MAX_CURRENT, (int64_t)MAX_CURRENT);
+}
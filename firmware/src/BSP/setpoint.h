@@ -0,0 +1,47 @@
+/**
+ * StepperServoCAN
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * @ Description:
+ * Setpoint generator - turns position commands arriving at the CAN rate
+ * into a velocity, acceleration and jerk limited target for every control loop tick.
+ */
+
+#ifndef SETPOINT_H
+#define SETPOINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "encoder.h"
+
+//limits are in the motor shaft domain
+#define SETPOINT_VEL_MAX	(int32_t)(20 * ANGLE_STEPS)		//angleraw/s - 20 rev/s
+#define SETPOINT_ACC_MAX	(int32_t)(1000 * ANGLE_STEPS)	//angleraw/s^2 - 1000 rev/s^2
+#define SETPOINT_JERK_MAX	(int64_t)(200000 * (int64_t)ANGLE_STEPS)	//angleraw/s^3 - full acceleration reached in 5ms
+
+//api - generated target
+extern volatile int32_t setpointVelocity;		//angleraw/s
+extern volatile int32_t setpointAcceleration;	//angleraw/s^2
+
+void Setpoint_command(int32_t location);
+void Setpoint_reset(int32_t location);
+int32_t Setpoint_process(void);
+int16_t Setpoint_inertiaCurrent(void);
+
+#endif // SETPOINT_H
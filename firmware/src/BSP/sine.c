@@ -20,6 +20,8 @@
  */
  
 #include "sine.h"
+#include <stdbool.h>
+#include "utils.h"
 
 //update values below with sine_profile.py
 static const int16_t sineTable[SINE_STEPS] = {
@@ -99,35 +101,59 @@ int16_t cosine(uint16_t electric_angle)
 	return sine(electric_angle + SINE_PI);//since SINE_STEPS is a divider of UINT16_MAX, potential wraping uint16_t electric_angle around is not harmful
 }
 
+//commutation waveform with the harmonic profile in RAM - sine at [angle], cosine at [angle + SINE_PI]
+static int16_t rippleTable[SINE_STEPS + SINE_PI];
+static bool rippleValid = false;
+static int8_t rippleHarmonic3;
+static int8_t rippleHarmonic5;
+
+/**
+ * @brief Generates the commutation table when the harmonic profile changes
+ * Interpolates sin(x), sin(3x) and sin(5x) - the peak at 90 degrees stays at SINE_MAX
+ * The motion task reads the table, regenerate it with the motor idle
+ * 
+ * @param harmonic_3rd is -128 to 127 and represent -1/8 to 1/8 sin(3x) ratio
+ * @param harmonic_5th is -128 to 127 and represent -1/8 to 1/8 sin(5x) ratio
+ */
+void sine_ripple_profile(int8_t harmonic_3rd, int8_t harmonic_5th){
+   if (rippleValid && (harmonic_3rd == rippleHarmonic3) && (harmonic_5th == rippleHarmonic5)){
+      return;
+   }
+
+   //max_ratio  is on purpose 8x value of int8 to only allow for 1/8 of a ratio
+   const int32_t max_ratio = 1024;
+   int32_t sin_x_ratio = max_ratio - harmonic_3rd - harmonic_5th;
+
+   for (uint16_t i = 0; i < (SINE_STEPS + SINE_PI); i++){
+      int32_t sin_x = sine(i);
+      int32_t sin_3x = sine((uint16_t)(3U * i));
+      int32_t sin_5x = sine((uint16_t)(5U * i));
+      int32_t sine_comp = ((sin_x_ratio * sin_x) - ((int32_t)harmonic_3rd * sin_3x) + ((int32_t)harmonic_5th * sin_5x)) / max_ratio;
+      rippleTable[i] = (int16_t)clip(sine_comp, -(int32_t)INT16_MAX, (int32_t)INT16_MAX); //both harmonics at full scale can overshoot between the peaks
+   }
+   rippleHarmonic3 = harmonic_3rd;
+   rippleHarmonic5 = harmonic_5th;
+   rippleValid = true;
+}
+
 /**
  * @brief Advance sine calculation to compensate higher torque harmonics
- * Interpolates sin(x) and sin(3x)
+ * Reads the table of sine_ripple_profile()
  * 
  * @param electric_angle - electrical electric_angle with usable range of 0-1023
- * @param strength is -128 to 127 and represent -1/8 to 1/8 sin(3x) ratio
  * @return int16_t 
  */
-int16_t sine_ripple(uint16_t electric_angle, int8_t strength){
-   int16_t sin_x = sine(electric_angle);
-   int16_t sin_3x = sine((3U*electric_angle) % SINE_STEPS);
-   
-   //max_ratio  is on purpose 8x value of int8 to only allow for 1/8 of a ratio
-   const int16_t max_ratio = 1024U; 
-   int16_t sin_x_ratio = max_ratio-strength;
-   int16_t sin_3x_ratio = strength;
-   
-   int16_t sine_comp = (int16_t)((((int32_t)sin_x_ratio * sin_x) - ((int32_t)sin_3x_ratio * sin_3x))/(int16_t)max_ratio);
-   return sine_comp;
+int16_t sine_ripple(uint16_t electric_angle){
+   return rippleTable[electric_angle % SINE_STEPS];
 }
 
 /**
  * @brief Advance cosine calculation to compensate higher torque harmonics
- * Interpolates sin(x) and sin(3x)
+ * Reads the table of sine_ripple_profile()
  * 
  * @param electric_angle - electrical electric_angle with usable range of 0-1023
- * @param strength is -128 to 127 and represent -1/8 to 1/8 sin(3x) ratio
  * @return int16_t 
  */
-int16_t cosine_ripple(uint16_t electric_angle, int8_t strength){
-   return sine_ripple(electric_angle + SINE_PI, strength);
+int16_t cosine_ripple(uint16_t electric_angle){
+   return rippleTable[(electric_angle % SINE_STEPS) + SINE_PI];
 }
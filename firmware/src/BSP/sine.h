@@ -30,7 +30,8 @@
 
 int16_t sine(uint16_t electric_angle);
 int16_t cosine(uint16_t electric_angle);
-int16_t sine_ripple(uint16_t electric_angle, int8_t strength);
-int16_t cosine_ripple(uint16_t electric_angle, int8_t strength);
+void sine_ripple_profile(int8_t harmonic_3rd, int8_t harmonic_5th);
+int16_t sine_ripple(uint16_t electric_angle);
+int16_t cosine_ripple(uint16_t electric_angle);
 
 #endif
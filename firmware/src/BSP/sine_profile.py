@@ -20,10 +20,13 @@ P = np.pi
 y_line_sin = abs((x-P/2) % (2*P) - P) / P * 2 - 1
 y_line_cos = abs(x % (2*P) - P) / P * 2 - 1 
 
-# %% sine profiling - subtract third harmonic
+# %% sine profiling - subtract third harmonic, add fifth harmonic
+# the firmware generates the same profile in RAM (sine_ripple_profile) - set anticogging_factor and anticogging_factor_5th to a*1024 and a5*1024
 a = .07 # 7%
-y_sin_mod = (1-a)*y_sin - a*np.sin(3*x)
-y_cos_mod = (1-a)*y_cos + a*np.cos(3*x)
+a5 = 0 # 5th harmonic, the peak at 90 degrees stays 1
+y_sin_mod = (1-a-a5)*y_sin - a*np.sin(3*x) + a5*np.sin(5*x)
+y_cos_mod = (1-a-a5)*y_cos + a*np.cos(3*x) + a5*np.cos(5*x)
+print("anticogging_factor = " + str(round(a*1024)) + ", anticogging_factor_5th = " + str(round(a5*1024)))
 
 # we want y_sin_mod to be in the range [-1, 1] (in order not to overflow and have good control)
 # we also want y_sin_mod to not change direction before crossing zero
@@ -27,21 +27,45 @@
 #include "board.h"
 #include "encoder.h"
 #include "motor.h"
+#include "setpoint.h"
+#include "observer.h"
+#include "autotune.h"
+#include "anticogging.h"
+#include "friction.h"
+#include "utils.h"
 
 volatile PID_t pPID; //positional current based PID control parameters
 volatile PID_t vPID; //velocity PID control parameters
 
+//vPID.Kp [A/(rev/s)] and vPID.Ki [10A/rev] to mA
+#define VEL_KP_SCALING			((int64_t)CTRL_PID_SCALING * (int64_t)ANGLE_STEPS / 1000)
+#define VEL_KI_SCALING			((int64_t)CTRL_PID_SCALING * (int64_t)ANGLE_STEPS / 10000 * (int64_t)SAMPLING_HZ)
+
+//gain derived multipliers - the motion task uses multiplies and shifts only
+#define PID_LIMIT_Q		16U
+#define PID_ITERM_Q		32U
+#define VEL_PTERM_Q		32U
+#define VEL_ITERM_Q		40U		//vPID.Ki/VEL_KI_SCALING is small
+static int32_t pid_errorMax_mul;		//maxEachTerm to errorMax - CTRL_PID_SCALING/Kp
+static int32_t pid_deltaErrorMax_mul;	//maxEachTerm to deltaErrorMax - CTRL_PID_SCALING/Kd/SAMPLING_PERIOD_uS
+static int32_t pid_iTerm_mul;			//error to iTerm accumulator - Ki/SAMPLING_PERIOD_uS/CTRL_PID_SCALING
+static int32_t vel_pTerm_mul;			//Kp/VEL_KP_SCALING
+static int32_t vel_iTerm_mul;			//Ki/VEL_KI_SCALING
+
 volatile bool StepperCtrl_Enabled = false;
 volatile bool enableSensored = false; //motor control using sensor angle feedback scheme
 volatile bool enableCloseLoop = false; //true if control uses PID
 volatile bool enableSoftOff = false; //true if soft off is enabled
 static volatile bool enableRelative = true;
+static volatile bool enableCascade = false; //position -> velocity -> current cascade instead of the position PID
+static volatile bool enableVelocityCmd = false; //velocity target comes from the api instead of the position loop
 volatile int32_t angleFullStep = 327;
 
 volatile int32_t zeroAngleOffset = 0;
 
 //api - commanded
 volatile int32_t desiredLocation;
+volatile int32_t desiredVelocity; // rev/s/65536
 volatile int16_t feedForward;
 volatile int16_t closeLoopMaxDes;
 
@@ -51,10 +75,15 @@ volatile int16_t closeLoop;
 volatile int16_t control;
 volatile int16_t control_actual;
 volatile int32_t speed_slow = 0; // rev/s/65536
+volatile int32_t speed_iir = 0; // rev/s/65536 - filtered position difference
+volatile int32_t velocityRef = 0; // rev/s/65536 - velocity loop target
 volatile int32_t loopError = 0;
 
 // special mode
 static bool base_speed_mode = false;
+static bool autotune_mode = false;
+static bool voltage_mode = false; //voltage commutation from the motor model only, whatever USE_VOLTAGE_CONTROL says
+static bool calibration_mode = false;
 
 static void UpdateRuntimeParams(void)
 {
@@ -67,19 +96,32 @@ static void UpdateRuntimeParams(void)
 	vPID.Ki = nvmMirror.vPID.Ki * CTRL_PID_SCALING;
 	vPID.Kd = nvmMirror.vPID.Kd * CTRL_PID_SCALING;
 
+	//Cortex-M3 division by zero yields 0 - keep the zero gain behavior
+	pid_errorMax_mul = (pPID.Kp != 0) ? (((int32_t)CTRL_PID_SCALING << PID_LIMIT_Q) / pPID.Kp) : 0;
+	pid_deltaErrorMax_mul = (pPID.Kd != 0) ? (((int32_t)CTRL_PID_SCALING << PID_LIMIT_Q) / (pPID.Kd * (int32_t)SAMPLING_PERIOD_uS)) : 0;
+	pid_iTerm_mul = (int32_t)((int64_t)pPID.Ki * ((int64_t)1 << PID_ITERM_Q) / ((int32_t)SAMPLING_PERIOD_uS * CTRL_PID_SCALING));
+	vel_pTerm_mul = (int32_t)((int64_t)vPID.Kp * ((int64_t)1 << VEL_PTERM_Q) / VEL_KP_SCALING);
+	vel_iTerm_mul = (int32_t)((int64_t)vPID.Ki * ((int64_t)1 << VEL_ITERM_Q) / VEL_KI_SCALING);
+
 	liveSystemParams = nvmMirror.systemParams;
 	liveMotorParams = nvmMirror.motorParams;
+	Friction_init();
 }
 
 
 //Keep track of full rotations
 //the current location lower 16 bits is angle (0-360 degrees in 65536 steps) while 
 //upper 16 bits effectively hold number of full rotations.
+//A sample rejected by the sensor safety word is replaced by the last motion.
 static int32_t StepperCtrl_updateCurrentLocation(void)
 {
-	uint16_t angle = GetCorrectedAngle(ReadEncoderAngle());
-	//convert to unsigned and use wrap around math to get circular angle distance!
-	int16_t previousAngleDelta = (int16_t)(uint16_t)(angle - (uint16_t)((int16_t)(currentLocation % (int32_t)ANGLE_STEPS)));
+	static int16_t previousAngleDelta = 0;
+	EncoderSample_t sample;
+	if (FetchEncoderSample(&sample)){
+		uint16_t angle = GetCorrectedAngle(sample.angle);
+		//convert to unsigned and use wrap around math to get circular angle distance!
+		previousAngleDelta = (int16_t)(uint16_t)(angle - (uint16_t)((int16_t)(currentLocation % (int32_t)ANGLE_STEPS)));
+	}
 	currentLocation = currentLocation + previousAngleDelta;
 
 	return currentLocation;
@@ -98,9 +140,16 @@ stepCtrlError_t StepperCtrl_begin(void){
 	{
 		return STEPCTRL_NO_ENCODER;
 	}
+	//a newly configured profile is stored with the nominal latency - the identified latency belongs to the stored profile
+	//a profile the sensor does not take leaves the stored one, or the default
+	bool profileChanged = (sensor_profile != liveMotorParams.sensorProfile) && Select_sensor_profile((EncoderProfile_t)sensor_profile);
+	if (!profileChanged && Encoder_setProfile((EncoderProfile_t)liveMotorParams.sensorProfile)){
+		Encoder_setLatency_us(liveMotorParams.sensorLatency);
+	}
 
 	//cal table init
 	CalibrationTable_init();
+	Anticogging_init();
 
 	//voltage check
 	if ((GetSupplyVoltage() < MIN_SUPPLY_VOLTAGE) || (GetMotorVoltage() < MIN_SUPPLY_VOLTAGE - 0.1f)){
@@ -134,6 +183,7 @@ void StepperCtrl_enable(bool enable) //enables feedback sensor processing Steppe
 		Motion_task_disable();
 		//reset globals:
 		speed_slow = 0;
+		speed_iir = 0;
 		closeLoop = 0;
 		control = 0;
 		control_actual = 0;
@@ -154,6 +204,11 @@ void StepperCtrl_setMotionMode(uint8_t mode)
 		UpdateRuntimeParams();
 	}
 	base_speed_mode = false;
+	autotune_mode = false;
+	voltage_mode = false;
+	calibration_mode = false;
+	enableCascade = false;
+	enableVelocityCmd = false;
 	switch (mode) {
 	case STEPCTRL_OFF:
 		enableSensored = false; //motor control using angle sensor feedback is off
@@ -171,11 +226,24 @@ void StepperCtrl_setMotionMode(uint8_t mode)
 		enableSensored = true;
 		enableCloseLoop = true;
 		enableRelative = false;
+		enableCascade = (liveSystemParams.controllerMode == CTRL_POS_VELOCITY_PID);
+		A4950_enable(true);
+		break;
+	case STEPCTRL_FEEDBACK_VELOCITY:
+		enableSensored = true;
+		enableCloseLoop = true;
+		enableRelative = false;
+		enableCascade = true;
+		enableVelocityCmd = true;
 		A4950_enable(true);
 		break;
-	case STEPCTRL_FEEDBACK_VELOCITY:	//TODO
+	case STEPCTRL_FEEDBACK_VELOCITY_VOLTAGE:
 		enableSensored = true;
 		enableCloseLoop = true;
+		enableRelative = false;
+		enableCascade = true;
+		enableVelocityCmd = true;
+		voltage_mode = true;
 		A4950_enable(true);
 		break;
 	case STEPCTRL_FEEDBACK_TORQUE:
@@ -193,6 +261,17 @@ void StepperCtrl_setMotionMode(uint8_t mode)
 		enableCloseLoop = false;
 		enableSoftOff = true;
 		break;
+	case STEPCTRL_FEEDBACK_AUTOTUNE:
+		enableSensored = true;
+		enableCloseLoop = false;
+		autotune_mode = true;
+		A4950_enable(true);
+		break;
+	case STEPCTRL_OPENLOOP_CALIBRATION:
+		enableSensored = false;
+		calibration_mode = true;
+		A4950_enable(true);
+		break;
 	case STEPCTRL_FEEDBACK_KBEMF_ADAPT:
 		base_speed_mode = true;
 		A4950_enable(true);
@@ -214,22 +293,82 @@ void StepperCtrl_setCloseLoopCurrentLim(int16_t current){
 	closeLoopMaxDes = current;
 }
 
-#define AVG_WINDOW 8U
-static int32_t errMovingAverage(int32_t val) {
-	const uint8_t window_n = AVG_WINDOW;
-	static int32_t ringbuffer[AVG_WINDOW];
+void StepperCtrl_setVelocity(int32_t velocity){
+	desiredVelocity = velocity;
+}
+
+//closeloop torque limit
+static int16_t closeLoopLimit(void){
+	int16_t closeLoopMax = closeLoopMaxDes;
+	// increase closeLoopMax if feedForward is larger than it and in opposite direction
+	// so that closeloop has always power to cancel out the feedforward to avoid uncontrolled rotation
+	if((closeLoop > 0) && (-feedForward > closeLoopMaxDes)){
+		closeLoopMax = -feedForward;
+	}
+	if((closeLoop < 0 ) && (feedForward > closeLoopMaxDes)){
+		closeLoopMax = feedForward;
+	}
+	return closeLoopMax;
+}
+
+//speed for the velocity loop - moving window differentiator has linear phase and resolution of SAMPLING_HZ/SPEED_WINDOW
+#define SPEED_WINDOW 16U
+static int32_t speedWindow(int32_t loc){
+	static int32_t ringbuffer[SPEED_WINDOW];
 	static uint8_t ringbuffer_idx = 0;
 
-	static int32_t avg=0;
-	static int32_t accu=0;
-	
-	accu += val - ringbuffer[ringbuffer_idx];
-	ringbuffer[ringbuffer_idx] = val;
+	int32_t speed = (loc - ringbuffer[ringbuffer_idx]) * (int32_t)(SAMPLING_HZ / SPEED_WINDOW);
+	ringbuffer[ringbuffer_idx] = loc;
+	ringbuffer_idx = (ringbuffer_idx + 1U) % SPEED_WINDOW;
+
+	return speed;
+}
+
+#define CASCADE_POS_DECIMATION	10U		//position loop runs at SAMPLING_HZ/10
+#define CASCADE_POS_KP			150		//1/s - position error to velocity target
+#define CASCADE_VEL_SLEW		(int32_t)(SETPOINT_ACC_MAX / (int32_t)SAMPLING_HZ) //velocity command change per tick
+
+static int64_t vel_iTerm_accu = 0; //velocity integrator memory - mA, Q VEL_ITERM_Q
 
-	avg = accu/(int32_t)window_n;
-	ringbuffer_idx = (ringbuffer_idx + 1U) % window_n;
+//position -> velocity -> current cascade
+static int16_t velocityCascade(int32_t posError, int32_t speed, int16_t closeLoopMax){
+	static int32_t velocityPos = 0;
+	static uint8_t decimation = 0;
+
+	if (enableVelocityCmd){
+		velocityRef += clip(desiredVelocity - velocityRef, -CASCADE_VEL_SLEW, CASCADE_VEL_SLEW);
+		velocityPos = 0;
+	}else{
+		// outer position loop - P only, decimated
+		decimation++;
+		if (decimation >= CASCADE_POS_DECIMATION){
+			decimation = 0;
+			velocityPos = clip(posError, -(SETPOINT_VEL_MAX / CASCADE_POS_KP), SETPOINT_VEL_MAX / CASCADE_POS_KP) * CASCADE_POS_KP;
+		}
+		velocityRef = clip(setpointVelocity + velocityPos, -SETPOINT_VEL_MAX, SETPOINT_VEL_MAX);
+	}
 
-	return avg;
+	// inner velocity PI - every tick
+	int32_t velError = velocityRef - speed;
+	int32_t pTerm = (int32_t)clip(((int64_t)velError * vel_pTerm_mul) >> VEL_PTERM_Q, -(int64_t)closeLoopMax, (int64_t)closeLoopMax);
+
+	vel_iTerm_accu += (int64_t)velError * vel_iTerm_mul;
+	int32_t iTerm = (int32_t)clip(vel_iTerm_accu >> VEL_ITERM_Q, -(int64_t)closeLoopMax, (int64_t)closeLoopMax);
+
+	int32_t out = pTerm + iTerm;
+	// saturate - any excess is subtracted from the integral part, but don't make it change sign
+	if (out > closeLoopMax){
+		iTerm = max(iTerm - (out - closeLoopMax), 0);
+		out = closeLoopMax;
+	}else if (out < -closeLoopMax){
+		iTerm = min(iTerm - (out + closeLoopMax), 0);
+		out = -closeLoopMax;
+	}else{
+		return (int16_t)out;
+	}
+	//backcalculate the accumulator
+	vel_iTerm_accu = (int64_t)iTerm * ((int64_t)1 << VEL_ITERM_Q);
+	return (int16_t)out;
 }
 
 bool StepperCtrl_processMotion(void)
@@ -237,29 +376,53 @@ bool StepperCtrl_processMotion(void)
 	bool no_error = false;
 	int32_t currentLoc;
 	static int32_t lastLoc;
-	const int16_t speed_filter_tc = 8; //speed filter time constant
-	const int8_t error_filter_tc = 2; //error filter time constant - choose depending on CAN RX rate
+	const uint8_t speed_filter_shift = 3U; //speed filter time constant 2^3 ticks
+	const uint8_t error_filter_shift = 1U; //error filter time constant 2^1 ticks - choose depending on CAN RX rate
 	int32_t speed_raw;
 	int32_t error;
 	static int32_t desiredLoc_slow = 0;
+	if (calibration_mode){
+		CalibrationSweep_process(); //the location is not tracked while the calibration table is measured
+		return false;
+	}
 	currentLoc = StepperCtrl_updateCurrentLocation(); //CurrentLocation
+	if ((Encoder_faultsInRow() > ENCODER_FAULTS_MAX) && (enableSensored || base_speed_mode)){
+		StepperCtrl_setMotionMode(STEPCTRL_OFF); //the extrapolated location cannot be trusted any longer
+	}
 
 	loopError = desiredLocation - currentLoc;
 	speed_raw = (currentLoc - lastLoc) * (int32_t) SAMPLING_HZ; // rev/s/65536
-	speed_slow = (int32_t)(int64_t)((speed_raw + (int64_t)(int16_t)(speed_filter_tc-1) * speed_slow) / speed_filter_tc);
+	speed_iir += (speed_raw - speed_iir) >> speed_filter_shift;
 	lastLoc = currentLoc;
+	Observer_process(currentLoc, control_actual);
+	speed_slow = USE_SPEED_OBSERVER ? observerSpeed : speed_iir;
+	int32_t speed = speedWindow(currentLoc);
 
-	desiredLoc_slow = (int32_t)(int64_t)(desiredLocation + (int64_t)(int8_t)(error_filter_tc-1) * desiredLoc_slow) / error_filter_tc;
+	int16_t inertiaFF = 0;
 	if (enableRelative){
+		Setpoint_reset(currentLoc); //no setpoint velocity left from the absolute mode
+		desiredLoc_slow += (desiredLocation - desiredLoc_slow) >> error_filter_shift;
 		error = desiredLoc_slow;
+	}else if(enableSensored && enableCloseLoop && !enableSoftOff && !base_speed_mode && !enableVelocityCmd){
+		error = Setpoint_process() - currentLoc; //error is setpoint - currentPos
+		inertiaFF = Setpoint_inertiaCurrent();
 	}else{
-		error = desiredLoc_slow - currentLoc; //error is desired - PoscurrentPos
+		Setpoint_reset(currentLoc); //closeloop will start from the current position
+		error = desiredLocation - currentLoc;
 	}
-	int32_t error_flt = errMovingAverage(error);
+	//friction feedforward from the commanded speed - the measured one would remove the friction that helps holding against a load
+	int32_t frictionSpeed = enableCascade ? velocityRef : setpointVelocity;
+	int16_t frictionFF = (enableCloseLoop && !enableRelative) ? Friction_feedforward(frictionSpeed) : 0;
 	static int32_t lastError = 0;
 	static uint32_t errorCount = 0;
 
-	static int32_t iTerm_accu; //iTerm memory
+	static int64_t iTerm_accu; //iTerm memory - mA, Q PID_ITERM_Q
+
+	if (!(enableSensored && enableCloseLoop && enableCascade) || enableSoftOff || base_speed_mode){
+		//bumpless start of the velocity loop
+		vel_iTerm_accu = 0;
+		velocityRef = speed;
+	}
 
 	if (base_speed_mode){
 		control = feedForward;
@@ -279,25 +442,31 @@ bool StepperCtrl_processMotion(void)
 			lastError = 0;
 			closeLoop = 0;
 		}
+		else if(autotune_mode){
+			control = Autotune_relay(currentLoc);
+			closeLoop = 0;
+			lastError = 0;
+			iTerm_accu = 0;
+		}
+		else if(enableCloseLoop && enableCascade){
+			closeLoop = velocityCascade(error, speed, closeLoopLimit());
+			control = (int16_t)clip(closeLoop + feedForward + inertiaFF + frictionFF, -MAX_CURRENT, MAX_CURRENT);
+			lastError = enableVelocityCmd ? 0 : error;
+			iTerm_accu = 0;
+		}
 		else if(enableCloseLoop){
 			int32_t errorSat;
 			int16_t pTerm;
 			int16_t dTerm;
 
-			int16_t closeLoopMax = closeLoopMaxDes;
-			// increase closeLoopMax if feedForward is larger than it and in opposite direction
-			// so that closeloop has always power to cancel out the feedforward to avoid uncontrolled rotation
-			if((closeLoop > 0) && (-feedForward > closeLoopMaxDes)){
-				closeLoopMax = -feedForward;
-			}
-			if((closeLoop < 0 ) && (feedForward > closeLoopMaxDes)){
-				closeLoopMax = feedForward;
-			}
+			int16_t feedForwardTot = (int16_t)clip(feedForward + inertiaFF + frictionFF, -MAX_CURRENT, MAX_CURRENT);
+
+			int16_t closeLoopMax = closeLoopLimit();
 
 			#define PID_TERMS 3
 			int16_t maxEachTerm = closeLoopMax * PID_TERMS;
 
-			int32_t errorMax = (int32_t)maxEachTerm * CTRL_PID_SCALING / pPID.Kp;
+			int32_t errorMax = (int32_t)(((int64_t)maxEachTerm * pid_errorMax_mul) >> PID_LIMIT_Q);
 			//protect closeLoop against overflow and unrealistic values - due to P term
 			if( error > errorMax){
 				errorSat = errorMax;
@@ -308,8 +477,8 @@ bool StepperCtrl_processMotion(void)
 			}
 
 			// PID - (I)ntegral term
-			iTerm_accu += errorSat;
-			int16_t iTerm = (int16_t)(iTerm_accu  * pPID.Ki / (int16_t)SAMPLING_PERIOD_uS / CTRL_PID_SCALING); //it's safe to cast to int16_t as iTerm_accu / CTRL_PID_SCALING cannot be much bigger than maxEachTerm since last time because iTerm_accu uses limited errorSat when acumulating error
+			iTerm_accu += (int64_t)errorSat * pid_iTerm_mul;
+			int16_t iTerm = (int16_t)(iTerm_accu >> PID_ITERM_Q); //it's safe to cast to int16_t as iTerm_accu cannot be much bigger than maxEachTerm since last time because iTerm_accu uses limited errorSat when acumulating error
 			bool iTermLimited = false;
 			//protect closeLoop against overflow and unrealistic values - due to I term
 			if (iTerm  > maxEachTerm){
@@ -330,11 +499,11 @@ bool StepperCtrl_processMotion(void)
 			}
 
 			// PID - (D)erivative term
-			// error deadzone to reduce mechanical vibration of the D term
-			if(((error < angleFullStep) && (error > -angleFullStep))){
+			// error deadzone to reduce mechanical vibration of the D term - damping is kept while the setpoint moves
+			if(((error < angleFullStep) && (error > -angleFullStep)) && (setpointVelocity == 0)){
 				dTerm=0;
 			}else{
-				int32_t deltaErrorMax = (int32_t) maxEachTerm * CTRL_PID_SCALING / pPID.Kd / (int16_t)SAMPLING_PERIOD_uS;
+				int32_t deltaErrorMax = (int32_t)(((int64_t)maxEachTerm * pid_deltaErrorMax_mul) >> PID_LIMIT_Q);
 				int32_t deltaError = error - lastError;
 				
 				//protect closeLoop against overflow and unrealistic values - due to D term
@@ -368,7 +537,7 @@ bool StepperCtrl_processMotion(void)
 				iTermLimited = true;
 				closeLoop = -closeLoopMax;
 			}
-			control = closeLoop + feedForward;
+			control = closeLoop + feedForwardTot;
 
 			// Saturate against MAX_CURRENT - any excess subtract from integral part, but don't make it change sign
 			if(control > MAX_CURRENT){	
@@ -389,7 +558,7 @@ bool StepperCtrl_processMotion(void)
 			}
 
 			if(iTermLimited == true){ //backcalculate the accumulator
-				iTerm_accu = (int32_t) SAMPLING_PERIOD_uS * CTRL_PID_SCALING * iTerm / pPID.Ki;
+				iTerm_accu = (int64_t)iTerm * ((int64_t)1 << PID_ITERM_Q);
 			}
 
 		}else{
@@ -406,17 +575,23 @@ bool StepperCtrl_processMotion(void)
 			iTerm_accu = 0;
 		}
 
-		field_oriented_control(control);
+		Anticogging_record((uint16_t)currentLoc, control);
+		field_oriented_control(control, voltage_mode ? COMMUTATION_VOLTAGE_FEEDFORWARD : (USE_VOLTAGE_CONTROL ? COMMUTATION_VOLTAGE : COMMUTATION_CURRENT));
 
 	}else{
 		control = 0;
 		closeLoop = 0;
 		control_actual = 0;
+		current_loop_reset();
 
 		lastError = 0;
 		iTerm_accu = 0;
 	}
 
+	//rotor turned by the load without current - with current the commutation torque ripple follows the calibration error
+	bool unpowered = !base_speed_mode && (!enableSensored || (!enableCloseLoop && !autotune_mode && (control == 0) && (Anticogging_current((uint16_t)currentLoc) == 0)));
+	CalibrationRefine_process((uint16_t)currentLoc, unpowered ? speed_slow : 0);
+
   // error needs to exist for some time period
 	if ((lastError > angleFullStep) || (lastError < -angleFullStep))
 	{
@@ -38,7 +38,7 @@ typedef enum {
 typedef enum {
 	CTRL_TORQUE = 0, //simple error controller
 	CTRL_POS_PID =1, //PID  Position controller
-	CTRL_POS_VELOCITY_PID = 2, //PID  Velocity controller
+	CTRL_POS_VELOCITY_PID = 2, //Position P -> velocity PI cascade
 } feedbackCtrl_t; //sizeof(feedbackCtrl_t)=1
 
 
@@ -55,12 +55,15 @@ typedef	enum {
 	//Uses angle sensor to control the stepper load
 	STEPCTRL_FEEDBACK_POSITION_RELATIVE=1,	//relative closeloop positioning with feedforward torque
 	STEPCTRL_FEEDBACK_POSITION_ABSOLUTE=2,	//absolute closeloop positioning with feedforward torque
-	STEPCTRL_FEEDBACK_VELOCITY=3,			//velocity closeloop positioning with feedforward torque
+	STEPCTRL_FEEDBACK_VELOCITY=3,			//velocity closeloop control with feedforward torque
 	//todo replace FEEDBACK with SENSED
 	STEPCTRL_FEEDBACK_TORQUE=4,				//torque control with no closeloop
 	STEPCTRL_FEEDBACK_CURRENT=5,			//current control
 	STEPCTRL_FEEDBACK_SOFT_TORQUE_OFF=6,	//last torque ramp off
 
+	STEPCTRL_FEEDBACK_VELOCITY_VOLTAGE=124,	//special calibration mode - velocity closeloop on voltage commutation without the current regulators
+	STEPCTRL_OPENLOOP_CALIBRATION=125,		//special calibration mode - open loop encoder calibration sweep
+	STEPCTRL_FEEDBACK_AUTOTUNE=126,			//special calibration mode - relay experiment of the position loop
 	STEPCTRL_FEEDBACK_KBEMF_ADAPT=127,		//special calibration mode
 
 	//Classical sensorless openloop
@@ -90,6 +93,8 @@ extern volatile PID_t vPID; //velocity PID control parameters
 #define S_to_uS   	(uint32_t)(1000000)
 #define SAMPLING_PERIOD_uS	(uint16_t)(40) //sampling time in uS of control loop. 35uS puts theoretical limit of ~125rev/s on the motor which is plenty.  Adjust to reduce harmonics. 
 #define SAMPLING_HZ		(uint32_t)(S_to_uS / SAMPLING_PERIOD_uS) //update rate of control loop
+#define ACTUATION_DELAY_uS	SAMPLING_PERIOD_uS //inputs are sampled at a PWM update, the outputs computed from them apply at the next one
+#define ENCODER_FAULTS_MAX	8U //rejected angle reads in a row before the motor is turned off - 320uS of extrapolated location
 
 //api - control states
 extern volatile bool StepperCtrl_Enabled;
@@ -100,6 +105,7 @@ extern volatile bool enableSoftOff;
 
 //api - commanded
 extern volatile int32_t desiredLocation;
+extern volatile int32_t desiredVelocity;
 extern volatile int16_t feedForward;
 extern volatile int16_t closeLoopMaxDes;
 
@@ -109,6 +115,8 @@ extern volatile int16_t closeLoop;
 extern volatile int16_t control;
 extern volatile int16_t control_actual;
 extern volatile int32_t speed_slow;
+extern volatile int32_t speed_iir;
+extern volatile int32_t velocityRef;
 extern volatile int32_t loopError;
 
 stepCtrlError_t StepperCtrl_begin(void);
@@ -116,6 +124,7 @@ void StepperCtrl_enable(bool enable);
 void StepperCtrl_setMotionMode(uint8_t mode);
 void StepperCtrl_setCurrent(int16_t current);
 void StepperCtrl_setCloseLoopCurrentLim(int16_t current);
+void StepperCtrl_setVelocity(int32_t velocity);
 bool StepperCtrl_processMotion(void);
 
 
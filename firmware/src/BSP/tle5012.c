@@ -30,35 +30,171 @@
 
 
 
-//
-static volatile uint16_t safety;
-static uint16_t TLE5012_ReadValue(uint16_t command)
+/*
+ * Reads run as DMA transfers. The command word is shifted out by the CPU (one word time),
+ * then the line turns to receive and DMA collects the data and the safety word.
+ * The DMA interrupt stops the clock when only the last word is left and releases chip select after it.
+ * A read started ahead of the motion task is consumed by it, other reads wait for their transfer
+ * with the motion task masked - interrupts above it (PWM break-in, DMA) keep running.
+ * Every read is checked against its safety word and the rejects are counted in tle5012_faults.
+ */
+#define TLE5012_RX_WORDS_MAX			4U	//burst data, safety word
+#define TLE5012_TRANSFER_TIMEOUT		400U
+
+static volatile uint16_t rxWords[TLE5012_RX_WORDS_MAX];
+static volatile uint16_t rxCount;	//data words + safety word
+static volatile bool rxLast;		//the last word is still to come - the DMA is rearmed for it
+static uint16_t rxCommand;			//part of the safety word CRC
+static volatile bool transferBusy;
+static volatile bool readAhead; //the transfer in rxWords was started for the motion task
+
+volatile TLE5012_Faults_t tle5012_faults;
+
+static uint8_t crcTable[256];
+
+static void TLE5012_CrcInit(void)
 {
-  uint16_t data;
-	
-  __disable_irq();
+  for(uint16_t i = 0; i < 256U; i++){
+    uint8_t crc = (uint8_t)i;
+    for(uint8_t bit = 0; bit < 8U; bit++){
+      crc = ((crc & 0x80U) != 0U) ? (uint8_t)((uint8_t)(crc << 1) ^ TLE5012_CRC_POLYNOMIAL) : (uint8_t)(crc << 1);
+    }
+    crcTable[i] = crc;
+  }
+}
+
+static uint8_t TLE5012_CrcWord(uint8_t crc, uint16_t word)
+{
+  crc = crcTable[crc ^ (uint8_t)(word >> 8)];
+  return crcTable[crc ^ (uint8_t)word];
+}
+
+//command phase is done by the CPU, the rest by DMA and TLE5012B_DMA_RX_IRQHandler
+static void TLE5012_StartTransfer(uint16_t command)
+{
+  transferBusy = true;
+  rxCommand = command|READ_FLAG;
+  rxCount = (command & TLE5012_ND_MASK) + 1U; //reads carry at least one data word
+  rxLast = true;
+  (void)SPI_I2S_ReceiveData(TLE5012B_SPI); //drop a word left by a late clock stop
 
   TLE5012_ACTIVE;
   SPI_RX_OFF;
   SPI_Cmd(TLE5012B_SPI, ENABLE);
-  SPI_Write(TLE5012B_SPI, command|READ_FLAG); //command write. 
+  SPI_Write(TLE5012B_SPI, rxCommand); //command write, waits until shifted out
 
-  SPI_RX_ON;
-  data = SPI_Read(TLE5012B_SPI);
-  SPI_Cmd(TLE5012B_SPI, DISABLE);//this will stop SCK right after last word is read
-  safety = SPI_Read(TLE5012B_SPI);//read last word from the buffer
-  TLE5012_INACTIVE;
-  
-	__enable_irq();
+  DMA_Cmd(TLE5012B_DMA_RX, DISABLE);
+  TLE5012B_DMA_RX->CMAR = (uint32_t)rxWords;
+  DMA_SetCurrDataCounter(TLE5012B_DMA_RX, rxCount - 1U);
+  DMA_Cmd(TLE5012B_DMA_RX, ENABLE);
+  SPI_I2S_DMACmd(TLE5012B_SPI, SPI_I2S_DMAReq_Rx, ENABLE);
+  SPI_RX_ON; //SCK starts
+}
+
+//false on timeout - rxWords are not valid
+static bool TLE5012_WaitTransfer(void)
+{
+  uint_fast16_t timeout = 0;
+  while(transferBusy)
+  {
+    ++timeout;
+    if(timeout >= TLE5012_TRANSFER_TIMEOUT){
+      DMA_Cmd(TLE5012B_DMA_RX, DISABLE);
+      SPI_I2S_DMACmd(TLE5012B_SPI, SPI_I2S_DMAReq_Rx, DISABLE);
+      SPI_Cmd(TLE5012B_SPI, DISABLE);
+      TLE5012_INACTIVE;
+      transferBusy = false;
+      return false;
+    }
+  }
+  return true;
+}
+
+void TLE5012B_DMA_RX_IRQHandler(void)
+{
+  if(DMA_GetITStatus(TLE5012B_DMA_RX_IT_TC) != RESET){
+    DMA_ClearITPendingBit(TLE5012B_DMA_RX_IT_TC);
+    DMA_Cmd(TLE5012B_DMA_RX, DISABLE);
+    if(rxLast){
+      rxLast = false;
+      SPI_Cmd(TLE5012B_SPI, DISABLE);//this will stop SCK right after the safety word
+      TLE5012B_DMA_RX->CMAR = (uint32_t)&rxWords[rxCount - 1U];
+      DMA_SetCurrDataCounter(TLE5012B_DMA_RX, 1);
+      DMA_Cmd(TLE5012B_DMA_RX, ENABLE);
+    }else{
+      TLE5012_INACTIVE;
+      SPI_I2S_DMACmd(TLE5012B_SPI, SPI_I2S_DMAReq_Rx, DISABLE);
+      transferBusy = false;
+    }
+  }
+}
+
+//waits for the transfer and checks it against its safety word
+static bool TLE5012_FinishTransfer(void)
+{
+  bool ok = false;
+  if(!TLE5012_WaitTransfer()){
+    tle5012_faults.timeout++;
+  }else{
+    uint16_t dataWords = rxCount - 1U;
+    uint16_t safety = rxWords[dataWords];
+    uint8_t crc = TLE5012_CrcWord(TLE5012_CRC_SEED, rxCommand);
+    for(uint16_t i = 0; i < dataWords; i++){
+      crc = TLE5012_CrcWord(crc, rxWords[i]);
+    }
+    if((uint8_t)~crc != (uint8_t)(safety & TLE5012_SAFETY_CRC)){
+      tle5012_faults.crc++; //the status bits are not trusted either
+    }else if((safety & TLE5012_SAFETY_INTERFACE) == 0U){
+      tle5012_faults.interface++;
+    }else if((safety & TLE5012_SAFETY_ANGLE) == 0U){
+      tle5012_faults.angle++;
+    }else{
+      ok = true;
+      if((safety & TLE5012_SAFETY_SYSTEM) == 0U){
+        tle5012_faults.system++;
+      }
+    }
+  }
+  if(ok){
+    tle5012_faults.faultsInRow = 0;
+  }else if(tle5012_faults.faultsInRow < UINT16_MAX){
+    tle5012_faults.faultsInRow++;
+  }
+  return ok;
+}
+
+//false if the read was rejected - data is 0 then
+static bool TLE5012_Read(uint16_t command, uint16_t *data)
+{
+  uint32_t basepri = __get_BASEPRI();
+  __set_BASEPRI(BASEPRI_MASK_MOTION_TASK);
 
+  (void)TLE5012_WaitTransfer(); //a read ahead may be in flight
+  readAhead = false; //rxWords is reused - the motion task reads again
+  TLE5012_StartTransfer(command);
+  bool ok = TLE5012_FinishTransfer();
+  *data = ok ? rxWords[0] : 0U;
+
+  __set_BASEPRI(basepri);
+  return ok;
+}
+
+//data word, 0 if the read was rejected
+static uint16_t TLE5012_ReadValue(uint16_t command)
+{
+  uint16_t data;
+  (void)TLE5012_Read(command, &data);
   return data;
 }
 
 //
 static void TLE5012_WriteValue(uint16_t command, uint16_t regValue)
 {
-  __disable_irq();
+  uint32_t basepri = __get_BASEPRI();
+  __set_BASEPRI(BASEPRI_MASK_MOTION_TASK);
 
+  (void)TLE5012_WaitTransfer();
+  readAhead = false;
   TLE5012_ACTIVE;
   SPI_RX_OFF;
   SPI_Cmd(TLE5012B_SPI, ENABLE);
@@ -67,7 +203,7 @@ static void TLE5012_WriteValue(uint16_t command, uint16_t regValue)
   SPI_Cmd(TLE5012B_SPI, DISABLE);
   TLE5012_INACTIVE;
 
-  __enable_irq();
+  __set_BASEPRI(basepri);
 }
 
 static bool TLE5012_WriteAndCheck(uint16_t command,uint16_t regValue)
@@ -81,6 +217,35 @@ static bool TLE5012_WriteAndCheck(uint16_t command,uint16_t regValue)
   return true;
 }
 
+//read-modify-write - the other fields hold factory trimming
+static bool TLE5012_UpdateRegister(uint16_t command, uint16_t mask, uint16_t bits)
+{
+  uint16_t regValue;
+  bool ok = TLE5012_Read(command, &regValue);
+  return ok && TLE5012_WriteAndCheck(command, (uint16_t)((regValue & (uint16_t)~mask) | (bits & mask)));
+}
+
+typedef struct {
+  uint16_t firMd;     //update rate, TLE5012_MOD1_FIR_MD
+  bool predict;       //halves the latency, amplifies the noise
+  bool spikeFilter;
+} TLE5012_Profile_t;
+
+static const TLE5012_Profile_t profiles[ENCODER_PROFILES] = {
+  [ENCODER_PROFILE_LOW_LATENCY] = {.firMd = 1U, .predict = true, .spikeFilter = false},
+  [ENCODER_PROFILE_BALANCED] = {.firMd = 2U, .predict = true, .spikeFilter = true},
+  [ENCODER_PROFILE_LOW_NOISE] = {.firMd = 3U, .predict = false, .spikeFilter = true},
+};
+
+static bool TLE5012_SetProfile(EncoderProfile_t profile)
+{
+  const TLE5012_Profile_t *p = &profiles[profile];
+  bool ok = TLE5012_UpdateRegister(WRITE_MOD1_VALUE, TLE5012_MOD1_FIR_MD, (uint16_t)(p->firMd << TLE5012_MOD1_FIR_MD_SHIFT));
+  ok = ok && TLE5012_WriteAndCheck(WRITE_MOD2_VALUE, TLE5012_MOD2_CONFIG | (p->predict ? TLE5012_MOD2_PREDICT : 0U));
+  ok = ok && TLE5012_UpdateRegister(WRITE_MOD3_VALUE, TLE5012_MOD3_SPIKEF, p->spikeFilter ? TLE5012_MOD3_SPIKEF : 0U);
+  return ok;
+}
+
 //Reads status register
 static uint16_t TLE5012_ReadState(void)
 {
@@ -95,11 +260,43 @@ uint16_t TLE5012_ReadAngle(void)
   return raw_angle;
 }
 
+//Starts reading angle, speed and revolutions in the background - from the motion task interrupts only
+void TLE5012_StartBurstRead(void)
+{
+  if(!transferBusy){
+    TLE5012_StartTransfer(READ_BURST_VALUES);
+    readAhead = true;
+  }
+}
+
+//Burst started by TLE5012_StartBurstRead(), waits for the rest of the transfer if needed
+//false if the read was rejected - the values are not valid
+bool TLE5012_FetchBurst(TLE5012_Burst_t *burst)
+{
+  bool ok;
+  if(readAhead){
+    readAhead = false;
+    ok = TLE5012_FinishTransfer();
+  }else{
+    uint32_t basepri = __get_BASEPRI();
+    __set_BASEPRI(BASEPRI_MASK_MOTION_TASK);
+    (void)TLE5012_WaitTransfer();
+    TLE5012_StartTransfer(READ_BURST_VALUES);
+    ok = TLE5012_FinishTransfer();
+    __set_BASEPRI(basepri);
+  }
+  burst->angle = rxWords[0] & DELETE_BIT_15; //0-32767
+  burst->speed = (int16_t)(uint16_t)(rxWords[1] << 1) >> 1; //sign extend bit 14
+  burst->revolutions = (int16_t)(uint16_t)(rxWords[2] << 7) >> 7; //sign extend bit 8
+  return ok;
+}
+
 
 bool TLE5012_begin(void)
 {
   bool ok = true;
 
+  TLE5012_CrcInit();
   uint16_t state=TLE5012_ReadState();// read state register
   if((state == 0U) || (state == 0xFFFFU)) {
     (void) printf("\nTLE5012 SPI comm error, state: %d\n", state);
@@ -108,9 +305,44 @@ bool TLE5012_begin(void)
     (void) printf("\nMagnet too weak or too strong, state: %d\n", state);
     ok = false;
   }else{
-    ok = ok && TLE5012_WriteAndCheck(WRITE_MOD2_VALUE, 0x804U);  //Set: ANG_Range 360 15bit, ANG_DIR: CCW, PREDICT: ON, AUTOCAL: OFF
+    ok = ok && TLE5012_SetProfile(ENCODER_PROFILE_DEFAULT);
   }
   //todo calculate CRC for crc_par register to remove S_FUSE error
   return ok;
 }
 
+//encoder interface - TLE5012 is 15bits, 32767 corresponds to 360deg
+static uint16_t TLE5012_EncoderAngle(void)
+{
+  return (uint16_t)(TLE5012_ReadAngle()<<1U); //Scale (0-32767) -> (0-65535)
+}
+
+static bool TLE5012_EncoderFetch(EncoderSample_t *sample)
+{
+  TLE5012_Burst_t burst;
+  bool ok = TLE5012_FetchBurst(&burst);
+  sample->angle = (uint16_t)(burst.angle<<1U); //Scale (0-32767) -> (0-65535)
+  sample->speed = burst.speed;
+  sample->revolutions = burst.revolutions;
+  return ok;
+}
+
+static uint16_t TLE5012_FaultsInRow(void)
+{
+  return tle5012_faults.faultsInRow;
+}
+
+const EncoderDriver_t TLE5012_driver = {
+  .name = "TLE5012",
+  .begin = TLE5012_begin,
+  .readAngle = TLE5012_EncoderAngle,
+  .startRead = TLE5012_StartBurstRead,
+  .fetch = TLE5012_EncoderFetch,
+  .faultsInRow = TLE5012_FaultsInRow,
+  .setProfile = TLE5012_SetProfile,
+  .latency_us = {
+    [ENCODER_PROFILE_LOW_LATENCY] = TLE5012_LATENCY_uS,
+    [ENCODER_PROFILE_BALANCED] = TLE5012_LATENCY_BALANCED_uS,
+    [ENCODER_PROFILE_LOW_NOISE] = TLE5012_LATENCY_LOW_NOISE_uS,
+  },
+};
@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "board.h"
+#include "encoder.h"
 
 #define SPI_RX_ON  SPI_BiDirectionalLineConfig(TLE5012B_SPI, SPI_Direction_Rx)
 #define SPI_RX_OFF   SPI_BiDirectionalLineConfig(TLE5012B_SPI, SPI_Direction_Tx)
@@ -39,17 +40,60 @@
 #define READ_STATUS				0x8001U			//00h
 #define READ_ANGLE_VALUE		0x8021U			//02h
 #define READ_SPEED_VALUE		0x8031U			//03h
+#define READ_BURST_VALUES		0x8023U			//02h-04h angle, speed, revolutions
 
-#define WRITE_MOD1_VALUE		0x5060U
-#define WRITE_MOD2_VALUE		0x5081U
-#define WRITE_MOD3_VALUE		0x5091U
-#define WRITE_MOD4_VALUE		0x50E0U
-#define WRITE_IFAB_VALUE		0x50B1U
+//configuration registers - lock 1010b, one data word
+#define WRITE_MOD1_VALUE		0x5061U			//06h
+#define WRITE_MOD2_VALUE		0x5081U			//08h
+#define WRITE_MOD3_VALUE		0x5091U			//09h
+#define WRITE_IFAB_VALUE		0x50D1U			//0Dh
+#define WRITE_MOD4_VALUE		0x50E1U			//0Eh
+
+#define TLE5012_MOD1_FIR_MD			0xC000U		//update rate: 1 - 42.7us, 2 - 85.3us, 3 - 170.6us
+#define TLE5012_MOD1_FIR_MD_SHIFT	14U
+#define TLE5012_MOD2_CONFIG			0x0800U		//ANG_RANGE 360 15bit, ANG_DIR: CCW, AUTOCAL: OFF
+#define TLE5012_MOD2_PREDICT		0x0004U		//angle extrapolated by one update
+#define TLE5012_MOD3_SPIKEF			0x0008U		//analog spike filter
 
 #define READ_FLAG   0x8000U
+//time between sampling and reading the angle - 1.5 updates with prediction, 2.5 without
+#define TLE5012_LATENCY_uS				64U		//42.7us update, prediction
+#define TLE5012_LATENCY_BALANCED_uS		128U	//85.3us update, prediction
+#define TLE5012_LATENCY_LOW_NOISE_uS	427U	//170.6us update
+#define TLE5012_ND_MASK		0x000FU		//number of data words of a command
+
+//safety word - status bits are cleared on error
+#define TLE5012_SAFETY_SYSTEM		0x4000U		//S_VR, S_DSPU, S_OV, S_XYOL, S_MAGOL, S_FUSE, S_ROM, S_ADCT
+#define TLE5012_SAFETY_INTERFACE	0x2000U		//interface access error
+#define TLE5012_SAFETY_ANGLE		0x1000U		//invalid angle value
+#define TLE5012_SAFETY_CRC			0x00FFU
+#define TLE5012_CRC_POLYNOMIAL		0x1DU		//X8+X4+X3+X2+1 J1850
+#define TLE5012_CRC_SEED			0xFFU
+
+typedef struct {
+	uint16_t angle;			//0-32767
+	int16_t speed;			//ASPD, 15bit signed
+	int16_t revolutions;	//REVOL, 9bit signed
+} TLE5012_Burst_t;
+
+//rejected reads by cause - the controller acts on faultsInRow
+typedef struct {
+	uint32_t crc;			//safety word CRC mismatch
+	uint32_t interface;		//interface access error
+	uint32_t angle;			//invalid angle value
+	uint32_t timeout;		//transfer did not complete
+	uint32_t system;		//system error bit - counted only, S_FUSE stays set after the configuration writes
+	uint16_t faultsInRow;	//rejected reads since the last good one
+} TLE5012_Faults_t;
+
+extern volatile TLE5012_Faults_t tle5012_faults;
 
 bool TLE5012_begin(void);
 uint16_t TLE5012_ReadAngle(void);
+void TLE5012_StartBurstRead(void);
+bool TLE5012_FetchBurst(TLE5012_Burst_t *burst);
+
+extern const EncoderDriver_t TLE5012_driver;
 
 
 // Values used to calculate 15 bit signed int sent by the sensor
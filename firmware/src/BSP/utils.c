@@ -12,4 +12,24 @@ uint32_t fastAbs(int32_t val)
     u_abs_value &= ~(mask & (u_abs_value >> (UINT32_BIT_SIZE - 1U)));
 
     return u_abs_value;
-}
\ No newline at end of file
+}
+
+//bitwise integer square root - 16 iterations
+uint16_t isqrt32(uint32_t x)
+{
+	uint32_t res = 0;
+	uint32_t bit = (uint32_t)1U << 30U;
+	while (bit > x){
+		bit >>= 2U;
+	}
+	while (bit != 0U){
+		if (x >= (res + bit)){
+			x -= res + bit;
+			res = (res >> 1U) + bit;
+		}else{
+			res >>= 1U;
+		}
+		bit >>= 2U;
+	}
+	return (uint16_t)res;
+}
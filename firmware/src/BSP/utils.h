@@ -30,11 +30,13 @@ __extension__ ({\
   })
 
 uint32_t fastAbs(int32_t v);
+uint16_t isqrt32(uint32_t x);
 
 #define PI_X1024 3217U
 #define TWO_PI_X1024 6434U
 
 #define Ohm_to_mOhm 1000
 #define H_to_uH 1000000
+#define A_to_mA 1000
 
 #endif // UTILS_H
@@ -94,7 +94,7 @@ int Msg_steering_command_unpack(
 
     dst_p->checksum = unpack_right_shift_u8(src_p[0], 0u, 0xffu);
     dst_p->counter = unpack_right_shift_u8(src_p[1], 0u, 0x0fu);
-    dst_p->steer_mode = unpack_right_shift_u8(src_p[1], 4u, 0x30u);
+    dst_p->steer_mode = unpack_right_shift_u8(src_p[1], 4u, 0x70u);
     steer_angle = unpack_right_shift_u16(src_p[2], 0u, 0xffu);
     steer_angle |= unpack_left_shift_u16(src_p[3], 8u, 0xffu);
     dst_p->steer_angle = (int16_t)steer_angle;
@@ -133,7 +133,7 @@ float Msg_steering_command_steer_mode_decode(uint8_t value)
 
 bool Msg_steering_command_steer_mode_is_in_range(uint8_t value)
 {
-    return (value <= 3u);
+    return (value <= 7u);
 }
 
 float Msg_steering_command_steer_angle_decode(int16_t value)
@@ -283,3 +283,60 @@ bool Msg_steering_status_debug_states_is_in_range(uint8_t value)
 
     return (true);
 }
+
+int Msg_steering_load_pack(
+    uint8_t *dst_p,
+    const struct Msg_steering_load_t *src_p,
+    size_t size)
+{
+    uint16_t load_torque;
+
+    if (size < 4u) {
+        return (-EINVAL);
+    }
+
+    memset(&dst_p[0], 0, 4);
+
+    dst_p[0] |= pack_left_shift_u8(src_p->checksum, 0u, 0xffu);
+    dst_p[1] |= pack_left_shift_u8(src_p->counter, 0u, 0x0fu);
+    load_torque = (uint16_t)src_p->load_torque;
+    dst_p[2] |= pack_left_shift_u16(load_torque, 0u, 0xffu);
+    dst_p[3] |= pack_right_shift_u16(load_torque, 8u, 0xffu);
+
+    return (4);
+}
+
+
+uint8_t Msg_steering_load_checksum_encode(float value)
+{
+    return (uint8_t)(value);
+}
+
+bool Msg_steering_load_checksum_is_in_range(uint8_t value)
+{
+    (void)value;
+
+    return (true);
+}
+
+uint8_t Msg_steering_load_counter_encode(float value)
+{
+    return (uint8_t)(value);
+}
+
+bool Msg_steering_load_counter_is_in_range(uint8_t value)
+{
+    return (value <= 15u);
+}
+
+int16_t Msg_steering_load_load_torque_encode(float value)
+{
+    return (int16_t)(value / 0.01f);
+}
+
+bool Msg_steering_load_load_torque_is_in_range(int16_t value)
+{
+    (void)value;
+
+    return (true);
+}
@@ -46,14 +46,17 @@ extern "C" {
 /* Frame ids. */
 #define MSG_STEERING_COMMAND_FRAME_ID (0x22eu)
 #define MSG_STEERING_STATUS_FRAME_ID (0x22fu)
+#define MSG_STEERING_LOAD_FRAME_ID (0x230u)
 
 /* Frame lengths in bytes. */
 #define MSG_STEERING_COMMAND_LENGTH (5u)
 #define MSG_STEERING_STATUS_LENGTH (8u)
+#define MSG_STEERING_LOAD_LENGTH (4u)
 
 /* Extended or standard frame types. */
 #define MSG_STEERING_COMMAND_IS_EXTENDED (0)
 #define MSG_STEERING_STATUS_IS_EXTENDED (0)
+#define MSG_STEERING_LOAD_IS_EXTENDED (0)
 
 /* Frame cycle times in milliseconds. */
 
@@ -63,6 +66,7 @@ extern "C" {
 #define MSG_STEERING_COMMAND_STEER_MODE_TORQUE_CONTROL_CHOICE (1u)
 #define MSG_STEERING_COMMAND_STEER_MODE_ANGLE_CONTROL_CHOICE (2u)
 #define MSG_STEERING_COMMAND_STEER_MODE_SOFT_OFF_CHOICE (3u)
+#define MSG_STEERING_COMMAND_STEER_MODE_VELOCITY_CONTROL_CHOICE (4u)
 
 /**
  * Signals in message STEERING_COMMAND.
@@ -94,9 +98,10 @@ struct Msg_steering_command_t {
      * TorqueControl - use steer_torque,
      * AngleControl - use steer_angle as relative target and steer_torque as feedforward
      * SoftOff - ramp torque to 0 in 1s,
+     * VelocityControl - use steer_angle as velocity target [deg/s] and steer_torque as feedforward,
      * Command Off after SoftOff to re-enable control.
      *
-     * Range: 0..3 (0..3 -)
+     * Range: 0..7 (0..7 -)
      * Scale: 1
      * Offset: 0
      */
@@ -200,6 +205,40 @@ struct Msg_steering_status_t {
     uint8_t debug_states;
 };
 
+/**
+ * Signals in message STEERING_LOAD.
+ *
+ * All signal values are as on the CAN bus.
+ */
+struct Msg_steering_load_t {
+    /**
+     * 8bit sum of all bytes and message id
+     *
+     * Range: 0..255 (0..255 -)
+     * Scale: 1
+     * Offset: 0
+     */
+    uint8_t checksum;
+
+    /**
+     * Rolling counter
+     *
+     * Range: 0..15 (0..15 -)
+     * Scale: 1
+     * Offset: 0
+     */
+    uint8_t counter;
+
+    /**
+     * External (driver) torque at the steering estimated by the disturbance observer
+     *
+     * Range: -32768..32767 (-327.68..327.67 Nm)
+     * Scale: 0.01
+     * Offset: 0
+     */
+    int16_t load_torque;
+};
+
 /**
  * Unpack message STEERING_COMMAND.
  *
@@ -463,6 +502,75 @@ uint8_t Msg_steering_status_debug_states_encode(float value);
  */
 bool Msg_steering_status_debug_states_is_in_range(uint8_t value);
 
+/**
+ * Pack message STEERING_LOAD.
+ *
+ * @param[out] dst_p Buffer to pack the message into.
+ * @param[in] src_p Data to pack.
+ * @param[in] size Size of dst_p.
+ *
+ * @return Size of packed data, or negative error code.
+ */
+int Msg_steering_load_pack(
+    uint8_t *dst_p,
+    const struct Msg_steering_load_t *src_p,
+    size_t size);
+
+
+/**
+ * Encode given signal by applying scaling and offset.
+ *
+ * @param[in] value Signal to encode.
+ *
+ * @return Encoded signal.
+ */
+uint8_t Msg_steering_load_checksum_encode(float value);
+
+/**
+ * Check that given signal is in allowed range.
+ *
+ * @param[in] value Signal to check.
+ *
+ * @return true if in range, false otherwise.
+ */
+bool Msg_steering_load_checksum_is_in_range(uint8_t value);
+
+/**
+ * Encode given signal by applying scaling and offset.
+ *
+ * @param[in] value Signal to encode.
+ *
+ * @return Encoded signal.
+ */
+uint8_t Msg_steering_load_counter_encode(float value);
+
+/**
+ * Check that given signal is in allowed range.
+ *
+ * @param[in] value Signal to check.
+ *
+ * @return true if in range, false otherwise.
+ */
+bool Msg_steering_load_counter_is_in_range(uint8_t value);
+
+/**
+ * Encode given signal by applying scaling and offset.
+ *
+ * @param[in] value Signal to encode.
+ *
+ * @return Encoded signal.
+ */
+int16_t Msg_steering_load_load_torque_encode(float value);
+
+/**
+ * Check that given signal is in allowed range.
+ *
+ * @param[in] value Signal to check.
+ *
+ * @return true if in range, false otherwise.
+ */
+bool Msg_steering_load_load_torque_is_in_range(int16_t value);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,170 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Host replacement of board.c and delay.c.
+	ADC readings come from the plant model, task timers are driven by the simulation engine.
+*/
+
+#include "board.h"
+#include "delay.h"
+#include "sim.h"
+#include "A4950.h"
+#include "utils.h"
+#include <math.h>
+#include <stddef.h>
+
+volatile uint16_t motion_task_period_us = 0;
+volatile bool service_task_enabled = false;
+uint16_t pwm_tim_max = 0;
+
+const EncoderDriver_t *const boardEncoders[] = {&EncoderMock_driver, NULL};
+
+void board_init(void){
+	//A4950_init() timer setup relevant to the plant
+	TIM_SetAutoreload(VREF_TIM, VREF_TIM_MAX);
+}
+
+bool F1_button_state(void){
+	return false;
+}
+
+bool F2_button_state(void){
+	return false;
+}
+
+void Set_Error_LED(bool state){
+	(void) state;
+}
+
+void Set_Func_LED(bool state){
+	(void) state;
+}
+
+static uint16_t lssA_mA;
+static uint16_t lssB_mA;
+
+//LSS at the center of the drive pulse - the bridge current flows through the sense resistor only while driving,
+//in the drive direction. The pulse has to cover the 13.5 cycles sampling, the regulator chops it above the limit.
+static uint16_t lss_sample(float i, float in_p, float in_n, float ilim){
+	float drive = in_p - in_n; //fraction of the period, signed by the direction
+	float sample_us = 1.3f;
+	if ((fabsf(drive) * (float)motion_task_period_us / 2.0f) < sample_us){
+		return 0U; //brake
+	}
+	float i_drive = (drive > 0.0f) ? i : -i;
+	if ((i_drive <= 0.0f) || (i_drive >= ilim)){
+		return 0U;
+	}
+	return (uint16_t)(i_drive * (float)A_to_mA);
+}
+
+void Sim_sampleLSS(bool bridgeA){
+	PlantDrive_t drive;
+	Sim_getDrive(&drive);
+	if (!drive.outputs_enabled){
+		lssA_mA = 0U;
+		lssB_mA = 0U;
+	}else if (bridgeA){
+		lssA_mA = lss_sample(simPlant.s.i_a, drive.in1, drive.in2, simPlant.s.ilim_a);
+	}else{
+		lssB_mA = lss_sample(simPlant.s.i_b, drive.in3, drive.in4, simPlant.s.ilim_b);
+	}
+}
+
+float GetVDDA(void){
+	return 3.3f;
+}
+
+uint16_t GetMcuVoltage_mV(void){
+	return 3300U;
+}
+
+float GetChipTemp(void){
+	return 25.0f;
+}
+
+//continuously scanned on the target
+uint16_t GetMotorVoltage_mV(void){
+	return (uint16_t)(simPlant.p.v_bus * (float)V_TO_mV);
+}
+
+float GetMotorVoltage(void){
+	return (float)GetMotorVoltage_mV() / (float)V_TO_mV;
+}
+
+float GetSupplyVoltage(void){
+	return GetMotorVoltage();
+}
+
+uint16_t GetSupplyVoltage_mV(void){
+	return GetMotorVoltage_mV();
+}
+
+uint16_t Get_PhaseA_Current_mA(void){
+	return lssA_mA;
+}
+
+uint16_t Get_PhaseB_Current_mA(void){
+	return lssB_mA;
+}
+
+float Get_PhaseA_Current(void){
+	return (float)lssA_mA / (float)A_to_mA;
+}
+
+float Get_PhaseB_Current(void){
+	return (float)lssB_mA / (float)A_to_mA;
+}
+
+void Motion_task_init(uint16_t taskPeriod){
+	motion_task_period_us = taskPeriod;
+	pwm_tim_max = (uint16_t)(64U * taskPeriod / 2U); //PWM_TIM period is the task period at 64MHz
+	TIM_SetAutoreload(PWM_TIM, pwm_tim_max);
+}
+
+void Serivice_task_init(void){
+	service_task_enabled = true;
+}
+
+volatile bool motion_task_isr_enabled = false;
+
+void Motion_task_enable(void){
+	motion_task_isr_enabled = true;
+}
+
+void Motion_task_disable(void){
+	motion_task_isr_enabled = false;
+}
+
+volatile bool motion_task_overrun;
+volatile uint32_t motion_task_overrun_count;
+volatile uint16_t motion_task_execution_us;
+
+volatile bool service_task_overrun;
+volatile uint32_t service_task_overrun_count;
+volatile uint16_t service_task_execution_us;
+
+void delay_us(uint32_t us){
+	Sim_advance_us(us);
+}
+
+void delay_ms(uint32_t ms){
+	Sim_advance_us(ms * 1000U);
+}
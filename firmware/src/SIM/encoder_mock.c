@@ -0,0 +1,125 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+//Host angle sensor driver - sampled from the plant model, or replayed from a recorded trace
+#include "sim.h"
+#include "encoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//nominal latencies of the TLE5012 profiles it stands in for - the plant sensor keeps its own latency
+#define ENCODER_MOCK_LATENCY_uS				64U
+#define ENCODER_MOCK_LATENCY_BALANCED_uS	128U
+#define ENCODER_MOCK_LATENCY_LOW_NOISE_uS	427U
+
+uint32_t encoderMockRejected = 0;
+static uint16_t faultsInRow;
+static uint32_t fault_seed = 12345U;
+
+static uint16_t *trace = NULL;
+static uint32_t trace_len = 0;
+static uint32_t trace_pos = 0;
+
+//text file, one angle (0-65535) per line, '#' starts a comment line - replayed in a loop, one sample per read
+bool EncoderMock_loadTrace(const char *path){
+	FILE *f = fopen(path, "r");
+	if (f == NULL){
+		return false;
+	}
+	uint32_t size = 0;
+	char line[64];
+	while (fgets(line, (int)sizeof(line), f) != NULL){
+		if ((line[0] == '#') || (line[0] == '\n')){
+			continue;
+		}
+		if (trace_len == size){
+			size = (size == 0U) ? 1024U : (size * 2U);
+			trace = realloc(trace, size * sizeof(uint16_t));
+		}
+		trace[trace_len++] = (uint16_t)strtoul(line, NULL, 0);
+	}
+	(void)fclose(f);
+	trace_pos = 0;
+	return trace_len > 0U;
+}
+
+static uint16_t EncoderMock_angle(void){
+	uint16_t angle;
+	if (trace_len > 0U){
+		angle = trace[trace_pos];
+		trace_pos = (trace_pos + 1U) % trace_len;
+	}else{
+		angle = (uint16_t)(Plant_sensorAngle(&simPlant) << 1U); //15bit like the TLE5012
+	}
+	return angle;
+}
+
+//the read ahead samples the plant when the transfer would start
+static uint16_t readAheadAngle;
+static bool readAhead;
+
+static bool EncoderMock_begin(void){
+	return true;
+}
+
+static void EncoderMock_startRead(void){
+	readAheadAngle = EncoderMock_angle();
+	readAhead = true;
+}
+
+static bool EncoderMock_fetch(EncoderSample_t *sample){
+	if (readAhead){
+		readAhead = false;
+		sample->angle = readAheadAngle;
+	}else{
+		sample->angle = EncoderMock_angle();
+	}
+	sample->speed = 0;		//not modelled
+	sample->revolutions = 0;
+
+	fault_seed = (fault_seed * 1103515245U) + 12345U;
+	bool ok = ((float)(fault_seed >> 8) / (float)(1U << 24)) >= simPlant.p.sensor_fault_rate;
+	if (ok){
+		faultsInRow = 0;
+	}else{
+		encoderMockRejected++;
+		faultsInRow++;
+		sample->angle = (uint16_t)(fault_seed >> 8); //corrupted word
+	}
+	return ok;
+}
+
+static uint16_t EncoderMock_faultsInRow(void){
+	return faultsInRow;
+}
+
+static bool EncoderMock_setProfile(EncoderProfile_t profile){
+	(void)profile;
+	return true;
+}
+
+const EncoderDriver_t EncoderMock_driver = {
+	.name = "mock",
+	.begin = EncoderMock_begin,
+	.readAngle = EncoderMock_angle,
+	.startRead = EncoderMock_startRead,
+	.fetch = EncoderMock_fetch,
+	.faultsInRow = EncoderMock_faultsInRow,
+	.setProfile = EncoderMock_setProfile,
+	.latency_us = {ENCODER_MOCK_LATENCY_uS, ENCODER_MOCK_LATENCY_BALANCED_uS, ENCODER_MOCK_LATENCY_LOW_NOISE_uS},
+};
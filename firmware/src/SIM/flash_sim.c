@@ -0,0 +1,100 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Host replacement of flash.c.
+	The firmware addresses flash pages through absolute addresses (nvmFlashCalData, NVM_startAddress),
+	so the emulated flash is mapped at the same address as on the STM32F103.
+*/
+
+#define _GNU_SOURCE
+#include "flash.h"
+#include "sim.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SIM_FLASH_BASE		0x08000000U
+#define SIM_FLASH_SIZE		0x10000U
+#define SIM_NVM_ADDR		FLASH_PAGE62_ADDR
+#define SIM_NVM_SIZE		(2U * FLASH_PAGE_SIZE) //parameters and calibration pages
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+
+static volatile uint16_t *flash_ptr(uint32_t address){
+	return (volatile uint16_t *)(uintptr_t)address;
+}
+
+bool Sim_flash_begin(const char *image_path){
+	void *flash = mmap((void *)(uintptr_t)SIM_FLASH_BASE, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (flash != (void *)(uintptr_t)SIM_FLASH_BASE){
+		(void) printf("Cannot map emulated flash at 0x%08X\n", SIM_FLASH_BASE);
+		return false;
+	}
+	(void) memset(flash, 0xFF, SIM_FLASH_SIZE); //erased state
+
+	if (image_path != NULL){
+		FILE *f = fopen(image_path, "rb");
+		if (f != NULL){
+			size_t n = fread((void *)(uintptr_t)SIM_NVM_ADDR, 1, SIM_NVM_SIZE, f);
+			(void) fclose(f);
+			(void) printf("Loaded %u bytes of parameters and calibration from %s\n", (unsigned)n, image_path);
+		}
+	}
+	return true;
+}
+
+bool Sim_flash_save(const char *image_path){
+	FILE *f = fopen(image_path, "wb");
+	if (f == NULL){
+		return false;
+	}
+	size_t n = fwrite((void *)(uintptr_t)SIM_NVM_ADDR, 1, SIM_NVM_SIZE, f);
+	(void) fclose(f);
+	return n == SIM_NVM_SIZE;
+}
+
+void Flash_ProgramPage(uint32_t flashAddr, uint16_t* ptrData, uint16_t size){
+	uint32_t page = flashAddr & ~(FLASH_PAGE_SIZE - 1U);
+	for (uint32_t i = 0; i < FLASH_PAGE_SIZE; i += 2U){
+		*flash_ptr(page + i) = 0xFFFFU;
+	}
+	Flash_ProgramSize(flashAddr, ptrData, size);
+}
+
+//halfword programming only succeeds on erased cells (or when writing zero) - as on the STM32F1
+void Flash_ProgramSize(uint32_t flashAddr, uint16_t* ptrData, uint16_t size){
+	for (uint32_t i = 0; i < size; i++){
+		volatile uint16_t *cell = flash_ptr(flashAddr + (i * 2U));
+		if ((*cell == 0xFFFFU) || (ptrData[i] == 0U)){
+			*cell = ptrData[i];
+		}
+	}
+}
+
+uint16_t Flash_readHalfWord(uint32_t address){
+	return *flash_ptr(address);
+}
+
+uint32_t Flash_readWord(uint32_t address){
+	return *(volatile uint32_t *)(uintptr_t)address;
+}
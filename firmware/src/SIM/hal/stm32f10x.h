@@ -0,0 +1,118 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Thin host replacement of the CMSIS device header for the native simulation build.
+	Only the registers and Standard Peripheral Library calls that the control stack
+	touches are provided. Writes land in plain RAM structures that the plant model reads.
+*/
+
+#ifndef __STM32F10x_H
+#define __STM32F10x_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#define __IO volatile
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+typedef struct
+{
+  __IO uint32_t CRL;
+  __IO uint32_t CRH;
+  __IO uint32_t IDR;
+  __IO uint32_t ODR;
+  __IO uint32_t BSRR;
+  __IO uint32_t BRR;
+  __IO uint32_t LCKR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+  __IO uint16_t CNT;
+  __IO uint16_t ARR;
+  __IO uint16_t CCR1;
+  __IO uint16_t CCR2;
+  __IO uint16_t CCR3;
+  __IO uint16_t CCR4;
+  __IO uint16_t BDTR;
+} TIM_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t DR;
+} ADC_TypeDef;
+
+typedef struct
+{
+  __IO uint16_t DR;
+} SPI_TypeDef;
+
+extern GPIO_TypeDef SIM_GPIOA;
+extern GPIO_TypeDef SIM_GPIOB;
+extern GPIO_TypeDef SIM_GPIOC;
+extern TIM_TypeDef SIM_TIM1;
+extern TIM_TypeDef SIM_TIM2;
+extern TIM_TypeDef SIM_TIM3;
+extern TIM_TypeDef SIM_TIM4;
+extern ADC_TypeDef SIM_ADC1;
+extern SPI_TypeDef SIM_SPI2;
+
+#define GPIOA   (&SIM_GPIOA)
+#define GPIOB   (&SIM_GPIOB)
+#define GPIOC   (&SIM_GPIOC)
+#define TIM1    (&SIM_TIM1)
+#define TIM2    (&SIM_TIM2)
+#define TIM3    (&SIM_TIM3)
+#define TIM4    (&SIM_TIM4)
+#define ADC1    (&SIM_ADC1)
+#define SPI2    (&SIM_SPI2)
+
+#define GPIO_Pin_0                 ((uint16_t)0x0001)
+#define GPIO_Pin_1                 ((uint16_t)0x0002)
+#define GPIO_Pin_2                 ((uint16_t)0x0004)
+#define GPIO_Pin_3                 ((uint16_t)0x0008)
+#define GPIO_Pin_4                 ((uint16_t)0x0010)
+#define GPIO_Pin_5                 ((uint16_t)0x0020)
+#define GPIO_Pin_6                 ((uint16_t)0x0040)
+#define GPIO_Pin_7                 ((uint16_t)0x0080)
+#define GPIO_Pin_8                 ((uint16_t)0x0100)
+#define GPIO_Pin_9                 ((uint16_t)0x0200)
+#define GPIO_Pin_10                ((uint16_t)0x0400)
+#define GPIO_Pin_11                ((uint16_t)0x0800)
+#define GPIO_Pin_12                ((uint16_t)0x1000)
+#define GPIO_Pin_13                ((uint16_t)0x2000)
+#define GPIO_Pin_14                ((uint16_t)0x4000)
+#define GPIO_Pin_15                ((uint16_t)0x8000)
+
+#define TIM_BDTR_MOE               ((uint16_t)0x8000)
+
+//stm32f10x_tim.h subset
+void TIM_SetAutoreload(TIM_TypeDef* TIMx, uint16_t Autoreload);
+void TIM_SetCompare1(TIM_TypeDef* TIMx, uint16_t Compare1);
+void TIM_SetCompare2(TIM_TypeDef* TIMx, uint16_t Compare2);
+void TIM_SetCompare3(TIM_TypeDef* TIMx, uint16_t Compare3);
+void TIM_SetCompare4(TIM_TypeDef* TIMx, uint16_t Compare4);
+void TIM_CtrlPWMOutputs(TIM_TypeDef* TIMx, FunctionalState NewState);
+uint16_t TIM_GetCounter(TIM_TypeDef* TIMx);
+
+#endif
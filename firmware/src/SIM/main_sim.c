@@ -0,0 +1,702 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Native software-in-the-loop entry point - replaces APP/main.c.
+	Runs the unmodified control stack against the plant model and prints closed loop metrics.
+	Commands are applied at the CAN rate (10ms) through control_api, the same way can.c does.
+
+	Usage: program [step|sine|torque|velocity] [--time s] [--amp deg] [--freq Hz] [--torque Nm] [--speed deg/s]
+	               [--load Nm] [--load-time s] [--cascade] [--estimators] [--autotune] [--anticogging] [--friction] [--harmonics K] [--continuous-cal] [--refine] [--hysteresis deg] [--sensor-faults rate] [--sensor-latency us] [--sensor-profile n] [--identify-latency] [--encoder-trace file] [--vbus V] [--field-weakening mA] [--overmodulation %] [--ripple-3rd n] [--ripple-5th n] [--dead-time ns] [--seed n] [--flash file] [--csv file] [--decimate n]
+
+	--estimators compares the speed estimators (speed_iir and the observer) against the plant speed:
+	lag is the shift with the best cross correlation, noise is the rms error left after removing the lag.
+	--autotune runs the relay autotuner (autotune.c) before the scenario, so the scenario uses the tuned pPID.
+	--anticogging learns the cogging map (anticogging.c) before the scenario.
+	--friction identifies the friction model (friction.c) before the scenario, which enables the friction feedforward.
+	--harmonics stores a new encoder calibration as K harmonics instead of the point table (calibration_harmonics).
+	--continuous-cal calibrates the encoder with the continuous sweep instead of stepping (calibration_continuous).
+	--refine refines the calibration table online during the scenario (calibration_refine), the main loop runs every 10ms.
+	The refined table is stored after the scenario, with the motor off.
+	--hysteresis sets the magnetic hysteresis of the angle sensor - difference between the directions, motor shaft degrees.
+	--sensor-faults rejects this fraction of the angle sensor reads, as a safety word CRC error would.
+	--sensor-latency sets the time between sampling and reading the plant angle sensor.
+	--sensor-profile configures the sensor filter profile (sensor_profile) - the plant keeps its latency, the firmware assumes the nominal one of a changed profile.
+	--identify-latency identifies the sensor latency (Identify_sensor_latency) before the scenario, with the current motor_k_bemf.
+	--field-weakening sets the d current budget of field weakening (field_weakening_current), 0 disables it.
+	--overmodulation sets the voltage vector limit in % of the bus voltage (overmodulation), 100 keeps sine waves.
+	--ripple-3rd and --ripple-5th set the harmonic profile of the commutation (anticogging_factor, anticogging_factor_5th), -128-127 for -1/8-1/8.
+	--dead-time sets the crossover delay of the plant bridges.
+	Torque and velocity scenarios report the steady state over the last second: speed, torque and voltage utilisation -
+	the fundamental of the phase voltages relative to the bus voltage.
+	--encoder-trace replays recorded angles (0-65535, one per line) instead of sampling the plant - the loop is open.
+	The encoder map error is the calibration table against the plant angle, noise and hysteresis free, without the mean.
+	The sensor error is currentLocation against the plant angle during the scenario, without the mean.
+*/
+
+#include "main.h"
+#include "sim.h"
+#include "board.h"
+#include "stepper_controller.h"
+#include "control_api.h"
+#include "calibration.h"
+#include "calibration_lookup.h"
+#include "nonvolatile.h"
+#include "actuator_config.h"
+#include "encoder.h"
+#include "observer.h"
+#include "autotune.h"
+#include "anticogging.h"
+#include "friction.h"
+#include "delay.h"
+#include "utils.h"
+#include "Msg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define SIM_TORQUE_CL_MAX 2.0f //Nm - actuator side close loop torque limit as sent by openpilot
+#define SIM_STEP_TIME 0.1f //s - step is applied after holding the initial position
+#define SIM_SETTLE_TIME 0.2f //s - sine tracking metrics skip the engagement transient
+#define SIM_STEADY_TIME 1.0f //s - steady state metrics of torque and velocity average the end of the scenario
+
+typedef enum {
+	SCENARIO_STEP = 0,
+	SCENARIO_SINE = 1,
+	SCENARIO_TORQUE = 2,
+	SCENARIO_VELOCITY = 3,
+} Scenario_t;
+
+typedef struct {
+	Scenario_t scenario;
+	float time;			//s - duration after initialization
+	float amp;			//deg - actuator step or sine amplitude
+	float freq;			//Hz - sine frequency
+	float torque;		//Nm - actuator torque command
+	float speed;		//deg/s - actuator velocity command
+	float load;			//Nm - external load torque
+	float load_time;	//s - when the load is applied
+	bool cascade;		//position control with the velocity cascade
+	bool estimators;	//speed estimators benchmark
+	bool autotune;		//relay autotune of the position PID
+	bool anticogging;	//cogging map calibration
+	bool friction;		//friction identification
+	int8_t sensor_profile;	//EncoderProfile_t, negative keeps the configured one
+	bool latency;		//sensor latency identification
+	uint8_t harmonics;	//encoder calibration harmonics, 0 keeps the point table
+	bool continuous_cal;	//continuous encoder calibration sweep
+	bool refine;		//online calibration refinement
+	uint32_t seed;		//sensor noise seed, 0 keeps the default
+	const char *csv;
+	const char *flash;
+	const char *encoder_trace;	//recorded angles replayed during the scenario
+	uint32_t decimate;	//csv decimation in motion task samples
+} SimArgs_t;
+
+static SimArgs_t args = {
+	.scenario = SCENARIO_STEP,
+	.time = 2.0f,
+	.amp = 10.0f,
+	.freq = 1.0f,
+	.torque = 1.0f,
+	.speed = 90.0f,
+	.load = 0.0f,
+	.load_time = 0.0f,
+	.sensor_profile = -1,
+	.cascade = false,
+	.estimators = false,
+	.autotune = false,
+	.anticogging = false,
+	.friction = false,
+	.seed = 0U,
+	.csv = NULL,
+	.flash = NULL,
+	.encoder_trace = NULL,
+	.decimate = 25U,
+};
+
+static FILE *csv_file = NULL;
+
+//command generator state - written from Service_task like can.c would
+static bool scenario_active = false;
+static uint64_t scenario_start_us;
+static float angle_base;
+static float angle_cmd;
+static float torque_cmd;
+
+//metrics accumulated in Motion_task
+typedef struct {
+	uint32_t samples;
+	uint32_t err_samples;
+	double err_sum;
+	double err_sq_sum;
+	double iae;
+	float err_max;
+	float current_peak;
+	double speed_sum;
+	double speed_sq_sum;
+	double tq_sum;
+	double tq_sq_sum;
+	float tq_min;
+	float tq_max;
+	uint32_t load_samples;	//load torque estimate after the load is applied
+	double load_sum;
+	double load_sq_sum;
+	float load_detect_time;	//s - until the estimate reaches 90% of the load
+	double sensor_sum;		//motor shaft deg
+	double sensor_sq_sum;
+	uint32_t steady_samples;	//last SIM_STEADY_TIME
+	double steady_speed_sum;
+	double steady_tq_sum;
+	double steady_uq_sum;	//phase voltage in the back EMF direction, fraction of the bus voltage
+	double steady_ud_sum;
+} SimMetrics_t;
+
+static SimMetrics_t metrics;
+
+//step response trace - actuator angle relative to the base
+#define STEP_TRACE_LEN	(32U * 1024U)
+static float step_trace[STEP_TRACE_LEN];
+static uint32_t step_trace_len = 0;
+
+//speed estimators traces - rev/s of the motor shaft
+typedef enum {
+	EST_PLANT = 0,
+	EST_IIR = 1,
+	EST_OBSERVER = 2,
+	EST_COUNT = 3,
+} Estimator_t;
+#define EST_TRACE_LEN	(64U * 1024U)
+#define EST_MAX_LAG		100		//ticks
+static float est_trace[EST_COUNT][EST_TRACE_LEN];
+static uint32_t est_trace_len = 0;
+
+
+volatile stepCtrlError_t stepCtrlError = STEPCTRL_NO_POWER;
+volatile uint32_t can_err_rx_cnt = 0;
+
+static float scenario_time(void){
+	return (float)(sim_time_us - scenario_start_us) * 1e-6f;
+}
+
+//continuous reference - sampled by the CAN rate commands
+static float scenario_reference(float t){
+	switch (args.scenario){
+		case SCENARIO_STEP:
+			return angle_base + ((t >= SIM_STEP_TIME) ? args.amp : 0.0f);
+		case SCENARIO_SINE:
+			return angle_base + (args.amp * sinf(2.0f * (float)M_PI * args.freq * t));
+		default:
+			return 0.0f;
+	}
+}
+
+static uint8_t scenario_mode(void){
+	switch (args.scenario){
+		case SCENARIO_TORQUE:
+			return MSG_STEERING_COMMAND_STEER_MODE_TORQUE_CONTROL_CHOICE;
+		case SCENARIO_VELOCITY:
+			return MSG_STEERING_COMMAND_STEER_MODE_VELOCITY_CONTROL_CHOICE;
+		default:
+			return MSG_STEERING_COMMAND_STEER_MODE_ANGLE_CONTROL_CHOICE;
+	}
+}
+
+static void Scenario_command(void){
+	angle_cmd = scenario_reference(scenario_time());
+	torque_cmd = (args.scenario == SCENARIO_TORQUE) ? args.torque : 0.0f;
+	if (args.scenario == SCENARIO_VELOCITY){
+		StepperCtrl_setDesiredVelocity(args.speed);
+	}else{
+		StepperCtrl_setDesiredAngle(angle_cmd);
+	}
+	StepperCtrl_setFeedForwardTorque(torque_cmd);
+	StepperCtrl_setCloseLoopTorque(SIM_TORQUE_CL_MAX);
+	StepperCtrl_setControlMode(scenario_mode());
+}
+
+static void Scenario_record(void){
+	float t = scenario_time();
+	float angle = StepperCtrl_getAngleFromEncoder();
+	float err = scenario_reference(t) - angle;
+	float current = fmaxf(fabsf(simPlant.s.i_a), fabsf(simPlant.s.i_b));
+	float dir = (liveSystemParams.dirRotation == CW_ROTATION) ? 1.0f : -1.0f; //plant to actuator direction
+	float speed = dir * Plant_loadSpeed(&simPlant);
+	float torque = dir * simPlant.s.torque_em;
+
+	if (t >= args.load_time){
+		simPlant.p.load_torque = args.load;
+		if (args.load != 0.0f){
+			float load = dir * args.load;
+			float load_est = StepperCtrl_getLoadTorque();
+			if ((metrics.load_detect_time < 0.0f) && ((load_est / load) >= 0.9f)){
+				metrics.load_detect_time = t - args.load_time;
+			}
+			metrics.load_samples++;
+			metrics.load_sum += (double)load_est;
+			metrics.load_sq_sum += (double)(load_est * load_est);
+		}
+	}
+	if (args.scenario == SCENARIO_VELOCITY){
+		err = args.speed - (speed * (180.0f / (float)M_PI)); //deg/s
+	}
+
+	metrics.samples++;
+	if (((args.scenario != SCENARIO_SINE) && (args.scenario != SCENARIO_VELOCITY)) || (t >= SIM_SETTLE_TIME)){
+		metrics.err_samples++;
+		metrics.err_sum += (double)err;
+		metrics.err_sq_sum += (double)(err * err);
+		metrics.iae += (double)(fabsf(err) * ((float)SAMPLING_PERIOD_uS * 1e-6f));
+		metrics.err_max = fmaxf(metrics.err_max, fabsf(err));
+	}
+	metrics.current_peak = fmaxf(metrics.current_peak, current);
+	double sensor = ((double)currentLocation * (double)360 / (double)ANGLE_STEPS) - (simPlant.s.theta * (double)180 / (double)M_PI);
+	metrics.sensor_sum += sensor;
+	metrics.sensor_sq_sum += sensor * sensor;
+	metrics.speed_sum += (double)speed;
+	metrics.speed_sq_sum += (double)(speed * speed);
+	metrics.tq_sum += (double)torque;
+	metrics.tq_sq_sum += (double)(torque * torque);
+	metrics.tq_min = fminf(metrics.tq_min, torque);
+	metrics.tq_max = fmaxf(metrics.tq_max, torque);
+
+	if (t >= (args.time - SIM_STEADY_TIME)){
+		//PWM period average of the phase voltages in the rotor frame - the mean keeps the fundamental
+		PlantDrive_t drive;
+		Sim_getDrive(&drive);
+		float u_a = drive.in1 - drive.in2;
+		float u_b = simPlant.p.phase_b_inverted ? (drive.in4 - drive.in3) : (drive.in3 - drive.in4);
+		float elec = (float)fmod(simPlant.s.theta * (double)simPlant.p.fullSteps / (double)4, (double)2 * (double)M_PI);
+		metrics.steady_samples++;
+		metrics.steady_speed_sum += (double)speed;
+		metrics.steady_tq_sum += (double)torque;
+		metrics.steady_uq_sum += (double)((-u_a * sinf(elec)) + (u_b * cosf(elec)));
+		metrics.steady_ud_sum += (double)((u_a * cosf(elec)) + (u_b * sinf(elec)));
+	}
+
+	if ((args.scenario == SCENARIO_STEP) && (t >= SIM_STEP_TIME) && (step_trace_len < STEP_TRACE_LEN)){
+		step_trace[step_trace_len] = angle - angle_base;
+		step_trace_len++;
+	}
+
+	if (args.estimators && (t >= SIM_SETTLE_TIME) && (est_trace_len < EST_TRACE_LEN)){
+		//currentLocation counts in the plant direction
+		est_trace[EST_PLANT][est_trace_len] = simPlant.s.omega / (2.0f * (float)M_PI);
+		est_trace[EST_IIR][est_trace_len] = (float)speed_iir / (float)ANGLE_STEPS;
+		est_trace[EST_OBSERVER][est_trace_len] = (float)observerSpeed / (float)ANGLE_STEPS;
+		est_trace_len++;
+	}
+
+	if ((csv_file != NULL) && ((metrics.samples % args.decimate) == 0U)){
+		(void) fprintf(csv_file, "%.6f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%d\n", (double)t,
+			(double)angle_cmd, (double)angle, (double)speed, (double)simPlant.s.i_a, (double)simPlant.s.i_b,
+			(double)torque, (double)StepperCtrl_getControlOutput(), control);
+	}
+}
+
+//fast motor control task
+volatile uint32_t motion_task_counter=0;	// cppcheck-suppress  misra-c2012-8.4
+volatile uint32_t service_task_counter=0;	// cppcheck-suppress  misra-c2012-8.4
+void Motion_task(void){
+	motion_task_counter++;
+
+	(void) StepperCtrl_processMotion(); //handle the control loop
+
+	if (scenario_active){
+		Scenario_record();
+	}
+}
+
+//10ms task - commands arrive at the CAN rate
+void Service_task(void){
+	service_task_counter++;
+
+	if (scenario_active){
+		Scenario_command();
+	}
+}
+
+static void Begin_process(void){
+	board_init();
+
+	update_actuator_parameters(USE_SIMPLE_PARAMETERS);
+
+	nonvolatile_begin();
+	validateAndInitNVMParams(); //systemParams init
+
+	Serivice_task_init(); //task init
+	Motion_task_init(SAMPLING_PERIOD_uS);
+
+	delay_ms(10);
+	stepCtrlError = STEPCTRL_NO_CAL;
+	while(STEPCTRL_NO_ERROR != stepCtrlError){
+		stepCtrlError = StepperCtrl_begin();
+
+		if(STEPCTRL_NO_CAL == stepCtrlError){
+			(void) printf("Calibrating...\n");
+			if (!Learn_StepSize_WiringPolarity()){
+				(void) printf("ERROR: Motor blocked or unpowered\n");
+				exit(EXIT_FAILURE);
+			}
+			uint64_t cal_start_us = sim_time_us;
+			uint16_t max_error = EncoderCalibrate(false);
+			(void) printf("Motor steps: %d, inverted phase: %d, max deviation %.3f deg, encoder calibration %.2f s\n",
+				liveMotorParams.fullStepsPerRotation, (int)liveMotorParams.invertedPhase, (double)ANGLERAW_T0_DEGREES(max_error),
+				(double)(sim_time_us - cal_start_us) / (double)S_to_uS);
+		}else if(STEPCTRL_NO_ERROR != stepCtrlError){
+			(void) printf("Initialization error %d\n", (int)stepCtrlError);
+			exit(EXIT_FAILURE);
+		}else{
+			//initialized
+		}
+	}
+	(void) printf("Initialization successful at %.3f s\n", (double)sim_time_us / (double)S_to_uS);
+
+	StepperCtrl_enable(true);
+	apiAllowControl(true);
+}
+
+static void Print_step_metrics(void){
+	float target = args.amp;
+	float sign = (target >= 0.0f) ? 1.0f : -1.0f;
+	float dt = (float)SAMPLING_PERIOD_uS * 1e-6f;
+	uint32_t i10 = step_trace_len;
+	uint32_t i90 = step_trace_len;
+	float peak = 0.0f;
+	for (uint32_t i = 0; i < step_trace_len; i++){
+		float y = step_trace[i] * sign;
+		if ((i10 == step_trace_len) && (y >= 0.1f * fabsf(target))) {i10 = i;}
+		if ((i90 == step_trace_len) && (y >= 0.9f * fabsf(target))) {i90 = i;}
+		peak = fmaxf(peak, y);
+	}
+	//settling - last sample outside 2% band (or 0.05deg for small steps)
+	float band = fmaxf(0.02f * fabsf(target), 0.05f);
+	uint32_t settle = 0;
+	for (uint32_t i = 0; i < step_trace_len; i++){
+		if (fabsf(step_trace[i] - target) > band) {settle = i + 1U;}
+	}
+	float sse = (step_trace_len > 0U) ? (target - step_trace[step_trace_len - 1U]) : 0.0f;
+
+	if (target == 0.0f){
+		//holding position - e.g. against --load
+		float dev = 0.0f;
+		for (uint32_t i = 0; i < step_trace_len; i++){
+			dev = fmaxf(dev, fabsf(step_trace[i]));
+		}
+		(void) printf("peak deviation:      %.4f deg\n", (double)dev);
+	}else{
+		if ((i10 < step_trace_len) && (i90 < step_trace_len)){
+			(void) printf("rise time (10-90%%):  %.2f ms\n", (double)((float)(i90 - i10) * dt * 1000.0f));
+		}else{
+			(void) printf("rise time (10-90%%):  not reached\n");
+		}
+		(void) printf("overshoot:           %.2f %%\n", (double)fmaxf(0.0f, (peak - fabsf(target)) / fabsf(target) * 100.0f));
+	}
+	(void) printf("settling time:       %.2f ms\n", (double)((float)settle * dt * 1000.0f));
+	(void) printf("steady state error:  %.4f deg\n", (double)sse);
+}
+
+//rms difference between the estimate and the plant speed delayed by lag ticks (negative lag - estimate leads)
+static double estimator_rms(const float *est, int32_t lag){
+	const float *ref = est_trace[EST_PLANT];
+	double sum = 0.0;
+	uint32_t n = 0;
+	for (uint32_t i = EST_MAX_LAG; (i + EST_MAX_LAG) < est_trace_len; i++){
+		double d = (double)(est[i] - ref[(int32_t)i - lag]);
+		sum += d * d;
+		n++;
+	}
+	return sqrt(sum / (double)max(n, 1U));
+}
+
+static void Print_estimator_metrics(void){
+	const char *names[EST_COUNT] = {"plant", "speed_iir", "observer"};
+	double tick_us = (double)SAMPLING_PERIOD_uS;
+	for (uint32_t e = EST_IIR; e < (uint32_t)EST_COUNT; e++){
+		//lag with the smallest rms error, refined by a parabola through the neighbours
+		int32_t best = 0;
+		double best_rms = estimator_rms(est_trace[e], 0);
+		for (int32_t lag = -EST_MAX_LAG; lag < EST_MAX_LAG; lag++){
+			double rms = estimator_rms(est_trace[e], lag);
+			if (rms < best_rms){
+				best_rms = rms;
+				best = lag;
+			}
+		}
+		double frac = (double)0;
+		if ((best > -EST_MAX_LAG) && (best < (EST_MAX_LAG - 1))){
+			double r0 = estimator_rms(est_trace[e], best - 1);
+			double r2 = estimator_rms(est_trace[e], best + 1);
+			double den = (r0 - best_rms) + (r2 - best_rms);
+			frac = (den > (double)0) ? ((r0 - r2) / (den + den)) : (double)0;
+		}
+		(void) printf("%-9s lag: %7.1f us, error rms: %.4f rev/s, noise rms: %.4f rev/s\n", names[e],
+			((double)best + frac) * tick_us, estimator_rms(est_trace[e], 0), best_rms);
+	}
+}
+
+static void Print_encoder_map(void){
+	const uint32_t points = 8192U;
+	Plant_t plant = simPlant;
+	plant.p.sensor_noise = 0.0f;
+	plant.p.sensor_hysteresis = 0.0f;
+	plant.s.omega = 0.0f;
+	int32_t ref = 0;
+	double sum = 0.0;
+	double sq_sum = 0.0;
+	int32_t err_min = INT32_MAX;
+	int32_t err_max = INT32_MIN;
+	for (uint32_t i = 0; i < points; i++){
+		plant.s.theta = (double)2 * (double)M_PI * (double)i / (double)points;
+		uint16_t expected = (uint16_t)(i * (ANGLE_STEPS / points));
+		uint16_t corrected = CalibrationLookup_angle((uint16_t)(Plant_sensorAngle(&plant) << 1U));
+		if (i == 0U){
+			ref = (int16_t)(uint16_t)(corrected - expected);
+		}
+		int32_t err = (int16_t)(uint16_t)(corrected - expected - (uint16_t)ref);
+		sum += (double)err;
+		sq_sum += (double)err * (double)err;
+		err_min = min(err_min, err);
+		err_max = max(err_max, err);
+	}
+	double mean = sum / (double)points;
+	double rms = sqrt(fmax(0.0, (sq_sum / (double)points) - (mean * mean)));
+	double peak = fmax((double)err_max - mean, mean - (double)err_min);
+	(void) printf("encoder map error: rms %.4f deg, max %.4f deg\n", rms * (double)360 / (double)ANGLE_STEPS, peak * (double)360 / (double)ANGLE_STEPS);
+}
+
+static void Print_metrics(double wall_s){
+	double n = (double)((metrics.samples > 0U) ? metrics.samples : 1U);
+	const char *names[] = {"step", "sine", "torque", "velocity"};
+	(void) printf("\n--- %s%s ---\n", names[args.scenario], args.cascade ? " (cascade)" : "");
+	if (args.scenario == SCENARIO_STEP){
+		Print_step_metrics();
+		(void) printf("IAE:                 %.4f deg*s\n", metrics.iae);
+	}else if (args.scenario == SCENARIO_VELOCITY){
+		double err_mean = metrics.err_sum / (double)max(metrics.err_samples, 1U);
+		(void) printf("speed error mean:    %.4f deg/s\n", err_mean);
+		(void) printf("speed error rms:     %.4f deg/s\n", sqrt(metrics.err_sq_sum / (double)max(metrics.err_samples, 1U)));
+		(void) printf("speed error max:     %.4f deg/s\n", (double)metrics.err_max);
+	}else if (args.scenario == SCENARIO_SINE){
+		(void) printf("tracking error rms:  %.4f deg\n", sqrt(metrics.err_sq_sum / (double)max(metrics.err_samples, 1U)));
+		(void) printf("tracking error max:  %.4f deg\n", (double)metrics.err_max);
+	}else{
+		double speed_mean = metrics.speed_sum / n;
+		double tq_mean = metrics.tq_sum / n;
+		(void) printf("load speed mean:     %.3f rad/s (std %.3f)\n", speed_mean, sqrt(fmax(0.0, (metrics.speed_sq_sum / n) - (speed_mean * speed_mean))));
+		(void) printf("motor torque mean:   %.4f Nm\n", tq_mean);
+		(void) printf("torque ripple std:   %.4f Nm\n", sqrt(fmax(0.0, (metrics.tq_sq_sum / n) - (tq_mean * tq_mean))));
+		(void) printf("torque ripple p-p:   %.4f Nm\n", (double)(metrics.tq_max - metrics.tq_min));
+	}
+	if ((args.scenario == SCENARIO_TORQUE) || (args.scenario == SCENARIO_VELOCITY)){
+		double sn = (double)max(metrics.steady_samples, 1U);
+		(void) printf("steady state speed:  %.3f rad/s, motor torque %.4f Nm, voltage utilisation %.1f %%\n",
+			metrics.steady_speed_sum / sn, metrics.steady_tq_sum / sn,
+			hypot(metrics.steady_uq_sum / sn, metrics.steady_ud_sum / sn) * (double)100);
+	}
+	(void) printf("peak phase current:  %.3f A\n", (double)metrics.current_peak);
+	double sensor_mean = metrics.sensor_sum / n;
+	(void) printf("sensor error rms:    %.4f deg\n", sqrt(fmax(0.0, (metrics.sensor_sq_sum / n) - (sensor_mean * sensor_mean))));
+	if (simPlant.p.sensor_fault_rate > 0.0f){
+		(void) printf("sensor rejected:     %u reads\n", (unsigned)encoderMockRejected);
+	}
+	if (metrics.load_samples > 0U){
+		double ln = (double)metrics.load_samples;
+		double load_mean = metrics.load_sum / ln;
+		(void) printf("load estimate mean:  %.4f Nm (applied %.4f Nm, std %.4f Nm)\n", load_mean,
+			(double)(args.load * ((liveSystemParams.dirRotation == CW_ROTATION) ? 1.0f : -1.0f)),
+			sqrt(fmax((double)0, (metrics.load_sq_sum / ln) - (load_mean * load_mean))));
+		(void) printf("load detected (90%%): %.2f ms\n", (double)(metrics.load_detect_time * 1000.0f));
+	}
+	if (args.estimators){
+		Print_estimator_metrics();
+	}
+	(void) printf("simulated %.3f s in %.3f s wall time (%.1fx real time)\n",
+		(double)args.time, wall_s, (wall_s > (double)0) ? ((double)args.time / wall_s) : (double)0);
+}
+
+static void Parse_args(int argc, char *argv[], PlantParams_t *params){
+	for (int i = 1; i < argc; i++){
+		const char *a = argv[i];
+		const char *v = ((i + 1) < argc) ? argv[i + 1] : NULL;
+		if (strcmp(a, "step") == 0)			{args.scenario = SCENARIO_STEP;}
+		else if (strcmp(a, "sine") == 0)	{args.scenario = SCENARIO_SINE;}
+		else if (strcmp(a, "torque") == 0)	{args.scenario = SCENARIO_TORQUE;}
+		else if (strcmp(a, "velocity") == 0){args.scenario = SCENARIO_VELOCITY;}
+		else if (strcmp(a, "--cascade") == 0){args.cascade = true;}
+		else if (strcmp(a, "--estimators") == 0){args.estimators = true;}
+		else if (strcmp(a, "--autotune") == 0){args.autotune = true;}
+		else if (strcmp(a, "--anticogging") == 0){args.anticogging = true;}
+		else if (strcmp(a, "--friction") == 0){args.friction = true;}
+		else if (strcmp(a, "--identify-latency") == 0){args.latency = true;}
+		else if (strcmp(a, "--continuous-cal") == 0){args.continuous_cal = true;}
+		else if (strcmp(a, "--refine") == 0){args.refine = true;}
+		else if (v == NULL)					{(void) printf("Missing value for %s\n", a); exit(EXIT_FAILURE);}
+		else if (strcmp(a, "--time") == 0)	{args.time = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--amp") == 0)	{args.amp = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--freq") == 0)	{args.freq = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--torque") == 0){args.torque = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--load") == 0)	{args.load = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--load-time") == 0){args.load_time = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--speed") == 0)	{args.speed = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--harmonics") == 0){args.harmonics = (uint8_t)strtoul(v, NULL, 0); i++;}
+		else if (strcmp(a, "--hysteresis") == 0){params->sensor_hysteresis = strtof(v, NULL) * (float)M_PI / 180.0f; i++;}
+		else if (strcmp(a, "--sensor-faults") == 0){params->sensor_fault_rate = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--sensor-latency") == 0){params->sensor_latency = strtof(v, NULL) * 1e-6f; i++;}
+		else if (strcmp(a, "--sensor-profile") == 0){args.sensor_profile = (int8_t)strtol(v, NULL, 0); i++;}
+		else if (strcmp(a, "--vbus") == 0)	{params->v_bus = strtof(v, NULL); i++;}
+		else if (strcmp(a, "--field-weakening") == 0){field_weakening_current = (uint16_t)strtoul(v, NULL, 0); i++;}
+		else if (strcmp(a, "--overmodulation") == 0){overmodulation = (uint8_t)strtoul(v, NULL, 0); i++;}
+		else if (strcmp(a, "--ripple-3rd") == 0){anticogging_factor = (int8_t)strtol(v, NULL, 0); i++;}
+		else if (strcmp(a, "--ripple-5th") == 0){anticogging_factor_5th = (int8_t)strtol(v, NULL, 0); i++;}
+		else if (strcmp(a, "--dead-time") == 0){params->dead_time = strtof(v, NULL) * 1e-9f; i++;}
+		else if (strcmp(a, "--seed") == 0)	{args.seed = (uint32_t)strtoul(v, NULL, 0); i++;}
+		else if (strcmp(a, "--csv") == 0)	{args.csv = v; i++;}
+		else if (strcmp(a, "--flash") == 0)	{args.flash = v; i++;}
+		else if (strcmp(a, "--encoder-trace") == 0){args.encoder_trace = v; i++;}
+		else if (strcmp(a, "--decimate") == 0){args.decimate = (uint32_t)max(strtoul(v, NULL, 0), 1UL); i++;}
+		else {(void) printf("Unknown argument %s\n", a); exit(EXIT_FAILURE);}
+	}
+}
+
+#ifndef PIO_UNIT_TESTING
+int main (int argc, char *argv[])
+{
+	PlantParams_t params;
+	Plant_defaults(&params);
+	Parse_args(argc, argv, &params);
+	Sim_begin(&params);
+	if (args.seed != 0U){
+		simPlant.s.noise_seed = args.seed;
+	}
+
+	if (!Sim_flash_begin(args.flash)){
+		return EXIT_FAILURE;
+	}
+
+	calibration_harmonics = args.harmonics;
+	calibration_continuous = args.continuous_cal;
+	calibration_refine = args.refine;
+	if (args.sensor_profile >= 0){
+		sensor_profile = (uint8_t)args.sensor_profile;
+	}
+	Begin_process();
+	Print_encoder_map();
+	if (Encoder_profile() != (EncoderProfile_t)sensor_profile){
+		(void) printf("Sensor profile %d not supported\n", (int)sensor_profile);
+		return EXIT_FAILURE;
+	}
+	if (args.latency){
+		apiAllowControl(false);
+		int8_t result = Identify_sensor_latency();
+		apiAllowControl(true);
+		(void) printf("Sensor latency %s: %u us, profile %d\n", (result == 0) ? "identified" : "not identified", Encoder_latency_us(), (int)Encoder_profile());
+	}
+	if (args.friction){
+		apiAllowControl(false);
+		int8_t result = Friction_identify();
+		apiAllowControl(true);
+		(void) printf("Friction %s: coulomb %d mA, stiction %d mA, stribeck %.3f rev/s, viscous %.2f mA/(rev/s)\n", (result == 0) ? "done" : "failed",
+			friction_coulomb_current, friction_stiction_current, (double)((float)friction_stribeck_speed / (float)ANGLE_STEPS),
+			(double)((float)friction_viscous_current / (float)FRICTION_VISCOUS_SCALING));
+	}
+	if (args.autotune){
+		apiAllowControl(false);
+		int8_t result = Autotune_pid();
+		apiAllowControl(true);
+		(void) printf("Autotune %s: Ku %.3f mA/angleraw, Tu %.2f ms -> Kp %.4f, Ki %.5f, Kd %.4f\n", (result == 0) ? "done" : "failed",
+			(double)autotuneKu, (double)(autotuneTu * 1000.0f), (double)nvmMirror.pPID.Kp, (double)nvmMirror.pPID.Ki, (double)nvmMirror.pPID.Kd);
+	}
+	if (args.anticogging){
+		apiAllowControl(false);
+		int8_t result = Anticogging_calibrate();
+		apiAllowControl(true);
+		int16_t cog_min = INT16_MAX;
+		int16_t cog_max = INT16_MIN;
+		for (uint16_t i = 0; i < (uint16_t)(ANGLE_STEPS / COGGING_TABLE_SIZE); i++){
+			int16_t cog = Anticogging_current((uint16_t)(i * COGGING_TABLE_SIZE));
+			cog_min = (int16_t)min(cog_min, cog);
+			cog_max = (int16_t)max(cog_max, cog);
+		}
+		(void) printf("Anticogging %s: map %d..%d mA\n", (result == 0) ? "done" : "failed", cog_min, cog_max);
+	}
+	if (args.flash != NULL){
+		(void) Sim_flash_save(args.flash); //keep calibration for the next run
+	}
+	if ((args.encoder_trace != NULL) && !EncoderMock_loadTrace(args.encoder_trace)){
+		(void) printf("Encoder trace %s not loaded\n", args.encoder_trace);
+		return EXIT_FAILURE;
+	}
+
+	if (args.csv != NULL){
+		csv_file = fopen(args.csv, "w");
+		if (csv_file != NULL){
+			(void) fprintf(csv_file, "t,angle_cmd,angle,load_speed,i_a,i_b,torque_em,torque_ctrl,control\n");
+		}
+	}
+
+	//settle at the current position before the scenario starts
+	delay_ms(10); //let the motion task pick up the current location
+	angle_base = StepperCtrl_getAngleFromEncoder();
+	angle_cmd = angle_base;
+	scenario_start_us = sim_time_us;
+	if (args.cascade){
+		nvmMirror.systemParams.controllerMode = CTRL_POS_VELOCITY_PID; //picked up when the control mode is set
+	}
+	metrics.tq_min = INFINITY;
+	metrics.tq_max = -INFINITY;
+	metrics.load_detect_time = -1.0f;
+	scenario_active = true;
+
+	clock_t wall_start = clock();
+	if (args.refine){
+		//main loop between the service task ticks
+		uint64_t scenario_end_us = sim_time_us + (uint64_t)(args.time * (float)S_to_uS);
+		while (sim_time_us < scenario_end_us){
+			Sim_advance_us((uint32_t)min(scenario_end_us - sim_time_us, (uint64_t)SERVICE_TASK_PERIOD_uS));
+			CalibrationTable_refine();
+		}
+	}else{
+		Sim_advance_us((uint32_t)(args.time * (float)S_to_uS));
+	}
+	double wall_s = (double)(clock() - wall_start) / CLOCKS_PER_SEC;
+	if (args.refine){
+		Print_encoder_map();
+		//motor off, the load removed - the table is stored once the rotor stops
+		scenario_active = false;
+		simPlant.p.load_torque = 0.0f;
+		StepperCtrl_setMotionMode(STEPCTRL_OFF);
+		for (uint16_t i = 0; i < 100U; i++){
+			Sim_advance_us(SERVICE_TASK_PERIOD_uS);
+			CalibrationTable_refine();
+		}
+		if (args.flash != NULL){
+			(void) Sim_flash_save(args.flash);
+		}
+	}
+
+	if (csv_file != NULL){
+		(void) fclose(csv_file);
+	}
+	Print_metrics(wall_s);
+	return (stepCtrlError == STEPCTRL_NO_ERROR) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif //PIO_UNIT_TESTING
@@ -0,0 +1,215 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+#include "plant.h"
+#include <math.h>
+
+#define TWO_PI 6.2831853f
+
+// default parameters - black 17HS4401S with the planetary gearbox from actuator_config.c
+// and a light steering column load
+void Plant_defaults(PlantParams_t *params){
+	params->R = 2.4f;
+	params->L = 3.23e-3f;
+	params->k_t = 0.2f;
+	params->fullSteps = 200U;
+	params->detent = 0.015f;
+	params->J_rotor = 54e-7f;
+
+	params->gear_ratio = (5.0f + (2.0f / 11.0f)) * 2.0f;
+	params->J_load = 5e-3f;
+	params->coulomb = 0.4f;
+	params->stiction = 0.6f;
+	params->stribeck_speed = 0.5f;
+	params->viscous = 0.05f;
+	params->load_torque = 0.0f;
+
+	params->v_bus = 12.0f;
+	params->vref_tau = 100e-6f; //R=1k, C=0.1uF
+	params->diode_drop = 0.43f;
+	params->dead_time = 0.0f;
+	params->phase_b_inverted = false;
+
+	params->sensor_offset = 1.0f;
+	params->sensor_ecc = 0.005f; //~0.3deg
+	params->sensor_noise = 0.0004f; //~0.02deg
+	params->sensor_latency = 0.0f;
+	params->sensor_hysteresis = 0.0f;
+	params->sensor_fault_rate = 0.0f;
+
+	params->dt = 2e-6f;
+}
+
+void Plant_init(Plant_t *plant, const PlantParams_t *params){
+	plant->p = *params;
+	plant->s = (PlantState_t){0};
+	plant->s.noise_seed = 0x12345678U;
+}
+
+// A4950 bridge: returns average phase voltage over the integration step
+// slow decay (brake) when the regulator trips, diode conduction against the supply when coasting
+// and during the crossover delay of a switching output (one delayed edge per period)
+static float bridge_voltage(const PlantDrive_t *drive, float in_p, float in_n, float ilim, float i, const PlantParams_t *p, float *coast){
+	if (!drive->outputs_enabled){
+		in_p = 0.0f;
+		in_n = 0.0f;
+	}
+	float brake = fminf(in_p, in_n);
+	float fwd = in_p - brake;
+	float rev = in_n - brake;
+	*coast = 1.0f - fmaxf(in_p, in_n);
+	float switching = fwd + rev;
+	float dead = ((switching > 0.0f) && (switching < 1.0f) && (drive->period > 0.0f)) ? fminf(p->dead_time / drive->period, switching) : 0.0f;
+
+	//fixed off-time current regulation - modelled as slow decay for the rest of the step
+	if ((fwd > 0.0f) && (i >= ilim)){
+		fwd = 0.0f;
+	}
+	if ((rev > 0.0f) && (-i >= ilim)){
+		rev = 0.0f;
+	}
+
+	float u = p->v_bus * (fwd - rev);
+	if (i > 0.0f){
+		u -= (*coast + dead) * (p->v_bus + 2.0f * p->diode_drop);
+	}else if (i < 0.0f){
+		u += (*coast + dead) * (p->v_bus + 2.0f * p->diode_drop);
+	}else{
+		//open phase
+	}
+	return u;
+}
+
+static float friction(const PlantParams_t *p, float omega_load){
+	float w = omega_load / p->stribeck_speed;
+	float level = p->coulomb + ((p->stiction - p->coulomb) * expf(-(w * w)));
+	return (copysignf(level, omega_load)) + (p->viscous * omega_load);
+}
+
+static void plant_substep(Plant_t *plant, const PlantDrive_t *drive, float dt){
+	const PlantParams_t *p = &plant->p;
+	PlantState_t *s = &plant->s;
+
+	double pole_pairs = (double)p->fullSteps / 4;
+	float elec = (float)fmod(pole_pairs * s->theta, (double)TWO_PI);
+	float sin_e = sinf(elec);
+	float cos_e = cosf(elec);
+
+	//A4950 VREF RC filter
+	float k_ref = dt / (p->vref_tau + dt);
+	s->ilim_a += (drive->ilim_a - s->ilim_a) * k_ref;
+	s->ilim_b += (drive->ilim_b - s->ilim_b) * k_ref;
+
+	//electrical
+	float coast_a;
+	float coast_b;
+	s->u_a = bridge_voltage(drive, drive->in1, drive->in2, s->ilim_a, s->i_a, p, &coast_a);
+	s->u_b = bridge_voltage(drive, drive->in3, drive->in4, s->ilim_b, s->i_b, p, &coast_b);
+	float e_a = -p->k_t * s->omega * sin_e;
+	float e_b = p->k_t * s->omega * cos_e;
+	if (p->phase_b_inverted){
+		e_b = -e_b;
+	}
+	float i_a = s->i_a + ((dt / p->L) * (s->u_a - (p->R * s->i_a) - e_a));
+	float i_b = s->i_b + ((dt / p->L) * (s->u_b - (p->R * s->i_b) - e_b));
+	//diodes block the current from reversing while coasting
+	if ((coast_a > 0.0f) && ((i_a * s->i_a) < 0.0f)){
+		i_a = 0.0f;
+	}
+	if ((coast_b > 0.0f) && ((i_b * s->i_b) < 0.0f)){
+		i_b = 0.0f;
+	}
+	s->i_a = i_a;
+	s->i_b = i_b;
+
+	//mechanical - everything reflected to the motor shaft
+	float i_b_motor = p->phase_b_inverted ? -s->i_b : s->i_b;
+	s->torque_em = p->k_t * ((-s->i_a * sin_e) + (i_b_motor * cos_e));
+	float torque_detent = -p->detent * sinf(4.0f * elec);
+	float torque_drive = s->torque_em + torque_detent + (p->load_torque / p->gear_ratio);
+	float J = p->J_rotor + (p->J_load / (p->gear_ratio * p->gear_ratio));
+	float omega_load = s->omega / p->gear_ratio;
+	float stick_lim = p->stiction / p->gear_ratio;
+
+	float omega_prev = s->omega;
+	if ((s->omega == 0.0f) && (fabsf(torque_drive) <= stick_lim)){
+		//static friction holds
+		s->torque_fric = -torque_drive;
+		s->alpha = 0.0f;
+	}else{
+		float fric_speed = (s->omega != 0.0f) ? omega_load : torque_drive;
+		s->torque_fric = -friction(p, fric_speed) / p->gear_ratio;
+		s->alpha = (torque_drive + s->torque_fric) / J;
+		s->omega += s->alpha * dt;
+		//stop at zero crossing if friction can hold the shaft
+		if (((s->omega * omega_prev) < 0.0f) && (fabsf(torque_drive) <= stick_lim)){
+			s->omega = 0.0f;
+		}
+	}
+	s->theta += (double)(s->omega * dt);
+}
+
+void Plant_step(Plant_t *plant, const PlantDrive_t *drive, float time){
+	while (time > 0.0f){
+		float dt = fminf(time, plant->p.dt);
+		plant_substep(plant, drive, dt);
+		time -= dt;
+	}
+}
+
+static float noise(uint32_t *seed){
+	//Irwin-Hall approximation of a unit normal distribution
+	float sum = 0.0f;
+	for (uint8_t k = 0; k < 4U; k++){
+		*seed ^= *seed << 13U;
+		*seed ^= *seed >> 17U;
+		*seed ^= *seed << 5U;
+		sum += (float)(*seed) / 4294967296.0f;
+	}
+	return (sum - 2.0f) * 1.7320508f;
+}
+
+//15bit TLE5012 style reading of the motor shaft angle
+uint16_t Plant_sensorAngle(Plant_t *plant){
+	const PlantParams_t *p = &plant->p;
+	double seen = plant->s.theta - (double)(plant->s.omega * p->sensor_latency);
+	double half = (double)(p->sensor_hysteresis * 0.5f);
+	if ((seen - plant->s.sensor_play) > half){
+		plant->s.sensor_play = seen - half;
+	}else if ((seen - plant->s.sensor_play) < -half){
+		plant->s.sensor_play = seen + half;
+	}else{
+		//within the play - the reading stays
+	}
+	float theta = (float)fmod(plant->s.sensor_play, (double)TWO_PI);
+	float meas = theta + p->sensor_offset
+		+ (p->sensor_ecc * sinf(theta + 0.3f))
+		+ (0.3f * p->sensor_ecc * sinf((2.0f * theta) + 1.1f))
+		+ (p->sensor_noise * noise(&plant->s.noise_seed));
+	float turns = meas / TWO_PI;
+	turns -= floorf(turns);
+	return (uint16_t)((uint32_t)(turns * 32768.0f) & 0x7FFFU);
+}
+
+float Plant_loadAngle(const Plant_t *plant){
+	return (float)(plant->s.theta / (double)plant->p.gear_ratio);
+}
+
+float Plant_loadSpeed(const Plant_t *plant){
+	return plant->s.omega / plant->p.gear_ratio;
+}
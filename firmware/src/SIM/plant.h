@@ -0,0 +1,108 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Two-phase hybrid stepper, A4950 power stage, gearbox and load model for the native simulation.
+	All quantities are SI (V, A, Ohm, H, Nm, rad, rad/s, kg*m^2, s).
+	Motor side variables are before the gearbox, load side variables after it.
+*/
+
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	//motor - per phase
+	float R;				//phase resistance
+	float L;				//phase inductance
+	float k_t;				//torque constant [Nm/A], equal to BEMF constant [V/(rad/s)]
+	uint16_t fullSteps;		//full steps per revolution - 200 or 400
+	float detent;			//cogging torque amplitude (4th electrical harmonic)
+	float J_rotor;			//rotor inertia
+
+	//gearbox and load
+	float gear_ratio;		//motor revolutions per load revolution
+	float J_load;			//load inertia
+	float coulomb;			//load side kinetic friction
+	float stiction;			//load side breakaway friction
+	float stribeck_speed;	//load side speed where friction decays from stiction to coulomb
+	float viscous;			//load side viscous friction [Nm/(rad/s)]
+	float load_torque;		//external torque applied on the load side
+
+	//supply and power stage
+	float v_bus;			//motor supply voltage
+	float vref_tau;			//A4950 VREF RC filter time constant
+	float diode_drop;		//mosfet body diode drop during coasting
+	float dead_time;		//crossover delay of a switching bridge output - the body diodes conduct
+	bool phase_b_inverted;	//motor phase B wired in opposite polarity
+
+	//angle sensor
+	float sensor_offset;	//magnet mounting offset
+	float sensor_ecc;		//1st harmonic error amplitude - eccentricity
+	float sensor_noise;		//rms noise
+	float sensor_latency;	//time between sampling and reading the angle
+	float sensor_hysteresis;	//play between the shaft and the reading - difference between the directions
+	float sensor_fault_rate;	//fraction of the reads rejected by the safety word
+
+	float dt;				//integration step
+} PlantParams_t;
+
+//H-bridge inputs seen by the A4950 pins, averaged over one PWM period
+typedef struct {
+	float in1;	//fraction of time IN1 is high
+	float in2;
+	float in3;
+	float in4;
+	float ilim_a;	//current regulator threshold (unfiltered VREF)
+	float ilim_b;
+	bool outputs_enabled;	//timer main output enable
+	float period;	//PWM period
+} PlantDrive_t;
+
+typedef struct {
+	float i_a;
+	float i_b;
+	float u_a;			//applied phase voltage
+	float u_b;
+	float ilim_a;		//current threshold after VREF filter
+	float ilim_b;
+	double theta;		//motor shaft angle - double to keep resolution after many revolutions
+	float omega;		//motor shaft speed
+	float alpha;		//motor shaft acceleration
+	float torque_em;	//electromagnetic torque
+	float torque_fric;	//friction torque seen at the motor shaft
+	uint32_t noise_seed;
+	double sensor_play;	//shaft angle seen by the sensor - follows theta within the hysteresis
+} PlantState_t;
+
+typedef struct {
+	PlantParams_t p;
+	PlantState_t s;
+} Plant_t;
+
+void Plant_defaults(PlantParams_t *params);
+void Plant_init(Plant_t *plant, const PlantParams_t *params);
+void Plant_step(Plant_t *plant, const PlantDrive_t *drive, float time);
+uint16_t Plant_sensorAngle(Plant_t *plant);
+float Plant_loadAngle(const Plant_t *plant);
+float Plant_loadSpeed(const Plant_t *plant);
+
+#endif // PLANT_H
@@ -0,0 +1,152 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+#include "sim.h"
+#include "board.h"
+#include "main.h"
+#include "utils.h"
+#include "A4950.h"
+#include "encoder.h"
+
+Plant_t simPlant;
+volatile uint64_t sim_time_us = 0;
+
+// peripheral register mirrors written by the firmware
+GPIO_TypeDef SIM_GPIOA;
+GPIO_TypeDef SIM_GPIOB;
+GPIO_TypeDef SIM_GPIOC;
+TIM_TypeDef SIM_TIM1;
+TIM_TypeDef SIM_TIM2;
+TIM_TypeDef SIM_TIM3;
+TIM_TypeDef SIM_TIM4;
+ADC_TypeDef SIM_ADC1;
+SPI_TypeDef SIM_SPI2;
+
+void TIM_SetAutoreload(TIM_TypeDef* TIMx, uint16_t Autoreload){
+	TIMx->ARR = Autoreload;
+}
+
+void TIM_SetCompare1(TIM_TypeDef* TIMx, uint16_t Compare1){
+	TIMx->CCR1 = Compare1;
+}
+
+void TIM_SetCompare2(TIM_TypeDef* TIMx, uint16_t Compare2){
+	TIMx->CCR2 = Compare2;
+}
+
+void TIM_SetCompare3(TIM_TypeDef* TIMx, uint16_t Compare3){
+	TIMx->CCR3 = Compare3;
+}
+
+void TIM_SetCompare4(TIM_TypeDef* TIMx, uint16_t Compare4){
+	TIMx->CCR4 = Compare4;
+}
+
+void TIM_CtrlPWMOutputs(TIM_TypeDef* TIMx, FunctionalState NewState){
+	if (NewState != DISABLE){
+		TIMx->BDTR |= TIM_BDTR_MOE;
+	}else{
+		TIMx->BDTR &= (uint16_t)~TIM_BDTR_MOE;
+	}
+}
+
+uint16_t TIM_GetCounter(TIM_TypeDef* TIMx){
+	return TIMx->CNT;
+}
+
+//fraction of the center aligned PWM period the A4950 input is high
+//CH1,CH2 are active high, CH3,CH4 are configured active low in A4950_init()
+static float pwm_high_fraction(uint16_t ccr, uint16_t arr, bool active_low){
+	float duty = (arr == 0U) ? 0.0f : ((float)min(ccr, arr) / (float)arr);
+	return active_low ? (1.0f - duty) : duty;
+}
+
+//VREF duty to A4950 current trip threshold: I = Vref / (10 * Rs)
+static float vref_to_current(uint16_t ccr, uint16_t arr){
+	float vref = (float)min(ccr, arr) / (float)arr * (float)GetMcuVoltage_mV() / 1000.0f;
+	return vref * (float)Ohm_to_mOhm / (float)(I_RS_A4950_div * RS_A4950);
+}
+
+//PWM_TIM compare values in effect - preloaded, they apply at the update event
+static uint16_t pwm_active_ccr[4];
+
+static void pwm_update_event(void){
+	pwm_active_ccr[0] = PWM_TIM->CCR1;
+	pwm_active_ccr[1] = PWM_TIM->CCR2;
+	pwm_active_ccr[2] = PWM_TIM->CCR3;
+	pwm_active_ccr[3] = PWM_TIM->CCR4;
+}
+
+void Sim_getDrive(PlantDrive_t *drive){
+	drive->in1 = pwm_high_fraction(pwm_active_ccr[0], PWM_TIM->ARR, false);
+	drive->in2 = pwm_high_fraction(pwm_active_ccr[1], PWM_TIM->ARR, false);
+	drive->in3 = pwm_high_fraction(pwm_active_ccr[2], PWM_TIM->ARR, true);
+	drive->in4 = pwm_high_fraction(pwm_active_ccr[3], PWM_TIM->ARR, true);
+	drive->ilim_a = vref_to_current(VREF_TIM->CCR2, VREF_TIM_MAX); //VREF12
+	drive->ilim_b = vref_to_current(VREF_TIM->CCR1, VREF_TIM_MAX); //VREF34
+	drive->outputs_enabled = ((PWM_TIM->BDTR & TIM_BDTR_MOE) != 0U);
+	drive->period = (float)motion_task_period_us * 1e-6f; //one PWM period per motion task period
+}
+
+void Sim_begin(const PlantParams_t *params){
+	Plant_init(&simPlant, params);
+	sim_time_us = 0;
+}
+
+//advance plant and dispatch task "interrupts" until the end time
+void Sim_advance_us(uint32_t us){
+	uint64_t t_end = sim_time_us + us;
+	while (sim_time_us < t_end){
+		uint64_t t_next = t_end;
+		uint64_t t_pwm = UINT64_MAX;
+		uint64_t t_overflow = UINT64_MAX;
+		uint64_t t_service = UINT64_MAX;
+		if (motion_task_period_us > 0U){ //PWM_TIM runs once Motion_task_init() set its period
+			uint64_t half = motion_task_period_us / 2U;
+			t_pwm = ((sim_time_us / motion_task_period_us) + 1U) * motion_task_period_us;
+			t_overflow = ((((sim_time_us + half) / motion_task_period_us) + 1U) * motion_task_period_us) - half;
+			t_next = min(t_next, min(t_pwm, t_overflow));
+		}
+		if (service_task_enabled){
+			t_service = ((sim_time_us / SERVICE_TASK_PERIOD_uS) + 1U) * SERVICE_TASK_PERIOD_uS;
+			t_next = min(t_next, t_service);
+		}
+
+		PlantDrive_t drive;
+		Sim_getDrive(&drive);
+		Plant_step(&simPlant, &drive, (float)(t_next - sim_time_us) * 1e-6f);
+		sim_time_us = t_next;
+
+		//LSS_A injected conversion - the center of the bridge A drive pulse
+		if (sim_time_us == t_overflow){
+			Sim_sampleLSS(true);
+		}
+		//motion task has the higher priority - sampled at the update, its outputs apply at the next one
+		if (sim_time_us == t_pwm){
+			pwm_update_event();
+			Sim_sampleLSS(false); //LSS_B injected conversion with the new compare values, the center of the bridge B drive pulse
+			if (motion_task_isr_enabled){
+				Encoder_startRead();
+				Motion_task();
+			}
+		}
+		if (sim_time_us == t_service){
+			Service_task();
+		}
+	}
+}
@@ -0,0 +1,54 @@
+/**
+ * StepperServoCAN
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+	@ Description:
+	Native software-in-the-loop engine.
+	Simulated time only advances through delay_us()/delay_ms() or Sim_advance_us().
+	Motion and service tasks are dispatched as if they were the PWM_TIM update and TIM2 interrupts.
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "plant.h"
+#include "encoder.h"
+
+#define SERVICE_TASK_PERIOD_uS 10000U
+
+extern Plant_t simPlant;
+extern volatile uint64_t sim_time_us;
+
+extern volatile uint16_t motion_task_period_us;
+extern volatile bool service_task_enabled;
+
+void Sim_begin(const PlantParams_t *params);
+void Sim_advance_us(uint32_t us);
+void Sim_getDrive(PlantDrive_t *drive);
+void Sim_sampleLSS(bool bridgeA);
+
+bool Sim_flash_begin(const char *image_path);
+bool Sim_flash_save(const char *image_path);
+
+extern const EncoderDriver_t EncoderMock_driver;
+extern uint32_t encoderMockRejected;
+bool EncoderMock_loadTrace(const char *path);
+
+#endif // SIM_H
@@ -0,0 +1,16 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+//wall clock timing for the host only benchmarks - include before any system header
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L //clock_gettime
+#endif
+#include <time.h>
+
+static inline double benchmark_now_ns(void){
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e9) + (double)ts.tv_nsec;
+}
+
+#endif
@@ -48,7 +48,8 @@ modes = {
     'OFF': 0,
     'TORQUE_CONTROL': 1,
     'ANGLE_CONTROL': 2,
-    'SOFT_OFF': 3
+    'SOFT_OFF': 3,
+    'VELOCITY_CONTROL': 4
 }
 
 actions = {
@@ -21,61 +21,66 @@ import matplotlib.pyplot as plt
 import numpy as np
 from scipy import signal
 from scipy import optimize
-import re
+import zlib
 
 basepath = os.path.dirname(__file__)
 
 
-## Firmware stores sensor calibration in a following structure with fields written one after another
+## Firmware stores sensor calibration as a FlashCalRecord_t - header followed by the table
 # typedef struct {
-# 	uint16_t FlashCalData[CALIBRATION_TABLE_SIZE];
-# 	uint16_t status;
-# } FlashCalData_t;
+# 	uint16_t magic, version, type, size, fullSteps, counter;
+# 	uint32_t crc;
+# } FlashCalHeader_t;
+# Older firmware stored a FlashCalData_t - 50 values followed by the status
 ANGLE_STEPS = 65536
+RECORD_MAGIC = 0xCA1B
+RECORD_TABLE = 1
+RECORD_TABLE_HYSTERESIS = 3 #table followed by the hysteresis band, int16
+HEADER_FORMAT = '<6HI' #ARM has little endian
+LEGACY_TABLE_SIZE = 50
+DUMP_SIZE = 512 #FLASH_ROW_SIZE - the cogging map follows
 
 class CalibrationRead(object):
     def __init__(self):
-        self._update_cal_table_size()
         self.address = 0x0800FC00  #FLASH_PAGE63_ADDR
 
-        self.struct = self._create_struct_format(self.cal_size) 
+        self.cal_size = LEGACY_TABLE_SIZE
         self.values =np.array([])
+        self.bands = np.array([])
         self.status= []
 
         self.wrap_idx = 0
 
-    @staticmethod
-    def _create_struct_format(_calsize):
-        struct = '<' #ARM has little endian
-        struct += str(_calsize) + 'H'  #cal array
-        struct += "HHH" #status
-        return struct
-
-    def _update_cal_table_size(self):
-        #find calibration size in c-code
-        calibration_h_file = os.path.join(basepath, os.pardir, 'src', 'BSP', 'calibration.h')
-        with open(calibration_h_file, "r") as f:
-            for line in f:
-                if "#define"  in line and "CALIBRATION_TABLE_SIZE" in line:
-                    self.cal_size = int(re.search(r'\d+', line).group())  #parse cal size from calibration.h
-                    return
-            print("Didn't find cal table size in c-code. The output might be wrong")
-
     def dump_eeprom_to_file(self):
         #dump eeprom memory for calibration address 
         
         if system() == 'Windows':
-            ret = os.system('ST-LINK_CLI  -NoPrompt -Dump ' + hex(self.address) + ' ' + str(struct.calcsize(self.struct))  + ' eepromCals.bin')
+            ret = os.system('ST-LINK_CLI  -NoPrompt -Dump ' + hex(self.address) + ' ' + str(DUMP_SIZE)  + ' eepromCals.bin')
         else: # Linux 
             # https://github.com/stlink-org/stlink
-            ret = os.system('st-flash read' + ' eepromCals.bin' + ' ' + hex(self.address) + ' ' + str(struct.calcsize(self.struct)))
+            ret = os.system('st-flash read' + ' eepromCals.bin' + ' ' + hex(self.address) + ' ' + str(DUMP_SIZE))
         return ret
 
     def load_from_bin(self):
         with open(os.path.join(basepath, 'eepromCals.bin'), mode='rb') as dump: # r -read, b -> binary
-            values_raw = struct.unpack(self.struct, dump.read(struct.calcsize(self.struct)))
-        self.values = np.array(values_raw[0:self.cal_size])
-        self.status = values_raw[-3]
+            raw = dump.read()
+        header = struct.unpack_from(HEADER_FORMAT, raw)
+        if header[0] == RECORD_MAGIC and header[2] in (RECORD_TABLE, RECORD_TABLE_HYSTERESIS):
+            magic, version, record_type, self.cal_size, full_steps, counter, crc = header
+            offset = struct.calcsize(HEADER_FORMAT)
+            self.values = np.array(struct.unpack_from('<' + str(self.cal_size) + 'H', raw, offset))
+            payload_size = 2 * self.cal_size
+            if record_type == RECORD_TABLE_HYSTERESIS:
+                self.bands = np.array(struct.unpack_from('<' + str(self.cal_size) + 'h', raw, offset + payload_size))
+                payload_size *= 2
+            payload = raw[offset:offset + payload_size]
+            crc_ok = zlib.crc32(raw[0:offset - 4] + payload) == crc
+            self.status = "record v{0}, {1} full steps, calibration #{2}, crc {3}".format(version, full_steps, counter, "ok" if crc_ok else "BAD")
+        else:
+            self.cal_size = LEGACY_TABLE_SIZE
+            values_raw = struct.unpack_from('<' + str(self.cal_size + 1) + 'H', raw)
+            self.values = np.array(values_raw[0:self.cal_size])
+            self.status = "legacy, status {0}".format(values_raw[-1])
         self.wrap_idx = self.values.argmin()
 
     def print_cals(self):
@@ -86,6 +91,9 @@ class CalibrationRead(object):
                 self.status
             )
         )
+        if self.bands.size > 0:
+            print("Hysteresis band (turning up - turning down), mean {0:.3f} deg:".format(self.bands.mean() / ANGLE_STEPS * 360))
+            print(self.bands)
     
     def fit_func(self, X,  a, b, c, d=0, e=0, f=0, g=0, h=0, i=0, j=0, o=0):
         A =              np.matrix([a, c, e, g, i])
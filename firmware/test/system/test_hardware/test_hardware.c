@@ -5,6 +5,7 @@
 #include "motor.h"
 #include "delay.h"
 #include "utils.h"
+#include "stepper_controller.h"
 
 
 //test conditions
@@ -15,7 +16,7 @@
 
 
 void setUp(void) {
-	adc_update_all();
+	//ADC readings are scanned continuously
 }
 
 void tearDown(void) {
@@ -87,7 +88,6 @@ static void test_adc_values_under_load(void) {
         openloop_step(FULLSTEP_ELECTRIC_ANGLE*phase, I_MAX_A4950*2); //make sure pwm is 100% - for each phase
         delay_ms(1000);
 
-        adc_update_all(); 
         TEST_ASSERT_FLOAT_WITHIN(0.1, supply_volt_load_expected, GetSupplyVoltage());
         TEST_ASSERT(GetSupplyVoltage() > GetMotorVoltage()); // sanity check - there should be voltage drop due to reverse polarity protection Schottky diode
         // estimate motor voltage under load better
@@ -111,6 +111,7 @@ static void test_adc_values_under_load(void) {
 int main(void) {
     UNITY_BEGIN();
     board_init();
+    Motion_task_init(SAMPLING_PERIOD_uS); //PWM_TIM triggers the LSS conversions
     RCC_ClocksTypeDef clks;
     RCC_GetClocksFreq(&clks);
     printf("ADC clock: %lu Hz\n", clks.ADCCLK_Frequency);
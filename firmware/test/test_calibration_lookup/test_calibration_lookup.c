@@ -0,0 +1,201 @@
+#include "benchmark.h"
+#include <unity.h>
+#include <stdio.h>
+#include <math.h>
+#include "calibration_lookup.h"
+#include "encoder.h"
+
+static uint16_t calValues[CALIBRATION_TABLE_SIZE];
+static uint32_t searchLoops;
+
+// ! copy pasted - the search replaced by calibration_lookup.c, calData[].value -> calValues[]
+static uint16_t interp(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t x){//(0-65535)
+	uint16_t dx;
+	uint16_t dy;
+	uint16_t dx2;
+	uint16_t y;
+
+	dx = x2 - x1;
+	dy = y2 - y1;
+	dx2 = x - x1;
+	y = y1 + (uint16_t)((uint32_t)dx2 * dy / dx);
+	return y;
+}
+static uint16_t CalibrationTable_reverseLookup(uint16_t encoderAngle){
+	uint16_t idx1 = (uint16_t)((uint32_t)(uint16_t)(encoderAngle - calValues[0]) * CALIBRATION_TABLE_SIZE / ANGLE_STEPS);
+	uint16_t x = encoderAngle;
+	for(uint16_t i = 0; i < 20U; i++){
+		searchLoops++;
+		uint16_t x1 = calValues[idx1];
+		uint16_t x_x1 = x - x1;
+		if (((int16_t)x_x1 >= 0)){
+			uint16_t idx2 = (idx1 + 1U)%CALIBRATION_TABLE_SIZE;
+			uint16_t x2 = calValues[idx2];
+			uint16_t x2_x = x2 - x;
+			if((int16_t)x2_x > 0){
+				uint16_t y1 = (uint16_t)((uint32_t) idx1 * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+				uint16_t y2 = (uint16_t)((uint32_t) idx2 * ANGLE_STEPS / CALIBRATION_TABLE_SIZE);
+				uint16_t y = interp(x1,y1,x2,y2,x);
+				return y;
+			}else{
+				idx1=(idx1+1U)%CALIBRATION_TABLE_SIZE;
+			}
+		}else{
+			idx1=(idx1-1U)%CALIBRATION_TABLE_SIZE;
+		}
+	}
+	return calValues[idx1];
+}
+
+static uint32_t lcg_state = 1U;
+static int32_t noise(int32_t amplitude){
+	lcg_state = (lcg_state * 1103515245U) + 12345U;
+	return (int32_t)((lcg_state >> 8) % (uint32_t)(2 * amplitude + 1)) - amplitude;
+}
+
+//encoder angle at the calibration points - offset, eccentricity (1st and 2nd harmonic) and noise, within CALIBRATION_MAX_ERROR
+static void make_table(uint16_t offset, float amp1, float amp2, int32_t noise_amp){
+	for (uint16_t i = 0; i < CALIBRATION_TABLE_SIZE; i++){
+		float phase = 2.0f * 3.14159265f * (float)i / (float)CALIBRATION_TABLE_SIZE;
+		int32_t err = (int32_t)((amp1 * sinf(phase + 0.3f)) + (amp2 * sinf((2.0f * phase) + 1.1f))) + noise(noise_amp);
+		calValues[i] = (uint16_t)(offset + (uint16_t)((uint32_t)i * ANGLE_STEPS / CALIBRATION_TABLE_SIZE) + (uint16_t)err);
+	}
+	CalibrationLookup_build(calValues);
+}
+
+static void assert_all_angles_equal(void){
+	for (uint32_t x = 0; x < ANGLE_STEPS; x++){
+		uint16_t expected = CalibrationTable_reverseLookup((uint16_t)x);
+		uint16_t actual = CalibrationLookup_angle((uint16_t)x);
+		if (expected != actual){
+			char msg[64];
+			(void)snprintf(msg, sizeof(msg), "encoder angle %u", (unsigned)x);
+			TEST_ASSERT_EQUAL_UINT16_MESSAGE(expected, actual, msg);
+		}
+	}
+}
+
+void setUp(void) {
+    lcg_state = 1U;
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+static void test_linear(void) {
+    make_table(0, 0.0f, 0.0f, 0);
+    assert_all_angles_equal();
+    make_table(12345, 0.0f, 0.0f, 0);
+    assert_all_angles_equal();
+}
+
+static void test_wrap_offsets(void) {
+    //the table wraps at every possible segment and within the buckets
+    for (uint32_t offset = 0; offset < ANGLE_STEPS; offset += 997U){
+        make_table((uint16_t)offset, 300.0f, 100.0f, 20);
+        assert_all_angles_equal();
+    }
+}
+
+static void test_large_errors(void) {
+    //shortest segment 1310 - 2*500 - longer than a bucket
+    make_table(40000, 500.0f, 0.0f, 0);
+    assert_all_angles_equal();
+    make_table(777, 250.0f, 250.0f, 0);
+    assert_all_angles_equal();
+    make_table(65000, 350.0f, 100.0f, 50);
+    assert_all_angles_equal();
+}
+
+static void test_harmonics(void) {
+    //eccentricity, GMR 2nd and 4th harmonic, a small 24th - in 1/16 angleraw
+    FlashCalHarmonics_t model = {0};
+    model.harmonics = CALIBRATION_HARMONICS_MAX;
+    model.offset = 54321;
+    model.coef[0] = 4000;   model.coef[1] = -2500;
+    model.coef[2] = 1200;   model.coef[3] = 900;
+    model.coef[6] = -300;   model.coef[7] = 450;
+    model.coef[46] = 40;    model.coef[47] = -25;
+    CalibrationLookup_buildHarmonics(&model);
+
+    for (uint32_t x = 0; x < ANGLE_STEPS; x++){
+        double phase = 2.0 * 3.14159265358979 * (double)x / (double)ANGLE_STEPS;
+        double error = 0.0;
+        for (uint16_t k = 0; k < model.harmonics; k++){
+            error += ((double)model.coef[2U * k] * cos((double)(k + 1U) * phase)) + ((double)model.coef[(2U * k) + 1U] * sin((double)(k + 1U) * phase));
+        }
+        error /= (double)(1U << CALIBRATION_HARMONIC_Q);
+        double expected = (double)x - (double)model.offset - error;
+        int16_t diff = (int16_t)(uint16_t)(CalibrationLookup_angle((uint16_t)x) - (uint16_t)(int32_t)floor(expected + 0.5));
+        if ((diff > 1) || (diff < -1)){
+            char msg[64];
+            (void)snprintf(msg, sizeof(msg), "encoder angle %u", (unsigned)x);
+            TEST_ASSERT_EQUAL_INT16_MESSAGE(0, diff, msg);
+        }
+    }
+
+    //the point table replaces the harmonic model again
+    make_table(0, 0.0f, 0.0f, 0);
+    assert_all_angles_equal();
+}
+
+static void test_hysteresis(void) {
+    int16_t bands[CALIBRATION_TABLE_SIZE];
+    for (uint16_t i = 0; i < CALIBRATION_TABLE_SIZE; i++){
+        bands[i] = (int16_t)(-100 + (int16_t)(4U * i)); //steps back at the wrap
+    }
+    CalibrationLookup_buildHysteresis(bands);
+    for (uint32_t angle = 0; angle < ANGLE_STEPS; angle++){
+        double position = (double)angle * (double)CALIBRATION_TABLE_SIZE / (double)ANGLE_STEPS;
+        uint16_t i = (uint16_t)position;
+        double b1 = bands[i];
+        double b2 = bands[(i + 1U) % CALIBRATION_TABLE_SIZE];
+        double expected = (b1 + ((b2 - b1) * (position - (double)i))) / 2.0;
+        int16_t half = CalibrationLookup_hysteresis((uint16_t)angle);
+        if (fabs((double)half - expected) > 1.0){
+            char msg[64];
+            (void)snprintf(msg, sizeof(msg), "shaft angle %u", (unsigned)angle);
+            TEST_ASSERT_EQUAL_INT16_MESSAGE((int16_t)expected, half, msg);
+        }
+    }
+}
+
+static void test_benchmark(void) {
+    const uint32_t repeats = 50U;
+    volatile uint16_t sink = 0;
+    make_table(21000, 300.0f, 100.0f, 20);
+
+    searchLoops = 0;
+    double t0 = benchmark_now_ns();
+    for (uint32_t r = 0; r < repeats; r++){
+        for (uint32_t x = 0; x < ANGLE_STEPS; x++){
+            sink = CalibrationTable_reverseLookup((uint16_t)x);
+        }
+    }
+    double t1 = benchmark_now_ns();
+    for (uint32_t r = 0; r < repeats; r++){
+        for (uint32_t x = 0; x < ANGLE_STEPS; x++){
+            sink = CalibrationLookup_angle((uint16_t)x);
+        }
+    }
+    double t2 = benchmark_now_ns();
+    (void)sink;
+
+    double n = (double)repeats * (double)ANGLE_STEPS;
+    char msg[128];
+    (void)snprintf(msg, sizeof(msg), "search %.1f ns (%.2f loops), lookup %.1f ns per angle",
+        (t1 - t0) / n, (double)searchLoops / n, (t2 - t1) / n);
+    TEST_MESSAGE(msg);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_linear);
+    RUN_TEST(test_wrap_offsets);
+    RUN_TEST(test_large_errors);
+    RUN_TEST(test_harmonics);
+    RUN_TEST(test_hysteresis);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,156 @@
+#include <unity.h>
+#include <string.h>
+#include "calibration_record.h"
+#include "encoder.h"
+
+static FlashCalRecord_t record;
+
+//encoder angle at the calibration points - offset and a smooth error
+static void make_table(uint16_t *table, uint16_t size, uint16_t offset){
+    for (uint16_t i = 0; i < size; i++){
+        uint16_t phase = (uint16_t)((uint32_t)i * ANGLE_STEPS / size);
+        int16_t err = (int16_t)((phase < 32768U) ? (phase / 256U) : ((65535U - phase) / 256U)); //triangle, 0-128
+        table[i] = (uint16_t)(offset + phase + (uint16_t)err);
+    }
+}
+
+void setUp(void) {
+    (void)memset(&record, 0, sizeof(record));
+    record.header.type = (uint16_t)CAL_RECORD_TABLE;
+    record.header.size = CALIBRATION_TABLE_SIZE;
+    record.header.fullSteps = 200;
+    record.header.counter = 7;
+    make_table(record.payload.table, CALIBRATION_TABLE_SIZE, 60000);
+    CalibrationRecord_seal(&record);
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+static void test_crc32_check_value(void) {
+    const uint8_t data[] = "123456789";
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926U, CalibrationRecord_crc32(data, 9U, 0U));
+    //incremental
+    uint32_t crc = CalibrationRecord_crc32(data, 4U, 0U);
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926U, CalibrationRecord_crc32(&data[4], 5U, crc));
+}
+
+static void test_sealed_record_valid(void) {
+    TEST_ASSERT_EQUAL_HEX16(CALIBRATION_RECORD_MAGIC, record.header.magic);
+    TEST_ASSERT_EQUAL_UINT16(CALIBRATION_RECORD_VERSION, record.header.version);
+    TEST_ASSERT_TRUE(CalibrationRecord_valid(&record));
+}
+
+static void test_corruption_detected(void) {
+    record.payload.table[CALIBRATION_TABLE_SIZE - 1U] ^= 0x0100U;
+    TEST_ASSERT_FALSE(CalibrationRecord_valid(&record));
+    setUp();
+    record.header.counter++;
+    TEST_ASSERT_FALSE(CalibrationRecord_valid(&record));
+    setUp();
+    record.header.size = CALIBRATION_TABLE_SIZE_MAX + 1U;
+    CalibrationRecord_seal(&record);
+    TEST_ASSERT_FALSE(CalibrationRecord_valid(&record));
+    setUp();
+    record.header.version = CALIBRATION_RECORD_VERSION + 1U;
+    TEST_ASSERT_FALSE(CalibrationRecord_valid(&record));
+
+    //erased flash
+    (void)memset(&record, 0xFF, sizeof(record));
+    TEST_ASSERT_FALSE(CalibrationRecord_valid(&record));
+}
+
+static void test_harmonic_record(void) {
+    (void)memset(&record, 0, sizeof(record));
+    record.header.type = (uint16_t)CAL_RECORD_HARMONICS;
+    record.header.size = 4;
+    record.payload.harmonics.harmonics = 4;
+    record.payload.harmonics.coef[0] = 1234;
+    CalibrationRecord_seal(&record);
+    TEST_ASSERT_EQUAL_UINT16(sizeof(FlashCalHarmonics_t), CalibrationRecord_payloadSize(&record.header));
+    TEST_ASSERT_TRUE(CalibrationRecord_valid(&record));
+
+    record.payload.harmonics.harmonics = 5; //header and model disagree
+    CalibrationRecord_seal(&record);
+    TEST_ASSERT_FALSE(CalibrationRecord_valid(&record));
+}
+
+static void test_hysteresis_record(void) {
+    record.header.type = (uint16_t)CAL_RECORD_TABLE_HYSTERESIS;
+    for (uint16_t i = 0; i < CALIBRATION_TABLE_SIZE; i++){
+        record.payload.table[CALIBRATION_TABLE_SIZE + i] = (uint16_t)(int16_t)(-40 + (int16_t)(i % 7U));
+    }
+    CalibrationRecord_seal(&record);
+    TEST_ASSERT_EQUAL_UINT16(4U * CALIBRATION_TABLE_SIZE, CalibrationRecord_payloadSize(&record.header));
+    TEST_ASSERT_TRUE(CalibrationRecord_valid(&record));
+    TEST_ASSERT_EQUAL_INT16(-40, CalibrationRecord_band(&record, 0));
+    TEST_ASSERT_EQUAL_INT16(-34, CalibrationRecord_band(&record, 6));
+    record.payload.table[CALIBRATION_TABLE_SIZE] ^= 0x0001U; //the band is covered by the crc
+    TEST_ASSERT_FALSE(CalibrationRecord_valid(&record));
+
+    //the band halves the table size that fits the row
+    record.header.size = CALIBRATION_HYSTERESIS_SIZE_MAX + 1U;
+    TEST_ASSERT_EQUAL_UINT16(0, CalibrationRecord_payloadSize(&record.header));
+    record.header.type = (uint16_t)CAL_RECORD_TABLE;
+    TEST_ASSERT_NOT_EQUAL(0, CalibrationRecord_payloadSize(&record.header));
+}
+
+static void test_resample_band(void) {
+    int16_t src[50];
+    int16_t fine[200];
+    int16_t back[50];
+    for (uint16_t i = 0; i < 50U; i++){
+        src[i] = (int16_t)((i < 25U) ? (-60 + (int16_t)i) : (10 - (int16_t)i)); //negative, steps at the wrap
+    }
+    CalibrationRecord_resampleBand(src, 50, fine, 200);
+    for (uint16_t i = 0; i < 50U; i++){
+        TEST_ASSERT_EQUAL_INT16(src[i], fine[4U * i]);
+        for (uint16_t k = 1; k < 4U; k++){
+            int32_t next = src[(i + 1U) % 50U];
+            int32_t expected = src[i] + ((next - src[i]) * (int32_t)k / 4);
+            TEST_ASSERT_INT16_WITHIN(1, expected, fine[(4U * i) + k]);
+        }
+    }
+    CalibrationRecord_resampleBand(fine, 200, back, 50);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(src, back, 50);
+}
+
+static void test_resample_same_size(void) {
+    uint16_t table[CALIBRATION_TABLE_SIZE];
+    CalibrationRecord_resample(record.payload.table, CALIBRATION_TABLE_SIZE, table, CALIBRATION_TABLE_SIZE);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(record.payload.table, table, CALIBRATION_TABLE_SIZE);
+}
+
+static void test_resample_up_and_down(void) {
+    uint16_t src[50];
+    uint16_t fine[200];
+    uint16_t back[50];
+    make_table(src, 50, 65000); //wraps
+    CalibrationRecord_resample(src, 50, fine, 200);
+    for (uint16_t i = 0; i < 50U; i++){
+        TEST_ASSERT_EQUAL_UINT16(src[i], fine[4U * i]); //the measured points are kept
+        //the points in between are on the line - within rounding
+        for (uint16_t k = 1; k < 4U; k++){
+            uint16_t next = src[(i + 1U) % 50U];
+            int32_t expected = (int32_t)src[i] + (int32_t)((int16_t)(uint16_t)(next - src[i]) * (int32_t)k / 4);
+            int16_t diff = (int16_t)(uint16_t)(fine[(4U * i) + k] - (uint16_t)expected);
+            TEST_ASSERT_INT16_WITHIN(1, 0, diff);
+        }
+    }
+    CalibrationRecord_resample(fine, 200, back, 50);
+    TEST_ASSERT_EQUAL_UINT16_ARRAY(src, back, 50);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_crc32_check_value);
+    RUN_TEST(test_sealed_record_valid);
+    RUN_TEST(test_corruption_detected);
+    RUN_TEST(test_harmonic_record);
+    RUN_TEST(test_hysteresis_record);
+    RUN_TEST(test_resample_same_size);
+    RUN_TEST(test_resample_up_and_down);
+    RUN_TEST(test_resample_band);
+    return UNITY_END();
+}
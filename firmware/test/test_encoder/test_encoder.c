@@ -0,0 +1,125 @@
+#include <unity.h>
+#include <stddef.h>
+#include "encoder.h"
+
+//recorded angles - played back one per read
+static const uint16_t trace[] = {65530, 65534, 2, 6, 100, 200};
+static uint16_t tracePos;
+static bool firstAnswers;
+static uint16_t started;
+
+static uint16_t trace_angle(void){
+    uint16_t angle = trace[tracePos];
+    tracePos = (uint16_t)((tracePos + 1U) % (sizeof(trace) / sizeof(trace[0])));
+    return angle;
+}
+
+static bool first_begin(void){
+    return firstAnswers;
+}
+
+static bool second_begin(void){
+    return true;
+}
+
+static void mock_start(void){
+    started = trace_angle();
+}
+
+static bool mock_fetch(EncoderSample_t *sample){
+    sample->angle = (started != UINT16_MAX) ? started : trace_angle();
+    sample->speed = 0;
+    sample->revolutions = 0;
+    started = UINT16_MAX;
+    return true;
+}
+
+static uint16_t mock_faults(void){
+    return 3;
+}
+
+static bool mock_profile(EncoderProfile_t profile){
+    return (profile != ENCODER_PROFILE_LOW_NOISE);
+}
+
+static const EncoderDriver_t first = {
+    .name = "first", .begin = first_begin, .readAngle = trace_angle, .startRead = mock_start,
+    .fetch = mock_fetch, .faultsInRow = mock_faults,
+    .setProfile = NULL, .latency_us = {64U},
+};
+
+static const EncoderDriver_t second = {
+    .name = "second", .begin = second_begin, .readAngle = trace_angle, .startRead = mock_start,
+    .fetch = mock_fetch, .faultsInRow = mock_faults,
+    .setProfile = mock_profile, .latency_us = {5U, 20U, 80U},
+};
+
+const EncoderDriver_t *const boardEncoders[] = {&first, &second, NULL};
+
+void setUp(void) {
+    tracePos = 0;
+    started = UINT16_MAX;
+    firstAnswers = true;
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+static void test_select_first_answering(void) {
+    TEST_ASSERT_TRUE(Encoder_begin());
+    TEST_ASSERT_EQUAL_PTR(&first, Encoder_driver());
+    TEST_ASSERT_EQUAL_UINT16(64, Encoder_latency_us());
+
+    firstAnswers = false;
+    TEST_ASSERT_TRUE(Encoder_begin());
+    TEST_ASSERT_EQUAL_PTR(&second, Encoder_driver());
+    TEST_ASSERT_EQUAL_UINT16(5, Encoder_latency_us());
+}
+
+static void test_profile_latency(void) {
+    TEST_ASSERT_TRUE(Encoder_begin());
+    TEST_ASSERT_FALSE(Encoder_setProfile(ENCODER_PROFILE_BALANCED)); //no filter settings
+    TEST_ASSERT_EQUAL_UINT16(64, Encoder_latency_us());
+    Encoder_setLatency_us(100);
+    TEST_ASSERT_EQUAL_UINT16(100, Encoder_latency_us());
+
+    firstAnswers = false;
+    TEST_ASSERT_TRUE(Encoder_begin()); //back to the nominal latency
+    TEST_ASSERT_EQUAL_UINT16(5, Encoder_latency_us());
+    TEST_ASSERT_TRUE(Encoder_setProfile(ENCODER_PROFILE_BALANCED));
+    TEST_ASSERT_EQUAL_UINT16(20, Encoder_latency_us());
+    TEST_ASSERT_FALSE(Encoder_setProfile(ENCODER_PROFILE_LOW_NOISE)); //rejected by the sensor
+    TEST_ASSERT_EQUAL(ENCODER_PROFILE_BALANCED, Encoder_profile());
+    Encoder_setLatency_us(33);
+    TEST_ASSERT_EQUAL_UINT16(33, Encoder_latency_us());
+    Encoder_setLatency_us(ENCODER_LATENCY_NOMINAL);
+    TEST_ASSERT_EQUAL_UINT16(20, Encoder_latency_us());
+}
+
+static void test_read_ahead(void) {
+    TEST_ASSERT_TRUE(Encoder_begin());
+    Encoder_startRead();            //samples 65530
+    (void)ReadEncoderAngle();       //65534 - does not replace the started sample
+    EncoderSample_t sample;
+    TEST_ASSERT_TRUE(FetchEncoderSample(&sample));
+    TEST_ASSERT_EQUAL_UINT16(65530, sample.angle);
+    TEST_ASSERT_TRUE(FetchEncoderSample(&sample)); //nothing started - direct read
+    TEST_ASSERT_EQUAL_UINT16(2, sample.angle);
+    TEST_ASSERT_EQUAL_UINT16(3, Encoder_faultsInRow());
+}
+
+static void test_oversample_wraps(void) {
+    TEST_ASSERT_TRUE(Encoder_begin());
+    //65530 is the reference, then 65534, 2, 6 - mean 2 across the wrap
+    TEST_ASSERT_EQUAL_UINT16(2, OverSampleEncoderAngle(3));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_select_first_answering);
+    RUN_TEST(test_profile_latency);
+    RUN_TEST(test_read_ahead);
+    RUN_TEST(test_oversample_wraps);
+    return UNITY_END();
+}
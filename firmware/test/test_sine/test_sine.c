@@ -0,0 +1,108 @@
+#include "benchmark.h"
+#include <unity.h>
+#include <stdio.h>
+#include "sine.h"
+
+// ! copy pasted - the flash table version replaced by sine_ripple_profile()
+static int16_t flash_sine_ripple(uint16_t electric_angle, int8_t strength){
+   int16_t sin_x = sine(electric_angle);
+   int16_t sin_3x = sine((3U*electric_angle) % SINE_STEPS);
+
+   //max_ratio  is on purpose 8x value of int8 to only allow for 1/8 of a ratio
+   const int16_t max_ratio = 1024U;
+   int16_t sin_x_ratio = max_ratio-strength;
+   int16_t sin_3x_ratio = strength;
+
+   int16_t sine_comp = (int16_t)((((int32_t)sin_x_ratio * sin_x) - ((int32_t)sin_3x_ratio * sin_3x))/(int16_t)max_ratio);
+   return sine_comp;
+}
+
+static int16_t flash_cosine_ripple(uint16_t electric_angle, int8_t strength){
+   return flash_sine_ripple(electric_angle + SINE_PI, strength);
+}
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+//the 3rd harmonic alone matches the flash table version bit for bit
+static void test_third_harmonic(void) {
+    const int8_t strengths[] = {0, 30, 127, -128};
+    for (uint8_t s = 0; s < (sizeof(strengths) / sizeof(strengths[0])); s++){
+        sine_ripple_profile(strengths[s], 0);
+        for (uint32_t angle = 0; angle <= UINT16_MAX; angle += 7U){
+            TEST_ASSERT_EQUAL_INT16(flash_sine_ripple((uint16_t)angle, strengths[s]), sine_ripple((uint16_t)angle));
+            TEST_ASSERT_EQUAL_INT16(flash_cosine_ripple((uint16_t)angle, strengths[s]), cosine_ripple((uint16_t)angle));
+        }
+    }
+}
+
+static void test_fifth_harmonic(void) {
+    sine_ripple_profile(30, 40);
+    TEST_ASSERT_EQUAL_INT16(32767, sine_ripple(SINE_PI)); //peak kept
+    TEST_ASSERT_EQUAL_INT16(0, sine_ripple(0));
+    for (uint16_t angle = 0; angle < SINE_STEPS; angle++){
+        TEST_ASSERT_EQUAL_INT16(sine_ripple(angle + SINE_PI), cosine_ripple(angle));
+        TEST_ASSERT_EQUAL_INT16(-sine_ripple(angle), sine_ripple(angle + (2U * SINE_PI)));
+    }
+    //(1024-30-40)/1024*sin(x) - 30/1024*sin(3x) + 40/1024*sin(5x) at 45 degrees
+    int16_t expected = (int16_t)(32767 * 0.70710678 * (1024 - 30 - 40 - 30 - 40) / 1024); //sin(3x) = sin(x), sin(5x) = -sin(x)
+    TEST_ASSERT_INT16_WITHIN(2, expected, sine_ripple(SINE_STEPS / 8U));
+}
+
+static void test_regenerate(void) {
+    sine_ripple_profile(0, 0);
+    TEST_ASSERT_EQUAL_INT16(sine(100), sine_ripple(100));
+    sine_ripple_profile(0, -128);
+    TEST_ASSERT_NOT_EQUAL(sine(100), sine_ripple(100));
+    for (uint16_t angle = 0; angle < SINE_STEPS; angle++){
+        TEST_ASSERT_TRUE(sine_ripple(angle) >= -INT16_MAX); //clipped
+    }
+    sine_ripple_profile(0, 0);
+    TEST_ASSERT_EQUAL_INT16(sine(100), sine_ripple(100));
+}
+
+static void test_benchmark(void) {
+    const uint32_t repeats = 2000U;
+    const int8_t strength = 30;
+    volatile int16_t sink = 0;
+    volatile int8_t strength_in = strength; //the factor is not known at compile time in the firmware
+    sine_ripple_profile(strength, 0);
+
+    double t0 = benchmark_now_ns();
+    for (uint32_t r = 0; r < repeats; r++){
+        for (uint16_t angle = 0; angle < SINE_STEPS; angle++){
+            sink = flash_sine_ripple(angle, strength_in);
+            sink = flash_cosine_ripple(angle, strength_in);
+        }
+    }
+    double t1 = benchmark_now_ns();
+    for (uint32_t r = 0; r < repeats; r++){
+        for (uint16_t angle = 0; angle < SINE_STEPS; angle++){
+            sink = sine_ripple(angle);
+            sink = cosine_ripple(angle);
+        }
+    }
+    double t2 = benchmark_now_ns();
+    sine_ripple_profile(strength, 1);
+    sine_ripple_profile(strength, 0);
+    double t3 = benchmark_now_ns();
+    (void)sink;
+
+    double n = (double)repeats * (double)SINE_STEPS;
+    char msg[128];
+    (void)snprintf(msg, sizeof(msg), "flash %.2f ns, RAM table %.2f ns per sine and cosine, regeneration %.1f us",
+        (t1 - t0) / n, (t2 - t1) / n, (t3 - t2) / 2e3);
+    TEST_MESSAGE(msg);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_third_harmonic);
+    RUN_TEST(test_fifth_harmonic);
+    RUN_TEST(test_regenerate);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
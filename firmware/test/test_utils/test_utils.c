@@ -36,9 +36,20 @@ static void test_minimum(void) {
     TEST_ASSERT_EQUAL_FLOAT(min(-2.5f, -1.2f), -2.5f);
 }
 
+static void test_isqrt32(void) {
+    TEST_ASSERT_EQUAL(0, isqrt32(0U));
+    TEST_ASSERT_EQUAL(1, isqrt32(3U));
+    TEST_ASSERT_EQUAL(2, isqrt32(4U));
+    TEST_ASSERT_EQUAL(3299, isqrt32(3300U * 3300U - 1U));
+    TEST_ASSERT_EQUAL(3300, isqrt32(3300U * 3300U));
+    TEST_ASSERT_EQUAL(5000, isqrt32(3000U * 3000U + 4000U * 4000U));
+    TEST_ASSERT_EQUAL(65535, isqrt32(UINT32_MAX));
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_maximum);
     RUN_TEST(test_minimum);
+    RUN_TEST(test_isqrt32);
     return UNITY_END();
 }